@@ -10,11 +10,23 @@
 #define s16 int16_t
 #define s32 int32_t
 #define s64 int64_t
-typedef struct {
+typedef s8  v8qi __attribute__((vector_size(8)));
+typedef u8  v8qu __attribute__((vector_size(8)));
+typedef s16 v4hi __attribute__((vector_size(8)));
+typedef u16 v4hu __attribute__((vector_size(8)));
+typedef s32 v2si __attribute__((vector_size(8)));
+typedef u32 v2su __attribute__((vector_size(8)));
+typedef union {
   u64 q;
   u32 d[2];
   u16 w[4];
   u8  b[8];
+  v8qi vb;
+  v8qu vub;
+  v4hi vw;
+  v4hu vuw;
+  v2si vd;
+  v2su vud;
 } mmxr;
 
 #define bool int
@@ -51,14 +63,185 @@ static inline BOOL PtInRect_sa(LPCRECT r, int x, int y)
   return PtInRect(r, p);
 }
 
+/* x86 PF: set if the low byte has an even number of bits set */
 static inline int do_parity(unsigned int v)
 {
-  v ^= v >> 4;
-  v ^= v >> 2;
-  v ^= v >> 1;
-  return (v ^ 1) & 1;
+  return !__builtin_parity(v & 0xff);
 }
 
+/* rcl/rcr with a variable count already masked to 5 bits,
+ * rotates bits + 1 bits through *cf */
+static inline u32 do_rcl(u32 v, u32 n, u32 *cf, int bits)
+{
+  u32 mask = bits == 32 ? ~0u : (1u << bits) - 1;
+  u64 x = ((u64)(*cf & 1) << bits) | (v & mask);
+
+  n %= bits + 1;
+  if (n == 0)
+    return v;
+  x = (x << n) | (x >> (bits + 1 - n));
+  *cf = (x >> bits) & 1;
+  return (u32)x & mask;
+}
+
+static inline u32 do_rcr(u32 v, u32 n, u32 *cf, int bits)
+{
+  u32 mask = bits == 32 ? ~0u : (1u << bits) - 1;
+  u64 x = ((u64)(*cf & 1) << bits) | (v & mask);
+
+  n %= bits + 1;
+  if (n == 0)
+    return v;
+  x = (x >> n) | (x << (bits + 1 - n));
+  *cf = (x >> bits) & 1;
+  return (u32)x & mask;
+}
+
+/* mmx, regs are plain vars so there is no x87 state to restore */
+#define do_emms()
+
+static inline mmxr mmx_q(u64 q)
+{
+  mmxr r;
+  r.q = q;
+  return r;
+}
+
+/* packed ops that have no plain vector expression,
+ * signed saturation: overflowed lanes get the limit by sign of a */
+#define MMX_ADDS(name, m, um, bits, max, op, ov) \
+static inline mmxr mmx_##name(mmxr a, mmxr b) \
+{ \
+  mmxr r, s, o; \
+  r.um = a.um op b.um; \
+  s.m = (a.m >> (bits - 1)) ^ max; \
+  o.m = (ov) >> (bits - 1); \
+  r.q = (r.q & ~o.q) | (s.q & o.q); \
+  return r; \
+}
+MMX_ADDS(paddsb, vb, vub, 8, 0x7f, +, (a.vb ^ r.vb) & (b.vb ^ r.vb))
+MMX_ADDS(paddsw, vw, vuw, 16, 0x7fff, +, (a.vw ^ r.vw) & (b.vw ^ r.vw))
+MMX_ADDS(psubsb, vb, vub, 8, 0x7f, -, (a.vb ^ b.vb) & (a.vb ^ r.vb))
+MMX_ADDS(psubsw, vw, vuw, 16, 0x7fff, -, (a.vw ^ b.vw) & (a.vw ^ r.vw))
+#undef MMX_ADDS
+
+/* unsigned saturation: compares give all ones lanes */
+#define MMX_ADDUS(name, m, um) \
+static inline mmxr mmx_padd##name(mmxr a, mmxr b) \
+{ \
+  mmxr r; \
+  r.um = a.um + b.um; \
+  r.m |= r.um < a.um; \
+  return r; \
+} \
+static inline mmxr mmx_psub##name(mmxr a, mmxr b) \
+{ \
+  mmxr r; \
+  r.um = a.um - b.um; \
+  r.m &= a.um >= b.um; \
+  return r; \
+}
+MMX_ADDUS(usb, vb, vub)
+MMX_ADDUS(usw, vw, vuw)
+#undef MMX_ADDUS
+
+/* counts above the element size clear the lanes, or fill with sign */
+#define MMX_SHIFT(name, m, op, bits, big) \
+static inline mmxr mmx_##name(mmxr a, u64 n) \
+{ \
+  if (n > bits - 1) \
+    big; \
+  else \
+    a.m op##= n; \
+  return a; \
+}
+MMX_SHIFT(psllw, vuw, <<, 16, a.q = 0)
+MMX_SHIFT(pslld, vud, <<, 32, a.q = 0)
+MMX_SHIFT(psllq, q,   <<, 64, a.q = 0)
+MMX_SHIFT(psrlw, vuw, >>, 16, a.q = 0)
+MMX_SHIFT(psrld, vud, >>, 32, a.q = 0)
+MMX_SHIFT(psrlq, q,   >>, 64, a.q = 0)
+MMX_SHIFT(psraw, vw,  >>, 16, a.vw >>= 15)
+MMX_SHIFT(psrad, vd,  >>, 32, a.vd >>= 31)
+#undef MMX_SHIFT
+
+static inline mmxr mmx_pmulhw(mmxr a, mmxr b)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    a.w[i] = ((s32)(s16)a.w[i] * (s16)b.w[i]) >> 16;
+  return a;
+}
+
+static inline mmxr mmx_pmaddwd(mmxr a, mmxr b)
+{
+  mmxr r;
+  int i;
+
+  // u32 sum, 0x8000 * 0x8000 * 2 wraps like the cpu does
+  for (i = 0; i < 2; i++)
+    r.d[i] = (u32)((s16)a.w[i * 2] * (s16)b.w[i * 2])
+      + (u32)((s16)a.w[i * 2 + 1] * (s16)b.w[i * 2 + 1]);
+  return r;
+}
+
+static inline s32 mmx_sat(s32 v, s32 min, s32 max)
+{
+  return v < min ? min : v > max ? max : v;
+}
+
+static inline mmxr mmx_packsswb(mmxr a, mmxr b)
+{
+  mmxr r;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    r.b[i]     = mmx_sat((s16)a.w[i], -0x80, 0x7f);
+    r.b[i + 4] = mmx_sat((s16)b.w[i], -0x80, 0x7f);
+  }
+  return r;
+}
+
+static inline mmxr mmx_packuswb(mmxr a, mmxr b)
+{
+  mmxr r;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    r.b[i]     = mmx_sat((s16)a.w[i], 0, 0xff);
+    r.b[i + 4] = mmx_sat((s16)b.w[i], 0, 0xff);
+  }
+  return r;
+}
+
+static inline mmxr mmx_packssdw(mmxr a, mmxr b)
+{
+  mmxr r;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    r.w[i]     = mmx_sat((s32)a.d[i], -0x8000, 0x7fff);
+    r.w[i + 2] = mmx_sat((s32)b.d[i], -0x8000, 0x7fff);
+  }
+  return r;
+}
+
+/* interleave low or high halves, a goes to even lanes */
+#define MMX_UNPACK(name, m, ...) \
+static inline mmxr mmx_##name(mmxr a, mmxr b) \
+{ \
+  a.m = __builtin_shuffle(a.m, b.m, (__typeof__(a.m)){ __VA_ARGS__ }); \
+  return a; \
+}
+MMX_UNPACK(punpcklbw, vb, 0, 8, 1, 9, 2, 10, 3, 11)
+MMX_UNPACK(punpckhbw, vb, 4, 12, 5, 13, 6, 14, 7, 15)
+MMX_UNPACK(punpcklwd, vw, 0, 4, 1, 5)
+MMX_UNPACK(punpckhwd, vw, 2, 6, 3, 7)
+MMX_UNPACK(punpckldq, vd, 0, 2)
+MMX_UNPACK(punpckhdq, vd, 1, 3)
+#undef MMX_UNPACK
+
 #define do_skip_code_abort() \
   printf("%s:%d: skip_code_abort\n", __FILE__, __LINE__); \
   *(volatile int *)0 = 1
@@ -66,6 +249,45 @@ static inline int do_parity(unsigned int v)
 #define barrier() \
   asm volatile("" ::: "memory")
 
+/* rep movs/stos with DF clear, n is the element count */
+static inline void rep_movs(u32 dst, u32 src, u32 n, int size)
+{
+  u32 i;
+
+  // memmove matches unless dst overlaps the src tail,
+  // a forward copy replicates the pattern then
+  if (dst - src >= n * size) {
+    memmove((void *)dst, (const void *)src, n * size);
+    return;
+  }
+  for (i = 0; i < n * size; i += size) {
+    if (size == 1)
+      *(u8 *)(dst + i) = *(const u8 *)(src + i);
+    else if (size == 2)
+      *(u16 *)(dst + i) = *(const u16 *)(src + i);
+    else
+      *(u32 *)(dst + i) = *(const u32 *)(src + i);
+  }
+}
+
+static inline void rep_stos(u32 dst, u32 v, u32 n, int size)
+{
+  u32 i;
+
+  if (size == 1 || (size == 2 && (u16)v == (u8)v * 0x0101u)
+      || (size == 4 && v == (u8)v * 0x01010101u))
+  {
+    memset((void *)dst, (u8)v, n * size);
+    return;
+  }
+  for (i = 0; i < n * size; i += size) {
+    if (size == 2)
+      *(u16 *)(dst + i) = v;
+    else
+      *(u32 *)(dst + i) = v;
+  }
+}
+
 /* gcc always emits vldr/vstr which requires alignment,
  * so in some cases these unaligned helpers are needed */
 #ifdef __ARM_NEON__
@@ -0,0 +1,42 @@
+_text           segment para public 'CODE' use32
+
+sub_test        proc near
+
+arg_0           = dword ptr  4
+
+                push    ebx
+                mov     ecx, [esp+4+arg_0]
+                mov     eax, 1
+                lock xadd [ecx], eax
+                mov     edx, 2
+                lock cmpxchg [ecx+8], edx
+                jnz     short loc_busy
+                lock or dword ptr [ecx+0Ch], 10h
+                lock add dword ptr [ecx+10h], 3
+                jb      short loc_busy
+                xchg    eax, [ecx+14h]
+                mov     ebx, eax
+                xor     eax, eax
+                xor     edx, edx
+                lock cmpxchg8b qword ptr [ecx+18h]
+                jnz     short loc_busy
+                lock dec dword ptr [ecx+4]
+                jz      short loc_free
+
+loc_busy:
+                xor     eax, eax
+                pop     ebx
+                retn
+
+loc_free:
+                mov     eax, 1
+                mov     edx, ebx
+                cmpxchg edx, ecx
+                xadd    eax, edx
+                pop     ebx
+                retn
+sub_test        endp
+
+_text           ends
+
+; vim:expandtab
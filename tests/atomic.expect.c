@@ -0,0 +1,57 @@
+int sub_test(int a1)
+{
+  u32 eax;
+  u32 ebx;
+  u32 ecx;
+  u32 edx;
+  u32 cond_c;
+  u32 cond_z;
+  u32 tmp;
+  u64 tmp64;
+
+  ecx = (u32)a1;  // arg_0
+  eax = 1;
+  tmp = __atomic_fetch_add((u32 *)(ecx), eax, __ATOMIC_SEQ_CST);
+  eax = tmp;  // lock
+  edx = 2;
+  { u32 t = eax;
+    cond_z = __atomic_compare_exchange_n((u32 *)(ecx+8), &t, edx, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    eax = t; }  // lock
+  if (!cond_z)
+    goto loc_busy;
+  __atomic_fetch_or((u32 *)(ecx+0x0c), 0x10, __ATOMIC_SEQ_CST);  // lock
+  tmp = __atomic_add_fetch((u32 *)(ecx+0x10), 3, __ATOMIC_SEQ_CST);
+  cond_c = (tmp < 3);  // lock
+  if (cond_c)
+    goto loc_busy;
+  eax = __atomic_exchange_n((u32 *)(ecx+0x14), eax, __ATOMIC_SEQ_CST);
+  ebx = eax;
+  eax = 0;
+  edx = 0;
+  tmp64 = ((u64)edx << 32) | eax;
+  cond_z = __atomic_compare_exchange_n((u64 *)(ecx+0x18), &tmp64, ((u64)ecx << 32) | ebx, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  edx = tmp64 >> 32; eax = tmp64;  // lock
+  if (!cond_z)
+    goto loc_busy;
+  tmp = __atomic_sub_fetch((u32 *)(ecx+4), 1, __ATOMIC_SEQ_CST);
+  cond_z = (tmp == 0);  // lock
+  if (cond_z)
+    goto loc_free;
+
+loc_busy:
+  eax = 0;
+  return eax;
+
+loc_free:
+  eax = 1;
+  edx = ebx;
+  if (eax == edx)
+    edx = ecx;
+  else
+    eax = edx;
+  tmp = eax + edx;
+  edx = eax;
+  eax = tmp;
+  return eax;
+}
+
@@ -0,0 +1 @@
+int __cdecl sub_test(int a1);
@@ -0,0 +1,94 @@
+#!/bin/sh
+# times the tools on a generated IDA-style .asm and compares
+# the results against bench.baseline
+# usage: ./bench.sh [-u] [funcs] [ops]
+#   -u - store the results as the new baseline
+
+update=0
+if [ "$1" = "-u" ]; then
+  update=1
+  shift
+fi
+
+funcs=${1:-1000}
+ops=${2:-1000}
+params="funcs=$funcs ops=$ops"
+
+now_ms() {
+  echo $(($(date +%s%N) / 1000000))
+}
+
+# run a command with output to bench.log, sets ms and rss (peak KB)
+run() {
+  if command -v python3 > /dev/null; then
+    set -- $(python3 -c '
+import resource, subprocess, sys, time
+t = time.time()
+r = subprocess.call(sys.argv[1:], stdout=open("bench.log", "w"),
+  stderr=subprocess.STDOUT)
+ms = int((time.time() - t) * 1000)
+rss = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+print(r, ms, rss)' "$@")
+    ret=$1 ms=$2 rss=$3
+  else
+    t=$(now_ms)
+    "$@" > bench.log 2>&1
+    ret=$?
+    ms=$(($(now_ms) - t))
+    rss="?"
+  fi
+  if [ "$ret" != 0 ]; then
+    cat bench.log
+    exit 1
+  fi
+}
+
+# report name input_lines, uses ms/rss from last run
+report() {
+  lps=$(($2 * 1000 / (ms + 1)))
+  vs=""
+  if [ -n "$base_ok" ]; then
+    set -- $1 $(awk -v n=$1 '$1 == n { print $2, $3 }' bench.baseline)
+    if [ -n "$2" ]; then
+      vs="$(((lps - $2) * 100 / ($2 + 1)))% lines/s"
+      if [ "$rss" != "?" ] && [ "$3" != "?" ]; then
+        vs="$vs, $(((rss - $3) * 100 / ($3 + 1)))% rss"
+      fi
+    fi
+  fi
+  printf "%-10s %7dms %9d lines/s %8s KB  %s\n" $1 $ms $lps $rss "$vs"
+  echo "$1 $lps $rss" >> bench.new
+}
+
+awk -v funcs=$funcs -v ops=$ops -v seed=bench.seed.h -f gen_asm.awk \
+  > bench.asm || exit 1
+grep "proc near" bench.asm | awk '{ print $1 }' > bench.syms
+lines=$(wc -l < bench.asm)
+syms=$(wc -l < bench.syms)
+
+base_ok=""
+if [ -f bench.baseline ] && grep -qx "# $params" bench.baseline; then
+  base_ok=1
+fi
+echo "# $params" > bench.new
+
+echo "$lines lines, $syms functions"
+run ../tools/translate -hdr bench.out.h bench.asm bench.seed.h ../stdc.list
+report hdr $lines
+run ../tools/translate bench.out.c bench.asm bench.out.h ../stdc.list
+report c $lines
+run ../tools/translate -hc bench.hc.h bench.hc.c bench.asm bench.seed.h \
+  ../stdc.list
+report hc $((lines * 2))
+run ../tools/cvt_data bench.out.s bench.asm bench.out.h
+report cvt_data $lines
+run ../tools/mkbridge bench.bridge.s bench.syms bench.syms bench.out.h
+report mkbridge $((syms * 2))
+
+if [ $update = 1 ]; then
+  mv bench.new bench.baseline
+  echo "baseline updated"
+else
+  rm -f bench.new
+  [ -n "$base_ok" ] || echo "no baseline for $params (use -u)"
+fi
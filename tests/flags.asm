@@ -0,0 +1,106 @@
+_text           segment para public 'CODE' use32
+
+sub_test        proc near
+
+arg_0           = dword ptr  4
+arg_4           = dword ptr  8
+
+                mov     ecx, [esp+arg_0]
+                mov     edx, [esp+arg_4]
+                xor     eax, eax
+                cmp     ecx, edx
+                jz      short loc_eq
+                mov     eax, 1
+
+loc_eq:
+                jl      short loc_lt
+                add     eax, 2
+
+loc_lt:
+                and     edx, 0Fh
+                jz      short loc_and
+                lea     eax, [eax+4]
+
+loc_and:
+                js      short loc_neg
+                test    ecx, ecx
+                jz      short loc_neg
+                lea     ecx, [ecx+1]
+
+loc_test:
+                jg      short loc_neg
+                lea     eax, [eax+8]
+
+loc_neg:
+                mov     edx, 3
+
+loc_loop:
+                add     eax, edx
+                dec     ecx
+
+loc_next:
+                jz      short loc_out
+                cmp     ecx, 100
+                jb      short loc_loop
+
+loc_out:
+                retn
+sub_test        endp
+
+sub_mem         proc near
+
+arg_0           = dword ptr  4
+arg_4           = dword ptr  8
+
+                mov     ecx, [esp+arg_0]
+                mov     edx, [esp+arg_4]
+                xor     eax, eax
+                cmp     dword ptr [ecx], 0
+                jz      short loc_m1
+                mov     dword ptr [edx], 5
+
+loc_m1:
+                jge     short loc_m2
+                inc     eax
+
+loc_m2:
+                cmp     dword ptr [ecx+4], 0
+                jz      short loc_m3
+                mov     eax, 2
+
+loc_m3:
+                jle     short loc_m4
+                add     eax, 4
+
+loc_m4:
+                retn
+sub_mem         endp
+
+; the address reg of the setter operand changes before the reader
+sub_base        proc near
+
+arg_0           = dword ptr  4
+
+                mov     ecx, [esp+arg_0]
+                xor     eax, eax
+                dec     dword ptr [ecx+4]
+                lea     ecx, [ecx+8]
+                jmp     short loc_b1
+
+loc_b1:
+                jz      short loc_b2
+                inc     eax
+
+loc_b2:
+                dec     dword ptr [ecx]
+                lea     ecx, [ecx+4]
+                jz      short loc_b3
+                add     eax, 2
+
+loc_b3:
+                retn
+sub_base        endp
+
+_text           ends
+
+; vim:expandtab
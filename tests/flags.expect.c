@@ -0,0 +1,112 @@
+int sub_test(int a1, int a2)
+{
+  u32 eax;
+  u32 ecx;
+  u32 edx;
+  u32 cond_le;
+
+  ecx = (u32)a1;  // arg_0
+  edx = (u32)a2;  // arg_4
+  eax = 0;
+  if (ecx == edx)
+    goto loc_eq;
+  eax = 1;
+
+loc_eq:
+  if ((s32)ecx < (s32)edx)
+    goto loc_lt;
+  eax += 2;
+
+loc_lt:
+  edx &= 0x0f;
+  if (edx == 0)
+    goto loc_and;
+  eax = eax+4;
+
+loc_and:
+  if ((s32)edx < 0)
+    goto loc_neg;
+  cond_le = ((s32)ecx <= 0);
+  if (ecx == 0)
+    goto loc_neg;
+  ecx = ecx+1;
+  if (!cond_le)
+    goto loc_neg;
+  eax = eax+8;
+
+loc_neg:
+  edx = 3;
+
+loc_loop:
+  eax += edx;
+  ecx--;
+  if (ecx == 0)
+    goto loc_out;
+  if (ecx < 0x64)
+    goto loc_loop;
+
+loc_out:
+  return eax;
+}
+
+int sub_mem(int * a1, int * a2)
+{
+  u32 eax;
+  u32 ecx;
+  u32 edx;
+  u32 cond_l;
+
+  ecx = (u32)a1;  // arg_0
+  edx = (u32)a2;  // arg_4
+  eax = 0;
+  cond_l = (*(s32 *)(ecx) < 0);
+  if (*(u32 *)(ecx) == 0)
+    goto loc_m1;
+  *(u32 *)(edx) = 5;
+
+loc_m1:
+  if (!cond_l)
+    goto loc_m2;
+  eax++;
+
+loc_m2:
+  if (*(u32 *)(ecx+4) == 0)
+    goto loc_m3;
+  eax = 2;
+
+loc_m3:
+  if (*(s32 *)(ecx+4) <= 0)
+    goto loc_m4;
+  eax += 4;
+
+loc_m4:
+  return eax;
+}
+
+int sub_base(int * a1)
+{
+  u32 eax;
+  u32 ecx;
+  u32 cond_z;
+
+  ecx = (u32)a1;  // arg_0
+  eax = 0;
+  *(u32 *)(ecx+4) -= 1;
+  cond_z = (*(u32 *)(ecx+4) == 0);
+  ecx = ecx+8;
+  if (cond_z)
+    goto loc_b2;
+  eax++;
+
+loc_b2:
+  *(u32 *)(ecx) -= 1;
+  cond_z = (*(u32 *)(ecx) == 0);
+  ecx = ecx+4;
+  if (cond_z)
+    goto loc_b3;
+  eax += 2;
+
+loc_b3:
+  return eax;
+}
+
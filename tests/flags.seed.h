@@ -0,0 +1,3 @@
+int __cdecl sub_test(int a1, int a2);
+int __cdecl sub_mem(int *a1, int *a2);
+int __cdecl sub_base(int *a1);
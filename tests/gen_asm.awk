@@ -0,0 +1,122 @@
+# generates a synthetic IDA-style .asm for benchmarking
+# usage: awk -v funcs=N -v ops=N [-v cases=N] [-v chunks=N] \
+#   [-v exits=N] [-v data=N] [-v seed=seed.h] -f gen_asm.awk > out.asm
+# every 4th function gets a switch of 'cases' entries, every 'chunks'th
+# one a function chunk; all save ebx/esi/edi and pop them on 'exits'
+# separate return paths; 'data' items go to a data segment, with
+# function pointer declarations for them written to 'seed'
+
+function label(a) {
+  return sprintf("loc_%X", a)
+}
+
+function body(f, cnt,  i, o) {
+  for (i = 0; i < cnt; i++) {
+    o = m[(i * 7 + f) % n + 1]
+    if (o == "inc" || o == "dec" || o == "neg" || o == "not")
+      printf "                %-8seax\n", o
+    else if (o == "lea")
+      printf "                lea     ecx, [eax+ecx*2+4]\n"
+    else if (o == "movzx")
+      printf "                movzx   edx, cl\n"
+    else if (o == "shl" || o == "shr" || o == "sar")
+      printf "                %-8seax, 3\n", o
+    else
+      printf "                %-8seax, ecx\n", o
+  }
+}
+
+BEGIN {
+  if (cases == "")
+    cases = 32
+  if (chunks == "")
+    chunks = 8
+  if (exits == "")
+    exits = 4
+  if (data == "")
+    data = funcs
+  if (seed != "")
+    printf "" > seed
+  n = split("mov add sub xor and or cmp test shl shr inc dec lea movzx " \
+            "imul neg not sar", m, " ")
+  printf "\n_text           segment para public 'CODE' use32\n\n"
+  for (f = 0; f < funcs; f++) {
+    base = 4198400 + f * 4096
+    name = sprintf("sub_%X", base)
+    has_sw = (f % 4 == 3)
+    has_ch = (chunks > 0 && f % chunks == chunks - 1)
+    printf "%-16sproc near\n", name
+    if (has_ch)
+      printf "; FUNCTION CHUNK AT %08X SIZE 00000010 BYTES\n", \
+        268435456 + f * 16
+    printf "                push    ebx\n"
+    printf "                push    esi\n"
+    printf "                push    edi\n"
+    printf "                mov     eax, %s\n", sprintf("dword_%X", \
+      536870912 + (f % data) * 4)
+    if (has_sw) {
+      printf "                cmp     ecx, %d\n", cases - 1
+      printf "                ja      %s\n", label(base + 3840)
+      printf "                jmp     ds:off_%X[ecx*4]\n", base + 4080
+      for (c = 0; c < cases; c++) {
+        printf "%s:\n", label(base + 16 + c * 16)
+        printf "                mov     edx, %d\n", c
+        printf "                add     eax, edx\n"
+        printf "                jmp     %s\n", label(base + 3840)
+      }
+      printf "%s:\n", label(base + 3840)
+    }
+    if (has_ch) {
+      printf "                test    eax, eax\n"
+      printf "                jz      loc_%X\n", 268435456 + f * 16
+      printf "%s:\n", label(base + 3856)
+    }
+    for (e = 1; e < exits; e++) {
+      body(f, int(ops / exits))
+      printf "                test    ecx, %d\n", e
+      printf "                jnz     %s\n", label(base + 3872 + e * 16)
+    }
+    body(f, ops - int(ops / exits) * (exits - 1))
+    for (e = 0; e < exits; e++) {
+      if (e > 0) {
+        printf "%s:\n", label(base + 3872 + e * 16)
+        printf "                mov     eax, %d\n", e
+      }
+      printf "                pop     edi\n"
+      printf "                pop     esi\n"
+      printf "                pop     ebx\n"
+      printf "                retn\n"
+    }
+    printf "%-16sendp\n\n", name
+    if (has_sw) {
+      for (c = 0; c < cases; c++)
+        printf "%-16sdd offset %s\n", c == 0 ? \
+          sprintf("off_%X", base + 4080) : "", label(base + 16 + c * 16)
+      printf "\n"
+    }
+  }
+  for (f = chunks - 1; chunks > 0 && f < funcs; f += chunks) {
+    base = 4198400 + f * 4096
+    printf "; START OF FUNCTION CHUNK FOR sub_%X\n\n", base
+    printf "loc_%X:\n", 268435456 + f * 16
+    printf "                mov     eax, 5\n"
+    printf "                jmp     %s\n", label(base + 3856)
+    printf "; END OF FUNCTION CHUNK FOR sub_%X\n\n", base
+  }
+  printf "_text           ends\n\n"
+  printf "_data           segment para public 'DATA' use32\n"
+  for (d = 0; d < data; d++) {
+    xref = sprintf("; DATA XREF: sub_%X+3r", 4198400 + (d % funcs) * 4096)
+    printf "dword_%X  dd %-20d%s\n", 536870912 + d * 4, d, xref
+    if (d % 4 == 0) {
+      printf "off_%X    dd offset sub_%X   %s\n", 805306368 + d * 4, \
+        4198400 + (d % funcs) * 4096, xref
+      if (seed != "")
+        printf "int (__fastcall *off_%X)(int a1);\n", \
+          805306368 + d * 4 > seed
+    }
+    else if (d % 4 == 1)
+      printf "aStr%X      db 'str%d',0\n", d, d
+  }
+  printf "_data           ends\n\n                end\n"
+}
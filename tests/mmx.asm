@@ -0,0 +1,81 @@
+_text           segment para public 'CODE' use32
+
+sub_test        proc near
+
+arg_0           = dword ptr  4
+arg_4           = dword ptr  8
+arg_8           = dword ptr  0Ch
+
+                mov     edx, [esp+arg_0]
+                mov     ecx, [esp+arg_4]
+                movd    mm7, [esp+arg_8]
+                pxor    mm6, mm6
+                punpcklwd mm7, mm7
+                punpckldq mm7, mm7
+
+loc_loop:
+                movd    mm0, dword ptr [ecx]
+                movq    mm1, qword ptr [edx]
+                punpcklbw mm0, mm6
+                movq    mm2, mm1
+                punpcklbw mm1, mm6
+                punpckhbw mm2, mm6
+                pmullw  mm0, mm7
+                psrlw   mm0, 8
+                paddsw  mm1, mm0
+                psubusw mm2, mm0
+                packuswb mm1, mm2
+                movq    mm3, mm1
+                pcmpgtb mm3, qword ptr [edx+8]
+                pand    mm1, mm3
+                pandn   mm3, qword ptr [edx]
+                por     mm1, mm3
+                paddusb mm1, qword ptr [edx+10h]
+                psubsb  mm1, mm6
+                movq    qword ptr [edx], mm1
+                pmulhw  mm0, mm7
+                pmaddwd mm0, mm7
+                psrad   mm0, 40
+                packssdw mm0, mm2
+                paddd   mm0, qword ptr [edx+18h]
+                psllq   mm0, mm7
+                pcmpeqw mm0, mm6
+                punpckhdq mm0, mm0
+                movd    eax, mm0
+                add     edx, 8
+                add     ecx, 4
+                test    eax, eax
+                jnz     short loc_loop
+                movd    dword ptr [ecx], mm1
+                emms
+                retn
+sub_test        endp
+
+; mm regs spilled to the frame, var_8 as a local, var_10 in the union
+sub_spill       proc near
+
+var_10          = qword ptr -10h
+var_8           = qword ptr -8
+arg_0           = dword ptr  8
+
+                push    ebp
+                mov     ebp, esp
+                sub     esp, 10h
+                mov     ecx, [ebp+arg_0]
+                movq    mm0, qword ptr [ecx]
+                movq    [ebp+var_8], mm0
+                movq    [ebp+var_10], mm0
+                paddw   mm0, mm0
+                movq    mm1, [ebp+var_8]
+                paddw   mm1, [ebp+var_10]
+                movq    qword ptr [ecx], mm1
+                mov     eax, dword ptr [ebp+var_10+4]
+                emms
+                mov     esp, ebp
+                pop     ebp
+                retn
+sub_spill       endp
+
+_text           ends
+
+; vim:expandtab
@@ -0,0 +1,79 @@
+void sub_test(int a1, int a2, int a3)
+{
+  u32 eax;
+  u32 ecx;
+  u32 edx;
+  mmxr mm0 = { 0, };
+  mmxr mm1 = { 0, };
+  mmxr mm2 = { 0, };
+  mmxr mm3 = { 0, };
+  mmxr mm6 = { 0, };
+  mmxr mm7 = { 0, };
+
+  edx = (u32)a1;  // arg_0
+  ecx = (u32)a2;  // arg_4
+  mm7.q = (u32)a3;  // arg_8
+  mm6.q = 0;
+  mm7 = mmx_punpcklwd(mm7, mm7);
+  mm7 = mmx_punpckldq(mm7, mm7);
+
+loc_loop:
+  mm0.q = *(u32 *)(ecx);
+  mm1.q = *(u64 *)(edx);
+  mm0 = mmx_punpcklbw(mm0, mm6);
+  mm2.q = mm1.q;
+  mm1 = mmx_punpcklbw(mm1, mm6);
+  mm2 = mmx_punpckhbw(mm2, mm6);
+  mm0.vuw *= mm7.vuw;
+  mm0.vuw >>= 8;
+  mm1 = mmx_paddsw(mm1, mm0);
+  mm2 = mmx_psubusw(mm2, mm0);
+  mm1 = mmx_packuswb(mm1, mm2);
+  mm3.q = mm1.q;
+  mm3.vb = mm3.vb > mmx_q(*(u64 *)(edx+8)).vb;
+  mm1.q &= mm3.q;
+  mm3.q = ~mm3.q & *(u64 *)(edx);
+  mm1.q |= mm3.q;
+  mm1 = mmx_paddusb(mm1, mmx_q(*(u64 *)(edx+0x10)));
+  mm1 = mmx_psubsb(mm1, mm6);
+  *(u64 *)(edx) = mm1.q;
+  mm0 = mmx_pmulhw(mm0, mm7);
+  mm0 = mmx_pmaddwd(mm0, mm7);
+  mm0.vd >>= 31;
+  mm0 = mmx_packssdw(mm0, mm2);
+  mm0.vud += mmx_q(*(u64 *)(edx+0x18)).vud;
+  mm0 = mmx_psllq(mm0, mm7.q);
+  mm0.vw = mm0.vw == mm6.vw;
+  mm0 = mmx_punpckhdq(mm0, mm0);
+  eax = mm0.d[0];
+  edx += 8;
+  ecx += 4;
+  if (eax != 0)
+    goto loc_loop;
+  *(u32 *)(ecx) = mm1.d[0];
+  do_emms();
+
+}
+
+int sub_spill(int a1)
+{
+  union { u32 d[4]; u8 b[16]; double q[2]; } sf;
+  u64 sf_q8;
+  u32 eax;
+  u32 ecx;
+  mmxr mm0 = { 0, };
+  mmxr mm1 = { 0, };
+
+  ecx = (u32)a1;  // arg_0
+  mm0.q = *(u64 *)(ecx);
+  sf_q8 = mm0.q;  // var_8
+  *(u64 *)&sf.q[0] = mm0.q;  // var_10
+  mm0.vuw += mm0.vuw;
+  mm1.q = sf_q8;  // var_8
+  mm1.vuw += mmx_q(*(u64 *)&sf.q[0]).vuw;  // var_10
+  *(u64 *)(ecx) = mm1.q;
+  eax = sf.d[1];  // var_10+4
+  do_emms();
+  return eax;
+}
+
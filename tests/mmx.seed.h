@@ -0,0 +1,2 @@
+void __cdecl sub_test(int a1, int a2, int a3);
+int __cdecl sub_spill(int a1);
@@ -44,7 +44,24 @@ loop:
                 repne cmpsb
                 setne   cl
                 adc     cl, cl
+                rol     eax, cl
+                ror     dx, cl
+                cmp     eax, edx
+                rcl     eax, cl
+                rcr     bl, cl
+                jb      short carry
+                inc     eax
 
+carry:
+                cmp     eax, ebx
+                rol     ecx, 1
+                jz      short zero
+                and     eax, 0F0h
+                rcr     ecx, 1
+                jp      short zero
+                inc     ebx
+
+zero:
                 push    1
                 pop     eax
                 pop     edi
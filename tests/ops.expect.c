@@ -8,6 +8,7 @@ int sub_test()
   u32 edi;
   u32 cond_c;
   u32 cond_z;
+  u32 tmp;
   u64 tmp64;
 
   ebx = 0x10000;
@@ -55,6 +56,29 @@ loop:
   }  // repne cmps
   LOBYTE(ecx) = (!cond_z);
   LOBYTE(ecx) += (u8)ecx + cond_c;
+  eax = (eax << ((u8)ecx & 31)) | (eax >> (-(u32)(u8)ecx & 31));
+  LOWORD(edx) = (LOWORD(edx) >> ((u8)ecx & 15)) | (LOWORD(edx) << (-(u32)(u8)ecx & 15));
+  cond_c = (eax < edx);
+  eax = do_rcl(eax, (u8)ecx & 0x1f, &cond_c, 32);  // rcl
+  LOBYTE(ebx) = do_rcr(LOBYTE(ebx), (u8)ecx & 0x1f, &cond_c, 8);  // rcr
+  if (cond_c)
+    goto carry;
+  eax++;
+
+carry:
+  ecx = (ecx << 1) | (ecx >> 31);
+  if (eax == ebx)
+    goto zero;
+  eax &= 0xf0;
+  cond_c = (0);
+  tmp = (ecx >> 0) & 1;
+  ecx = (ecx >> 1) | (cond_c << 31);
+  cond_c = tmp;  // rcr
+  if (do_parity(eax))
+    goto zero;
+  ebx++;
+
+zero:
   eax = 1;
   return eax;
 }
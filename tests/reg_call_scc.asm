@@ -0,0 +1,27 @@
+
+_text           segment para public 'CODE' use32
+
+sub_a           proc near
+                call    sub_b
+                call    sub_z
+                retn
+sub_a           endp
+
+sub_b           proc near
+                call    sub_c
+                retn
+sub_b           endp
+
+sub_c           proc near
+                call    sub_a
+                retn
+sub_c           endp
+
+sub_z           proc near
+                mov     eax, edx
+                retn
+sub_z           endp
+
+_text           ends
+
+; vim:expandtab
@@ -0,0 +1,37 @@
+int sub_a(int a1)
+{
+  u32 edx = (u32)a1;
+  u32 eax;
+
+  sub_b(edx);
+  eax = sub_z(edx);
+  return eax;
+}
+
+int sub_b(int a1)
+{
+  u32 edx = (u32)a1;
+  u32 eax;
+
+  eax = sub_c(edx);
+  return eax;
+}
+
+int sub_c(int a1)
+{
+  u32 edx = (u32)a1;
+  u32 eax;
+
+  eax = sub_a(edx);
+  return eax;
+}
+
+int sub_z(int a1)
+{
+  u32 edx = (u32)a1;
+  u32 eax;
+
+  eax = edx;
+  return eax;
+}
+
@@ -0,0 +1,46 @@
+; rep string ops that map to libc
+
+_text           segment para public 'CODE' use32
+
+sub_test        proc near
+
+arg_0           = dword ptr  8
+arg_4           = dword ptr  0Ch
+
+                push    ebp
+                mov     ebp, esp
+                push    esi
+                push    edi
+                mov     esi, [ebp+arg_0]
+                mov     edi, [ebp+arg_4]
+                mov     ecx, 10h
+                rep movsd
+                xor     eax, eax
+                mov     ecx, 8
+                rep stosd
+                mov     edi, [ebp+arg_4]
+                mov     esi, [ebp+arg_0]
+                mov     ecx, 40h
+                repe cmpsb
+                jnz     short loc_ne
+                mov     edi, esi
+                or      ecx, 0FFFFFFFFh
+                repne scasb
+                not     ecx
+                dec     ecx
+                mov     eax, ecx
+                jmp     short loc_ret
+
+loc_ne:
+                mov     eax, 0FFFFFFFFh
+
+loc_ret:
+                pop     edi
+                pop     esi
+                pop     ebp
+                retn
+sub_test        endp
+
+_text           ends
+
+; vim:expandtab
@@ -0,0 +1,50 @@
+int sub_test(const void * a1, void * a2)
+{
+  u32 eax;
+  u32 ecx;
+  u32 esi;
+  u32 edi;
+  u32 cond_z;
+
+  esi = (u32)a1;  // arg_0
+  edi = (u32)a2;  // arg_4
+  ecx = 0x10;
+  rep_movs(edi, esi, ecx, 4); edi += ecx * 4;
+  barrier();  // ^ rep movs
+  eax = 0;
+  ecx = 8;
+  rep_stos(edi, eax, ecx, 4);
+  barrier();  // ^ rep stos
+  edi = (u32)a2;  // arg_4
+  esi = (u32)a1;  // arg_0
+  ecx = 0x40;
+  if (ecx != 0 && memcmp((void *)esi, (void *)edi, ecx * 1) == 0) {
+    cond_z = 1; esi += ecx * 1;
+  }
+  else while (ecx != 0) {
+    cond_z = (*(u8 *)esi == *(u8 *)edi); esi += 1, edi += 1;
+    ecx--;
+    if (cond_z == 0) break;
+  }  // repe cmps
+  if (!cond_z)
+    goto loc_ne;
+  edi = esi;
+  ecx = 0xffffffff;
+  if (ecx != 0) {
+    u32 p = (u32)memchr((void *)edi, (u8)eax, ecx);
+    cond_z = p != 0;
+    p = p ? p + 1 - edi : ecx;
+    ecx -= p;
+  }  // repne scas
+  ecx = ~ecx;
+  ecx--;
+  eax = ecx;
+  goto loc_ret;
+
+loc_ne:
+  eax = 0xffffffff;
+
+loc_ret:
+  return eax;
+}
+
@@ -0,0 +1 @@
+int __cdecl sub_test(const void *a1, void *a2);
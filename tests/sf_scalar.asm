@@ -0,0 +1,56 @@
+_text           segment para public 'CODE' use32
+
+sub_test        proc near
+
+var_14          = dword ptr -14h
+var_10          = byte ptr -10h
+var_C           = dword ptr -0Ch
+var_8           = word ptr -8
+var_4           = dword ptr -4
+arg_0           = dword ptr  8
+
+                push    ebp
+                mov     ebp, esp
+                sub     esp, 14h
+                mov     eax, [ebp+arg_0]
+                mov     [ebp+var_14], eax
+                mov     [ebp+var_8], ax
+                mov     [ebp+var_C], eax
+                mov     cl, byte ptr [ebp+var_C+1]
+                mov     [ebp+var_10], cl
+                lea     edx, [ebp+var_4]
+                push    edx
+                call    sub_get
+                mov     eax, [ebp+var_14]
+                movzx   ecx, [ebp+var_8]
+                add     eax, ecx
+                movzx   ecx, [ebp+var_10]
+                add     eax, ecx
+                add     eax, [ebp+var_4]
+                mov     esp, ebp
+                pop     ebp
+                retn
+sub_test        endp
+
+sub_lea         proc near
+
+var_8           = dword ptr -8
+var_4           = dword ptr -4
+arg_0           = dword ptr  8
+
+                push    ebp
+                mov     ebp, esp
+                sub     esp, 8
+                mov     eax, [ebp+arg_0]
+                mov     dword ptr [ebp+var_4], 0
+                lea     edx, [ebp+var_8]
+                mov     [edx+4], eax
+                mov     eax, [ebp+var_4]
+                mov     esp, ebp
+                pop     ebp
+                retn
+sub_lea         endp
+
+_text           ends
+
+; vim:expandtab
@@ -0,0 +1,41 @@
+int sub_test(int a1, int a2)
+{
+  union { u32 d[5]; u16 w[10]; u8 b[20]; } sf;
+  u8 sf_b4;
+  u16 sf_w12;
+  u32 sf_d0;
+  u32 eax;
+  u32 ecx = 0;
+  u32 edx;
+
+  eax = (u32)a1;  // arg_0
+  sf_d0 = eax;  // var_14
+  sf_w12 = (u16)eax;  // var_8
+  sf.d[2] = eax;  // var_C
+  LOBYTE(ecx) = sf.b[9];  // var_C+1
+  sf_b4 = (u8)ecx;  // var_10
+  edx = (u32)&sf.d[4];  // var_4
+  sub_get((int *)edx);
+  eax = sf_d0;  // var_14
+  ecx = sf_w12;  // var_8
+  eax += ecx;
+  ecx = sf_b4;  // var_10
+  eax += ecx;
+  eax += sf.d[4];  // var_4
+  return eax;
+}
+
+int sub_lea(int a1)
+{
+  union { u32 d[2]; u8 b[8]; } sf;
+  u32 eax;
+  u32 edx;
+
+  eax = (u32)a1;  // arg_0
+  sf.d[1] = 0;  // var_4
+  edx = (u32)&sf.d[0];  // var_8
+  *(u32 *)(edx+4) = eax;
+  eax = sf.d[1];  // var_4
+  return eax;
+}
+
@@ -0,0 +1,2 @@
+void __stdcall sub_get(int *a1);
+int __cdecl sub_lea(int a1);
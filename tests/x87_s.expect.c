@@ -1,28 +1,32 @@
 double sub_test()
 {
   union { u32 d[1]; u8 b[4]; double q[1]; } sf;
-  float f_st[8];
-  int f_stp = 0;
+  float f_s0;
+  float f_s1;
+  float f_s2;
+  float f_s3;
+  float f_s4;
+  float f_s5;
+  float f_s6;
+  float f_s7;
 
   sf.d[0] = 4;  // var_4
-  f_st[--f_stp & 7] = (float)(s32)sf.d[0];  // var_4 fild
-  f_st[--f_stp & 7] = *(float *)((u32)&sf.d[0]);  // var_4 fld
-  f_st[--f_stp & 7] = (float)(s32)sf.d[0];  // var_4 fild
-  f_st[--f_stp & 7] = 1.0;
-  f_st[--f_stp & 7] = (float)(s32)sf.d[0];  // var_4 fild
-  f_st[--f_stp & 7] = 0.0;
-  f_st[--f_stp & 7] = M_LN2;
-  f_st[--f_stp & 7] = (float)(s32)sf.d[0];  // var_4 fild
-  f_stp++;
-  f_st[(f_stp + 5) & 7] /= f_st[f_stp & 7];  f_stp++;
-  f_st[(f_stp + 1) & 7] = f_st[(f_stp + 1) & 7] * log2f(f_st[f_stp & 7]); f_stp++;  // fyl2x
-  f_st[(f_stp + 2) & 7] -= f_st[f_stp & 7];  f_stp++;
-  f_stp++;
-  { float t = f_st[f_stp & 7]; f_st[f_stp & 7] = f_st[(f_stp + 6) & 7]; f_st[(f_stp + 6) & 7] = t; }  // fxch
-  f_st[f_stp & 7] = -f_st[f_stp & 7];
-  f_st[(f_stp + 1) & 7] = atanf(f_st[(f_stp + 1) & 7] / f_st[f_stp & 7]); f_stp++;
-  sf.d[0] = (s32)f_st[f_stp & 7];  // var_4 fist
-  *(float *)((u32)&sf.d[0]) = f_st[f_stp & 7];  f_stp++;  // var_4 fst
-  return f_st[f_stp & 7];
+  f_s0 = (float)(s32)sf.d[0];  // var_4 fild
+  f_s1 = *(float *)((u32)&sf.d[0]);  // var_4 fld
+  f_s2 = (float)(s32)sf.d[0];  // var_4 fild
+  f_s3 = 1.0;
+  f_s4 = (float)(s32)sf.d[0];  // var_4 fild
+  f_s5 = 0.0;
+  f_s6 = M_LN2;
+  f_s7 = (float)(s32)sf.d[0];  // var_4 fild
+  f_s1 /= f_s6;
+  f_s4 = f_s4 * log2f(f_s5);  // fyl2x
+  f_s2 -= f_s4;
+  { float t = f_s2; f_s2 = f_s4; f_s4 = t; }  // fxch
+  f_s2 = -f_s2;
+  f_s1 = atanf(f_s1 / f_s2);
+  sf.d[0] = (s32)f_s1;  // var_4 fist
+  *(float *)((u32)&sf.d[0]) = f_s1;  // var_4 fst
+  return f_s0;
 }
 
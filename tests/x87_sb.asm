@@ -0,0 +1,39 @@
+_text           segment para public 'CODE' use32
+
+sub_test        proc near
+
+arg_0           = dword ptr  4
+
+                fld1
+                fldz
+                fldpi
+                mov     ecx, [esp+arg_0]
+                test    ecx, ecx
+                jz      short loc_end
+
+loc_loop:
+                fadd    st(2), st
+                fld     st(1)
+                faddp   st(3), st
+                test    ecx, 1
+                jz      short loc_even
+                fld1
+                fsubp   st(1), st
+                jmp     short loc_next
+
+loc_even:
+                fchs
+
+loc_next:
+                dec     ecx
+                jnz     short loc_loop
+
+loc_end:
+                fstp    st
+                fstp    st
+                retn
+sub_test        endp
+
+_text           ends
+
+; vim:expandtab
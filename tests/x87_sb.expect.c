@@ -0,0 +1,37 @@
+double sub_test(int a1)
+{
+  u32 ecx;
+  double f_s0;
+  double f_s1;
+  double f_s2;
+  double f_s3;
+
+  f_s0 = 1.0;
+  f_s1 = 0.0;
+  f_s2 = M_PI;
+  ecx = (u32)a1;  // arg_0
+  if (ecx == 0)
+    goto loc_end;
+
+loc_loop:
+  f_s0 += f_s2;
+  f_s3 = f_s1;  // fld
+  f_s0 += f_s3;
+  if ((ecx & 1) == 0)
+    goto loc_even;
+  f_s3 = 1.0;
+  f_s2 -= f_s3;
+  goto loc_next;
+
+loc_even:
+  f_s2 = -f_s2;
+
+loc_next:
+  ecx--;
+  if (ecx != 0)
+    goto loc_loop;
+
+loc_end:
+  return f_s0;
+}
+
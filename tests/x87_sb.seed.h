@@ -0,0 +1 @@
+double __cdecl sub_test(int a1);
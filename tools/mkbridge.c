@@ -67,7 +67,7 @@ static void out_toasm_x86(FILE *f, const char *sym_out,
 
 	argc_repush = pp->argc;
 	if (pp->is_vararg)
-		argc_repush = ARRAY_SIZE(pp->arg); // hopefully enough?
+		argc_repush = PP_MAX_ARGS; // hopefully enough?
 
 	for (i = 0; i < pp->argc; i++) {
 		if (pp->arg[i].reg != NULL)
@@ -110,7 +110,7 @@ static void out_toasm_x86(FILE *f, const char *sym_out,
 
 	// reconstruct arg stack for asm
 	for (i = argc_repush - 1; i >= 0; i--) {
-		if (pp->arg[i].reg == NULL) {
+		if (i >= pp->argc || pp->arg[i].reg == NULL) {
 			fprintf(f, "\tmovl %d(%%esp), %%eax\n",
 				(i + sarg_ofs) * 4);
 			fprintf(f, "\tpushl %%eax\n");
@@ -159,7 +159,7 @@ static void out_toasm_x86(FILE *f, const char *sym_out,
 static void out_fromasm_x86(FILE *f, const char *sym,
 	const struct parsed_proto *pp)
 {
-	int reg_ofs[ARRAY_SIZE(pp->arg)];
+	int reg_ofs[PP_MAX_ARGS];
 	int sarg_ofs = 1; // stack offset to args, in DWORDs
 	int saved_regs = 0;
 	int ecx_ofs = -1;
@@ -173,7 +173,7 @@ static void out_fromasm_x86(FILE *f, const char *sym,
 	argc_repush = pp->argc;
 	stack_args = pp->argc_stack;
 	if (pp->is_vararg) {
-		argc_repush = ARRAY_SIZE(pp->arg); // hopefully enough?
+		argc_repush = PP_MAX_ARGS; // hopefully enough?
 		stack_args = argc_repush - pp->argc_reg;
 	}
 
@@ -246,7 +246,7 @@ static void out_fromasm_x86(FILE *f, const char *sym,
 
 	// construct arg stack
 	for (i = argc_repush - 1; i >= 0; i--) {
-		if (pp->arg[i].reg == NULL) {
+		if (i >= pp->argc || pp->arg[i].reg == NULL) {
 			fprintf(f, "\tmovl %d(%%esp), %%ecx\n",
 				(sarg_ofs + stack_args - 1) * 4);
 			fprintf(f, "\tpushl %%ecx\n");
@@ -18,6 +18,14 @@ static char *sskip(char *s)
 	return s;
 }
 
+static inline const char *sskip_c(const char *s)
+{
+	while (my_isblank(*s))
+		s++;
+
+	return s;
+}
+
 static char *next_word(char *w, size_t wsize, char *s)
 {
 	size_t i;
@@ -6,8 +6,16 @@
  * See COPYING file in the top-level directory.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 struct parsed_proto;
 
+#define PP_MAX_ARGS 32
+
 struct parsed_type {
 	char *name;
 	unsigned int is_array:1;
@@ -34,7 +42,9 @@ struct parsed_proto {
 		struct parsed_type ret_type;
 		struct parsed_type type;
 	};
-	struct parsed_proto_arg arg[32];
+	// PP_MAX_ARGS entries for protos made by proto_new/proto_clone,
+	// just argc for cached ones (see pp_compact)
+	struct parsed_proto_arg *arg;
 	int argc;
 	int argc_stack;
 	int argc_reg;
@@ -56,24 +66,154 @@ struct parsed_proto {
 	unsigned int has_retreg:1;
 };
 
+struct parsed_struct_member {
+	int offset;
+	struct parsed_proto pp;
+};
+
 struct parsed_struct {
 	char name[256];
-	struct {
-		int offset;
-		struct parsed_proto pp;
-	} members[64];
+	struct parsed_struct_member *members;
 	int member_count;
 };
 
 static const char *hdrfn;
 static int hdrfline = 0;
 
+// optional observer of lookups, for tools that need to know what their
+// results depended on; offset is -1 for proto_parse() lookups
+static void (*pp_lookup_cb)(const char *name, int offset,
+	const struct parsed_proto *pp);
+
+// optional allocator for proto_clone(), must return zeroed memory;
+// the tool owns what it returns, so such clones can't be proto_release()d
+static void *(*pp_clone_alloc)(size_t size);
+
 static void pp_copy_arg(struct parsed_proto_arg *d,
 	const struct parsed_proto_arg *s);
+struct parsed_proto *proto_clone(const struct parsed_proto *pp_c);
 
 static int b_pp_c_handler(char *proto, const char *fname,
 	int is_include, int is_osinc, int is_cinc);
 static int struct_handler(FILE *fhdr, char *proto, int *line);
+static void ppc_add_dep(const char *fname);
+
+#define FNV64_INIT 0xcbf29ce484222325ull
+
+static uint64_t fnv64(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len-- > 0)
+		h = (h ^ *p++) * 0x100000001b3ull;
+	return h;
+}
+
+// cached protos are never freed, so they live in big pool blocks
+// with their strings interned, instead of many small allocs
+static char *pp_pool;
+static size_t pp_pool_left;
+
+static void *pp_pool_alloc(size_t size)
+{
+	void *ret;
+
+	size = (size + 7) & ~7;
+	if (size > pp_pool_left) {
+		pp_pool_left = size > 0x10000 ? size : 0x10000;
+		pp_pool = calloc(1, pp_pool_left);
+		my_assert_not(pp_pool, NULL);
+	}
+	ret = pp_pool;
+	pp_pool += size;
+	pp_pool_left -= size;
+
+	return ret;
+}
+
+struct pp_str {
+	struct pp_str *next;
+	size_t save_ofs; // for ppc_save()
+	unsigned int save_gen; // save_ofs is valid for this ppc_save()
+	char s[];
+};
+
+#define PP_STR_HASH_SIZE 4096
+static struct pp_str *pp_strs[PP_STR_HASH_SIZE];
+
+static char *pp_intern(const char *s)
+{
+	struct pp_str *ps;
+	unsigned int h = 0;
+	const char *p;
+
+	for (p = s; *p != 0; p++)
+		h = h * 31 + (unsigned char)*p;
+	h &= PP_STR_HASH_SIZE - 1;
+
+	for (ps = pp_strs[h]; ps != NULL; ps = ps->next)
+		if (strcmp(ps->s, s) == 0)
+			return ps->s;
+
+	ps = pp_pool_alloc(sizeof(*ps) + strlen(s) + 1);
+	strcpy(ps->s, s);
+	ps->next = pp_strs[h];
+	pp_strs[h] = ps;
+
+	return ps->s;
+}
+
+static char *pp_intern_free(char *s)
+{
+	char *ret;
+
+	if (s == NULL)
+		return NULL;
+	ret = pp_intern(s);
+	free(s);
+
+	return ret;
+}
+
+// move a freshly parsed proto's data to the pool
+static void pp_compact(struct parsed_proto *pp)
+{
+	struct parsed_proto_arg *arg = NULL;
+	struct parsed_proto *pp_a;
+	int i;
+
+	pp->ret_type.name = pp_intern_free(pp->ret_type.name);
+
+	if (pp->argc > 0) {
+		arg = pp_pool_alloc(pp->argc * sizeof(arg[0]));
+		memcpy(arg, pp->arg, pp->argc * sizeof(arg[0]));
+	}
+	for (i = 0; i < pp->argc; i++) {
+		arg[i].reg = pp_intern_free(arg[i].reg);
+		arg[i].type.name = pp_intern_free(arg[i].type.name);
+		if (arg[i].pp != NULL) {
+			pp_compact(arg[i].pp);
+			pp_a = pp_pool_alloc(sizeof(*pp_a));
+			memcpy(pp_a, arg[i].pp, sizeof(*pp_a));
+			free(arg[i].pp);
+			arg[i].pp = pp_a;
+		}
+	}
+	free(pp->arg);
+	pp->arg = arg;
+}
+
+static struct parsed_proto *proto_new(void)
+{
+	struct parsed_proto *pp;
+
+	pp = calloc(1, sizeof(*pp));
+	my_assert_not(pp, NULL);
+	pp->arg = calloc(PP_MAX_ARGS, sizeof(pp->arg[0]));
+	my_assert_not(pp->arg, NULL);
+
+	return pp;
+}
 
 static int do_protostrs(FILE *fhdr, const char *fname, int is_include)
 {
@@ -119,6 +259,7 @@ static int do_protostrs(FILE *fhdr, const char *fname, int is_include)
 					fname_inc, line, finc_name);
 				continue;
 			}
+			ppc_add_dep(fname_inc);
 			ret = do_protostrs(finc, finc_name, 1);
 			fclose(finc);
 			if (ret < 0)
@@ -384,8 +525,7 @@ static int parse_arg(char **p_, struct parsed_proto_arg *arg, int xarg)
 	char *pe;
 	int ret;
 
-	arg->pp = calloc(1, sizeof(*arg->pp));
-	my_assert_not(arg->pp, NULL);
+	arg->pp = proto_new();
 	arg->pp->is_arg = 1;
 
 	pe = p;
@@ -644,7 +784,7 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 			return -1;
 		}
 
-		if (xarg >= ARRAY_SIZE(pp->arg)) {
+		if (xarg >= PP_MAX_ARGS) {
 			printf("%s:%d:%zd: too many args\n",
 				hdrfn, hdrfline, (p - protostr) + 1);
 			return -1;
@@ -789,6 +929,7 @@ static int ps_cache_alloc;
 
 static int struct_handler(FILE *fhdr, char *proto, int *line)
 {
+	struct parsed_struct_member members[64];
 	struct parsed_struct *ps;
 	char lstr[256], *p;
 	int offset = 0;
@@ -822,25 +963,34 @@ static int struct_handler(FILE *fhdr, char *proto, int *line)
 		if (p[0] == '}')
 			break;
 
-		if (m >= ARRAY_SIZE(ps->members)) {
+		if (m >= ARRAY_SIZE(members)) {
 			printf("%s:%d: too many struct members\n",
 				hdrfn, *line);
 			return -1;
 		}
 
 		hdrfline = *line;
-		ret = parse_protostr(p, &ps->members[m].pp);
+		memset(&members[m], 0, sizeof(members[m]));
+		members[m].pp.arg = calloc(PP_MAX_ARGS,
+			sizeof(members[m].pp.arg[0]));
+		my_assert_not(members[m].pp.arg, NULL);
+		ret = parse_protostr(p, &members[m].pp);
 		if (ret < 0) {
 			printf("%s:%d: struct member #%d/%02x "
 				"doesn't parse\n", hdrfn, *line,
 				m, offset);
 			return -1;
 		}
-		ps->members[m].offset = offset;
+		pp_compact(&members[m].pp);
+		members[m].offset = offset;
 		offset += 4;
 		m++;
 	}
 
+	if (m > 0) {
+		ps->members = pp_pool_alloc(m * sizeof(ps->members[0]));
+		memcpy(ps->members, members, m * sizeof(ps->members[0]));
+	}
 	ps->member_count = m;
 
 	return 0;
@@ -866,9 +1016,13 @@ static int b_pp_c_handler(char *proto, const char *fname,
 			 * sizeof(pp_cache[0]));
 	}
 
+	pp_cache[pp_cache_size].arg = calloc(PP_MAX_ARGS,
+		sizeof(pp_cache[0].arg[0]));
+	my_assert_not(pp_cache[pp_cache_size].arg, NULL);
 	ret = parse_protostr(proto, &pp_cache[pp_cache_size]);
 	if (ret < 0)
 		return -1;
+	pp_compact(&pp_cache[pp_cache_size]);
 
 	pp_cache[pp_cache_size].is_include = is_include;
 	pp_cache[pp_cache_size].is_osinc = is_osinc;
@@ -877,11 +1031,339 @@ static int b_pp_c_handler(char *proto, const char *fname,
 	return 0;
 }
 
+/*
+ * precompiled cache: if PPCACHE_DIR is set, the sorted caches are
+ * saved there after parsing and loaded back on the next run if none
+ * of the header files have changed (by mtime, size and content hash).
+ * Files are named after the header and a hash of its realpath.
+ * All pointers are stored as blob offsets + 1, 0 stays NULL.
+ */
+#define PPC_MAGIC   0x33435050 // "PPC3"
+#define PPC_LAYOUT  (sizeof(struct parsed_proto) \
+	| sizeof(struct parsed_proto_arg) << 12 \
+	| sizeof(struct parsed_struct) << 20)
+
+struct ppc_hdr {
+	unsigned int magic;
+	unsigned int layout;
+	int dep_count;
+	int pp_count;
+	int ps_count;
+	size_t pp_ofs;
+	size_t ps_ofs;
+	size_t size;
+};
+
+struct ppc_dep {
+	char name[256]; // realpath if it resolves
+	long long mtime;
+	long long size;
+	uint64_t hash;  // fnv64 of the contents
+};
+
+static struct ppc_dep *ppc_deps;
+static int ppc_dep_cnt;
+static char *ppc_buf;
+static size_t ppc_size;
+static size_t ppc_alloc;
+static unsigned int ppc_save_gen;
+
+static int ppc_stat(struct ppc_dep *dep)
+{
+	char buf[4096];
+	struct stat st;
+	uint64_t h = FNV64_INIT;
+	FILE *f;
+	size_t n;
+
+	if (stat(dep->name, &st) != 0)
+		return -1;
+	dep->mtime = st.st_mtime;
+	dep->size = st.st_size;
+
+	// mtime has 1s resolution, a same size rewrite may keep both
+	f = fopen(dep->name, "rb");
+	if (f == NULL)
+		return -1;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		h = fnv64(h, buf, n);
+	fclose(f);
+	dep->hash = h;
+	return 0;
+}
+
+static void ppc_add_dep(const char *fname)
+{
+	char rp[PATH_MAX];
+
+	if ((ppc_dep_cnt & 0x0f) == 0) {
+		ppc_deps = realloc(ppc_deps,
+			(ppc_dep_cnt + 0x10) * sizeof(ppc_deps[0]));
+		my_assert_not(ppc_deps, NULL);
+	}
+	// cache files may be shared by runs from other dirs
+	memset(&ppc_deps[ppc_dep_cnt], 0, sizeof(ppc_deps[0]));
+	if (realpath(fname, rp) == NULL)
+		snprintf(rp, sizeof(rp), "%s", fname);
+	snprintf(ppc_deps[ppc_dep_cnt].name,
+		sizeof(ppc_deps[0].name), "%s", rp);
+	ppc_dep_cnt++;
+}
+
+// keyed on the realpath, so that a/x.h and b/x.h don't collide
+static int ppc_path(char *buf, size_t buf_size)
+{
+	const char *dir = getenv("PPCACHE_DIR");
+	const char *base;
+	char rp[PATH_MAX];
+
+	if (dir == NULL || *dir == 0 || hdrfn == NULL)
+		return -1;
+
+	if (realpath(hdrfn, rp) == NULL)
+		snprintf(rp, sizeof(rp), "%s", hdrfn);
+	base = strrchr(rp, '/');
+	base = base != NULL ? base + 1 : rp;
+	snprintf(buf, buf_size, "%s/%.64s.%016llx.ppc", dir, base,
+		(unsigned long long)fnv64(FNV64_INIT, rp, strlen(rp)));
+
+	return 0;
+}
+
+// append, returns offset (8 byte aligned)
+static size_t ppc_put(const void *data, size_t size)
+{
+	size_t ofs = (ppc_size + 7) & ~7;
+
+	if (ofs + size > ppc_alloc) {
+		ppc_alloc = (ofs + size) * 2 + 0x10000;
+		ppc_buf = realloc(ppc_buf, ppc_alloc);
+		my_assert_not(ppc_buf, NULL);
+	}
+	memset(ppc_buf + ppc_size, 0, ofs - ppc_size);
+	memcpy(ppc_buf + ofs, data, size);
+	ppc_size = ofs + size;
+
+	return ofs;
+}
+
+// all cached strings are interned, so each is written once per save,
+// -hc saves more than one cache and each needs its own copy
+static void *ppc_save_str(const char *s)
+{
+	struct pp_str *ps;
+
+	if (s == NULL)
+		return NULL;
+
+	ps = (void *)(s - offsetof(struct pp_str, s));
+	if (ps->save_gen != ppc_save_gen) {
+		ps->save_ofs = ppc_put(s, strlen(s) + 1) + 1;
+		ps->save_gen = ppc_save_gen;
+	}
+
+	return (void *)(uintptr_t)ps->save_ofs;
+}
+
+#define PPC_PP(ofs) ((struct parsed_proto *)(ppc_buf + (ofs)))
+#define PPC_ARG(ofs, i) ((struct parsed_proto_arg *)(ppc_buf + (ofs)) + (i))
+
+// pp was copied to ofs already, write out what it points to
+static void ppc_save_pp(const struct parsed_proto *pp, size_t ofs)
+{
+	size_t a_ofs, o;
+	void *v;
+	int i;
+
+	v = ppc_save_str(pp->ret_type.name);
+	PPC_PP(ofs)->ret_type.name = v;
+	if (pp->argc == 0) {
+		PPC_PP(ofs)->arg = NULL;
+		return;
+	}
+
+	a_ofs = ppc_put(pp->arg, pp->argc * sizeof(pp->arg[0]));
+	PPC_PP(ofs)->arg = (void *)(uintptr_t)(a_ofs + 1);
+
+	for (i = 0; i < pp->argc; i++) {
+		v = ppc_save_str(pp->arg[i].reg);
+		PPC_ARG(a_ofs, i)->reg = v;
+		v = ppc_save_str(pp->arg[i].type.name);
+		PPC_ARG(a_ofs, i)->type.name = v;
+		PPC_ARG(a_ofs, i)->push_refs = NULL;
+		PPC_ARG(a_ofs, i)->push_ref_cnt = 0;
+		if (pp->arg[i].pp != NULL) {
+			o = ppc_put(pp->arg[i].pp, sizeof(*pp));
+			ppc_save_pp(pp->arg[i].pp, o);
+			PPC_ARG(a_ofs, i)->pp = (void *)(uintptr_t)(o + 1);
+		}
+	}
+}
+
+static void ppc_save(void)
+{
+	struct ppc_hdr hdr;
+	char path[512], tmp_path[560];
+	size_t m_ofs, o;
+	FILE *f;
+	int i, m;
+
+	if (ppc_path(path, sizeof(path)) < 0)
+		return;
+
+	for (i = 0; i < ppc_dep_cnt; i++)
+		if (ppc_stat(&ppc_deps[i]) < 0)
+			return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	ppc_save_gen++;
+	ppc_size = 0;
+	ppc_put(&hdr, sizeof(hdr));
+	if (ppc_dep_cnt > 0)
+		ppc_put(ppc_deps, ppc_dep_cnt * sizeof(ppc_deps[0]));
+
+	hdr.pp_ofs = ppc_put(pp_cache, pp_cache_size * sizeof(pp_cache[0]));
+	hdr.ps_ofs = ppc_put(ps_cache, ps_cache_size * sizeof(ps_cache[0]));
+
+	for (i = 0; i < pp_cache_size; i++)
+		ppc_save_pp(&pp_cache[i], hdr.pp_ofs + i * sizeof(pp_cache[0]));
+
+	for (i = 0; i < ps_cache_size; i++) {
+		o = hdr.ps_ofs + i * sizeof(ps_cache[0]);
+		if (ps_cache[i].member_count == 0)
+			continue;
+		m_ofs = ppc_put(ps_cache[i].members,
+			ps_cache[i].member_count * sizeof(ps_cache[0].members[0]));
+		((struct parsed_struct *)(ppc_buf + o))->members =
+			(void *)(uintptr_t)(m_ofs + 1);
+		for (m = 0; m < ps_cache[i].member_count; m++)
+			ppc_save_pp(&ps_cache[i].members[m].pp, m_ofs
+				+ m * sizeof(ps_cache[0].members[0])
+				+ offsetof(struct parsed_struct_member, pp));
+	}
+
+	hdr.magic = PPC_MAGIC;
+	hdr.layout = PPC_LAYOUT;
+	hdr.dep_count = ppc_dep_cnt;
+	hdr.pp_count = pp_cache_size;
+	hdr.ps_count = ps_cache_size;
+	hdr.size = ppc_size;
+	memcpy(ppc_buf, &hdr, sizeof(hdr));
+
+	// write and rename so that parallel runs never see partial files
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+	f = fopen(tmp_path, "wb");
+	if (f == NULL)
+		return;
+	if (fwrite(ppc_buf, 1, ppc_size, f) != ppc_size) {
+		fclose(f);
+		remove(tmp_path);
+		return;
+	}
+	fclose(f);
+	if (rename(tmp_path, path) != 0)
+		remove(tmp_path);
+
+	free(ppc_buf);
+	ppc_buf = NULL;
+	ppc_size = ppc_alloc = 0;
+}
+
+#define PPC_FIX(base, p) \
+	((p) = (p) ? (void *)((base) + (uintptr_t)(p) - 1) : NULL)
+
+static void ppc_load_pp(char *base, struct parsed_proto *pp)
+{
+	int i;
+
+	PPC_FIX(base, pp->ret_type.name);
+	PPC_FIX(base, pp->arg);
+	for (i = 0; i < pp->argc; i++) {
+		PPC_FIX(base, pp->arg[i].reg);
+		PPC_FIX(base, pp->arg[i].type.name);
+		PPC_FIX(base, pp->arg[i].pp);
+		if (pp->arg[i].pp != NULL)
+			ppc_load_pp(base, pp->arg[i].pp);
+	}
+}
+
+static int ppc_load(void)
+{
+	struct ppc_dep dep, *deps;
+	struct ppc_hdr hdr;
+	char path[512];
+	char *base;
+	FILE *f;
+	int ok = 0;
+	int i, m;
+
+	if (ppc_path(path, sizeof(path)) < 0)
+		return 0;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+		return 0;
+	if (fread(&hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+	    || hdr.magic != PPC_MAGIC || hdr.layout != PPC_LAYOUT)
+		goto out;
+
+	base = malloc(hdr.size);
+	my_assert_not(base, NULL);
+	rewind(f);
+	if (fread(base, 1, hdr.size, f) != hdr.size) {
+		free(base);
+		goto out;
+	}
+
+	// stale?
+	deps = (void *)(base + ((sizeof(hdr) + 7) & ~7));
+	for (i = 0; i < hdr.dep_count; i++) {
+		dep = deps[i];
+		if (ppc_stat(&dep) < 0 || dep.mtime != deps[i].mtime
+		    || dep.size != deps[i].size || dep.hash != deps[i].hash)
+		{
+			free(base);
+			goto out;
+		}
+	}
+
+	pp_cache_size = pp_cache_alloc = hdr.pp_count;
+	pp_cache = malloc((hdr.pp_count + 1) * sizeof(pp_cache[0]));
+	my_assert_not(pp_cache, NULL);
+	memcpy(pp_cache, base + hdr.pp_ofs,
+		hdr.pp_count * sizeof(pp_cache[0]));
+	for (i = 0; i < pp_cache_size; i++)
+		ppc_load_pp(base, &pp_cache[i]);
+
+	ps_cache_size = ps_cache_alloc = hdr.ps_count;
+	ps_cache = malloc((hdr.ps_count + 1) * sizeof(ps_cache[0]));
+	my_assert_not(ps_cache, NULL);
+	memcpy(ps_cache, base + hdr.ps_ofs,
+		hdr.ps_count * sizeof(ps_cache[0]));
+	for (i = 0; i < ps_cache_size; i++) {
+		PPC_FIX(base, ps_cache[i].members);
+		for (m = 0; m < ps_cache[i].member_count; m++)
+			ppc_load_pp(base, &ps_cache[i].members[m].pp);
+	}
+
+	// base stays allocated, cache entries point into it
+	ok = 1;
+out:
+	fclose(f);
+	return ok;
+}
+
 static void build_caches(FILE *fhdr)
 {
 	long pos;
 	int ret;
 
+	ppc_dep_cnt = 0;
+	if (hdrfn != NULL)
+		ppc_add_dep(hdrfn);
+	if (ppc_load())
+		return;
+
 	pos = ftell(fhdr);
 	rewind(fhdr);
 
@@ -892,6 +1374,26 @@ static void build_caches(FILE *fhdr)
 	qsort(pp_cache, pp_cache_size, sizeof(pp_cache[0]), pp_name_cmp);
 	qsort(ps_cache, ps_cache_size, sizeof(ps_cache[0]), ps_name_cmp);
 	fseek(fhdr, pos, SEEK_SET);
+
+	ppc_save();
+}
+
+// parse more protos from f into the caches of fhdr, as if f was
+// included at the top of fhdr; pointers to cache entries are invalidated
+static inline int pp_caches_add(FILE *fhdr, FILE *f, const char *fname)
+{
+	int ret;
+
+	if (pp_cache == NULL)
+		build_caches(fhdr);
+
+	ret = do_protostrs(f, fname, 0);
+	if (ret < 0)
+		return -1;
+
+	qsort(pp_cache, pp_cache_size, sizeof(pp_cache[0]), pp_name_cmp);
+	qsort(ps_cache, ps_cache_size, sizeof(ps_cache[0]), ps_name_cmp);
+	return 0;
 }
 
 static const struct parsed_proto *proto_parse(FILE *fhdr, const char *sym,
@@ -899,6 +1401,7 @@ static const struct parsed_proto *proto_parse(FILE *fhdr, const char *sym,
 {
 	const struct parsed_proto *pp_ret;
 	struct parsed_proto pp_search;
+	const char *sym_in = sym;
 	char *p;
 
 	if (pp_cache == NULL)
@@ -917,6 +1420,8 @@ static const struct parsed_proto *proto_parse(FILE *fhdr, const char *sym,
 			sizeof(pp_cache[0]), pp_name_cmp);
 	if (pp_ret == NULL && !quiet)
 		printf("%s: sym '%s' is missing\n", hdrfn, sym);
+	if (pp_lookup_cb != NULL)
+		pp_lookup_cb(sym_in, -1, pp_ret);
 
 	return pp_ret;
 }
@@ -924,6 +1429,7 @@ static const struct parsed_proto *proto_parse(FILE *fhdr, const char *sym,
 static const struct parsed_proto *proto_lookup_struct(FILE *fhdr,
 	const char *type, int offset)
 {
+	const struct parsed_proto *pp_ret = NULL;
 	struct parsed_struct ps_search, *ps;
 	int m;
 
@@ -945,55 +1451,84 @@ static const struct parsed_proto *proto_lookup_struct(FILE *fhdr,
 	if (ps == NULL) {
 		printf("%s: struct '%s' is missing\n",
 			hdrfn, ps_search.name);
-		return NULL;
+		goto out;
 	}
 
 	for (m = 0; m < ps->member_count; m++) {
-		if (ps->members[m].offset == offset)
-			return &ps->members[m].pp;
+		if (ps->members[m].offset == offset) {
+			pp_ret = &ps->members[m].pp;
+			break;
+		}
 	}
 
-	return NULL;
+out:
+	if (pp_lookup_cb != NULL)
+		pp_lookup_cb(ps_search.name, offset, pp_ret);
+	return pp_ret;
 }
 
-static void pp_copy_arg(struct parsed_proto_arg *d,
-	const struct parsed_proto_arg *s)
+static void *pp_clone_mem(void *(*alloc)(size_t), size_t size)
+{
+	void *p;
+
+	p = alloc != NULL ? alloc(size) : calloc(1, size);
+	my_assert_not(p, NULL);
+	return p;
+}
+
+static char *pp_clone_str(void *(*alloc)(size_t), const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	return memcpy(pp_clone_mem(alloc, len), s, len);
+}
+
+static struct parsed_proto *pp_clone_a(const struct parsed_proto *pp_c,
+	void *(*alloc)(size_t));
+
+static void pp_copy_arg_a(struct parsed_proto_arg *d,
+	const struct parsed_proto_arg *s, void *(*alloc)(size_t))
 {
 	memcpy(d, s, sizeof(*d));
 
-	if (s->reg != NULL) {
-		d->reg = strdup(s->reg);
-		my_assert_not(d->reg, NULL);
-	}
-	if (s->type.name != NULL) {
-		d->type.name = strdup(s->type.name);
-		my_assert_not(d->type.name, NULL);
-	}
-	if (s->pp != NULL) {
-		d->pp = malloc(sizeof(*d->pp));
-		my_assert_not(d->pp, NULL);
-		memcpy(d->pp, s->pp, sizeof(*d->pp));
-	}
+	if (s->reg != NULL)
+		d->reg = pp_clone_str(alloc, s->reg);
+	if (s->type.name != NULL)
+		d->type.name = pp_clone_str(alloc, s->type.name);
+	if (s->pp != NULL)
+		d->pp = pp_clone_a(s->pp, alloc);
 }
 
-struct parsed_proto *proto_clone(const struct parsed_proto *pp_c)
+// internal copies always use malloc, they may end up in the caches
+static void pp_copy_arg(struct parsed_proto_arg *d,
+	const struct parsed_proto_arg *s)
+{
+	pp_copy_arg_a(d, s, NULL);
+}
+
+static struct parsed_proto *pp_clone_a(const struct parsed_proto *pp_c,
+	void *(*alloc)(size_t))
 {
 	struct parsed_proto *pp;
 	int i;
 
-	pp = malloc(sizeof(*pp));
-	my_assert_not(pp, NULL);
+	pp = pp_clone_mem(alloc, sizeof(*pp));
 	memcpy(pp, pp_c, sizeof(*pp)); // lazy..
+	pp->arg = pp_clone_mem(alloc, PP_MAX_ARGS * sizeof(pp->arg[0]));
 
 	// do the actual deep copy..
 	for (i = 0; i < pp_c->argc; i++)
-		pp_copy_arg(&pp->arg[i], &pp_c->arg[i]);
+		pp_copy_arg_a(&pp->arg[i], &pp_c->arg[i], alloc);
 	if (pp_c->ret_type.name != NULL)
-		pp->ret_type.name = strdup(pp_c->ret_type.name);
+		pp->ret_type.name = pp_clone_str(alloc, pp_c->ret_type.name);
 
 	return pp;
 }
 
+struct parsed_proto *proto_clone(const struct parsed_proto *pp_c)
+{
+	return pp_clone_a(pp_c, pp_clone_alloc);
+}
 
 static inline int pp_cmp_func(const struct parsed_proto *pp1,
   const struct parsed_proto *pp2)
@@ -1068,11 +1603,13 @@ static inline void proto_release(struct parsed_proto *pp)
 	for (i = 0; i < pp->argc; i++) {
 		free(pp->arg[i].reg);
 		free(pp->arg[i].type.name);
-		free(pp->arg[i].pp);
+		if (pp->arg[i].pp != NULL)
+			proto_release(pp->arg[i].pp);
 		free(pp->arg[i].push_refs);
 	}
 	if (pp->ret_type.name != NULL)
 		free(pp->ret_type.name);
+	free(pp->arg);
 	free(pp);
 
 	(void)proto_lookup_struct;
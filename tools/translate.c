@@ -19,9 +19,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "my_assert.h"
 #include "my_str.h"
@@ -73,6 +80,8 @@ enum op_flags {
   OPF_FPOPP  = (1 << 24), /* pops x87 stack twice */
   OPF_FSHIFT = (1 << 25), /* x87 stack shift is actually needed */
   OPF_FINT   = (1 << 26), /* integer float op arg */
+  OPF_MEMF   = (1 << 27), /* rep string op done with mem* call */
+  OPF_FFWD   = (1 << 28), /* cc op takes flags from setter's operands */
 };
 
 enum op_op {
@@ -88,6 +97,9 @@ enum op_op {
 	OP_MOVZX,
 	OP_MOVSX,
 	OP_XCHG,
+	OP_XADD,
+	OP_CMPXCHG,
+	OP_CMPXCHG8B,
 	OP_NOT,
 	OP_XLAT,
 	OP_CDQ,
@@ -166,6 +178,29 @@ enum op_op {
   OP_FYL2X,
   // mmx
   OP_EMMS,
+  OP_MOVD,
+  OP_PADD,
+  OP_PADDS,
+  OP_PADDUS,
+  OP_PSUB,
+  OP_PSUBS,
+  OP_PSUBUS,
+  OP_PMULL,
+  OP_PMULH,
+  OP_PMADD,
+  OP_PAND,
+  OP_PANDN,
+  OP_POR,
+  OP_PXOR,
+  OP_PCMPEQ,
+  OP_PCMPGT,
+  OP_PSLL,
+  OP_PSRL,
+  OP_PSRA,
+  OP_PACKSS,
+  OP_PACKUS,
+  OP_PUNPCKL,
+  OP_PUNPCKH,
   // pseudo-ops for lib calls
   OPP_ALLSHL,
   OPP_ALLSHR,
@@ -227,7 +262,8 @@ struct parsed_op {
   unsigned char p_argnum; // arg push: call's saved arg #
   unsigned char p_arggrp; // arg push: arg group # for above
   unsigned char p_argpass;// arg push: arg of host func
-  short pad;
+  unsigned char lmod;     // packed mmx ops: element lmod
+  unsigned char pad;
   int regmask_src;        // all referensed regs
   int regmask_dst;
   int pfomask;            // flagop: parsed_flag_op that can't be delayed
@@ -246,6 +282,7 @@ struct parsed_op {
 // OP_PUSH  - points to OP_POP in complex push/pop graph
 // OP_POP   - points to OP_PUSH in simple push/pop pair
 // OP_FCOM  - needed_status_word_bits | (is_z_check << 16)
+// (OPF_MEMF) - mask of ecx/esi/edi that are read afterwards
 
 struct parsed_equ {
   char name[64];
@@ -311,24 +348,39 @@ enum segment {
   SEG_GS,
 };
 
-#define MAX_OPS     4096
 #define MAX_ARG_GRP 2
 
-static struct parsed_op ops[MAX_OPS];
+// per-op arrays, grown by ops_reserve() as the function is parsed
+static struct parsed_op *ops;
+static char **g_labels;
+static struct label_ref *g_label_refs;
+static unsigned char *g_cbits; // visited bits for graph passes
+static int *g_op_seen; // visit stamps for graph walks, see visit_stamp()
+static int g_ops_alloc;
 static struct parsed_equ *g_eqs;
 static int g_eqcnt;
-static char *g_labels[MAX_OPS];
-static struct label_ref g_label_refs[MAX_OPS];
+// label name -> op index chains, stored as index + 1
+#define LABEL_HASH_SIZE 1024
+static int g_label_hash[LABEL_HASH_SIZE];
+static int *g_label_hnext;
 static const struct parsed_proto *g_func_pp;
 static struct parsed_data *g_func_pd;
 static int g_func_pd_cnt;
 static int g_func_lmods;
+static int g_opr_lookups; // header lookups by parse_operand()
 static char g_func[256];
 static char g_comment[256];
 static int g_bp_frame;
 static int g_sp_frame;
 static int g_stack_frame_used;
 static int g_stack_fsz;
+// per sf byte: lmod + 1 where a scalar local starts, -1 inside one
+static int *g_sf_scalar;
+#define SF_MMXQ 8 // g_sf_scalar flag: qword slot holds mmx data
+static int g_sf_all_scalar; // .. and the union is not needed
+// x87 stack depth before each op, if it's static in "full stack" mode
+static int *g_f_depth;
+static int g_f_slots;       // .. mask of f_s* locals used
 static int g_seh_found;
 static int g_seh_size;
 static int g_ida_func_attr;
@@ -479,6 +531,18 @@ static int parse_reg(enum opr_lenmod *reg_lmod, const char *s)
   return -1;
 }
 
+static int is_mmx_reg(const struct parsed_opr *popr)
+{
+  return popr->type == OPT_REG && popr->reg >= xMM0 && popr->reg <= xMM7;
+}
+
+// mm reg <-> mem, qword mem is integer data then, not a double
+static int is_mmx_mem_op(const struct parsed_op *po)
+{
+  return po->operand_cnt == 2
+    && (is_mmx_reg(&po->operand[0]) || is_mmx_reg(&po->operand[1]));
+}
+
 static int parse_indmode(char *name, int *regmask, int need_c_cvt)
 {
   enum opr_lenmod lmod;
@@ -921,6 +985,7 @@ static int parse_operand(struct parsed_opr *opr,
   pp = proto_parse(g_fhdr, opr->name, g_quiet_pp);
 
 do_label:
+  g_opr_lookups++;
   if (pp != NULL) {
     if (pp->is_fptr || pp->is_func) {
       opr->lmod = OPLM_DWORD;
@@ -974,6 +1039,7 @@ static const struct {
   unsigned int flags;
   unsigned char pfo;
   unsigned char pfo_inv;
+  unsigned char lmod;     // element lmod for packed ops
 } op_table[] = {
   { "nop",  OP_NOP,    0, 0, 0 },
   { "push", OP_PUSH,   1, 1, 0 },
@@ -986,6 +1052,9 @@ static const struct {
   { "movzx",OP_MOVZX,  2, 2, OPF_DATA },
   { "movsx",OP_MOVSX,  2, 2, OPF_DATA },
   { "xchg", OP_XCHG,   2, 2, OPF_DATA },
+  { "xadd", OP_XADD,   2, 2, OPF_DATA|OPF_FLAGS },
+  { "cmpxchg",  OP_CMPXCHG,   2, 2, OPF_DATA|OPF_FLAGS },
+  { "cmpxchg8b",OP_CMPXCHG8B, 1, 1, OPF_DATA|OPF_FLAGS },
   { "not",  OP_NOT,    1, 1, OPF_DATA },
   { "xlat", OP_XLAT,   0, 0, OPF_DATA },
   { "cdq",  OP_CDQ,    0, 0, OPF_DATA },
@@ -1151,6 +1220,53 @@ static const struct {
   // mmx
   { "emms",   OP_EMMS,   0, 0, OPF_DATA },
   { "movq",   OP_MOV,    2, 2, OPF_DATA },
+  { "movd",   OP_MOVD,   2, 2, OPF_DATA },
+  { "paddb",  OP_PADD,   2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "paddw",  OP_PADD,   2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "paddd",  OP_PADD,   2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "paddq",  OP_PADD,   2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "paddsb", OP_PADDS,  2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "paddsw", OP_PADDS,  2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "paddusb",OP_PADDUS, 2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "paddusw",OP_PADDUS, 2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "psubb",  OP_PSUB,   2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "psubw",  OP_PSUB,   2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "psubd",  OP_PSUB,   2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "psubq",  OP_PSUB,   2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "psubsb", OP_PSUBS,  2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "psubsw", OP_PSUBS,  2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "psubusb",OP_PSUBUS, 2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "psubusw",OP_PSUBUS, 2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pmullw", OP_PMULL,  2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pmulhw", OP_PMULH,  2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pmaddwd",OP_PMADD,  2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pand",   OP_PAND,   2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "pandn",  OP_PANDN,  2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "por",    OP_POR,    2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "pxor",   OP_PXOR,   2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "pcmpeqb",OP_PCMPEQ, 2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "pcmpeqw",OP_PCMPEQ, 2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pcmpeqd",OP_PCMPEQ, 2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "pcmpgtb",OP_PCMPGT, 2, 2, OPF_DATA, 0, 0, OPLM_BYTE },
+  { "pcmpgtw",OP_PCMPGT, 2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pcmpgtd",OP_PCMPGT, 2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "psllw",  OP_PSLL,   2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "pslld",  OP_PSLL,   2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "psllq",  OP_PSLL,   2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "psrlw",  OP_PSRL,   2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "psrld",  OP_PSRL,   2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "psrlq",  OP_PSRL,   2, 2, OPF_DATA, 0, 0, OPLM_QWORD },
+  { "psraw",  OP_PSRA,   2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "psrad",  OP_PSRA,   2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "packsswb",OP_PACKSS,2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "packssdw",OP_PACKSS,2, 2, OPF_DATA, 0, 0, OPLM_DWORD },
+  { "packuswb",OP_PACKUS,2, 2, OPF_DATA, 0, 0, OPLM_WORD },
+  { "punpcklbw",OP_PUNPCKL,2,2,OPF_DATA, 0, 0, OPLM_BYTE },
+  { "punpcklwd",OP_PUNPCKL,2,2,OPF_DATA, 0, 0, OPLM_WORD },
+  { "punpckldq",OP_PUNPCKL,2,2,OPF_DATA, 0, 0, OPLM_DWORD },
+  { "punpckhbw",OP_PUNPCKH,2,2,OPF_DATA, 0, 0, OPLM_BYTE },
+  { "punpckhwd",OP_PUNPCKH,2,2,OPF_DATA, 0, 0, OPLM_WORD },
+  { "punpckhdq",OP_PUNPCKH,2,2,OPF_DATA, 0, 0, OPLM_DWORD },
   // pseudo-ops for lib calls
   { "_allshl",OPP_ALLSHL },
   { "_allshr",OPP_ALLSHR },
@@ -1161,6 +1277,56 @@ static const struct {
   { "ud2",    OP_UD2 },
 };
 
+// op_table name -> index, open addressing, stored as index + 1
+#define OP_HASH_SIZE 1024
+static unsigned short op_hash[OP_HASH_SIZE];
+
+static unsigned int str_hash(const char *s)
+{
+  unsigned int h = 0;
+
+  for (; *s != 0; s++)
+    h = h * 31 + (unsigned char)*s;
+
+  return h;
+}
+
+static void build_op_hash(void)
+{
+  unsigned int h;
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(op_table); i++) {
+    h = str_hash(op_table[i].name);
+    for (;; h++) {
+      h &= OP_HASH_SIZE - 1;
+      if (op_hash[h] == 0) {
+        op_hash[h] = i + 1;
+        break;
+      }
+      // first entry wins, like the linear search did
+      if (IS(op_table[op_hash[h] - 1].name, op_table[i].name))
+        break;
+    }
+  }
+}
+
+// returns op_table index or -1
+static int find_op(const char *name)
+{
+  unsigned int h;
+  int i;
+
+  for (h = str_hash(name); ; h++) {
+    h &= OP_HASH_SIZE - 1;
+    if (op_hash[h] == 0)
+      return -1;
+    i = op_hash[h] - 1;
+    if (IS(op_table[i].name, name))
+      return i;
+  }
+}
+
 static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
 {
   enum opr_lenmod lmod = OPLM_UNSPEC;
@@ -1186,15 +1352,11 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
   }
 
   op_w = w;
-  for (i = 0; i < ARRAY_SIZE(op_table); i++) {
-    if (IS(words[w], op_table[i].name))
-      break;
-  }
-
-  if (i == ARRAY_SIZE(op_table)) {
+  i = find_op(words[w]);
+  if (i < 0) {
     if (!g_skip_func)
       aerr("unhandled op: '%s'\n", words[0]);
-    i--; // OP_UD2
+    i = ARRAY_SIZE(op_table) - 1; // OP_UD2
   }
   w++;
 
@@ -1202,6 +1364,7 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
   op->flags = op_table[i].flags | prefix_flags;
   op->pfo = op_table[i].pfo;
   op->pfo_inv = op_table[i].pfo_inv;
+  op->lmod = op_table[i].lmod;
   op->regmask_src = op->regmask_dst = 0;
   op->asmln = asmln;
 
@@ -1265,6 +1428,72 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
     op->regmask_dst |= op->regmask_src;
     goto check_align;
 
+  case OP_XADD:
+    if (op->operand[1].type != OPT_REG)
+      aerr("xadd src must be a reg\n");
+    op->regmask_src |= op->regmask_dst;
+    op->regmask_dst |= 1 << op->operand[1].reg;
+    break;
+
+  case OP_CMPXCHG:
+    // accumulator is an implicit 3rd operand
+    op->regmask_src |= op->regmask_dst;
+    op->operand_cnt = 3;
+    setup_reg_opr(&op->operand[2], xAX, op->operand[1].lmod,
+      &op->regmask_src);
+    op->regmask_dst |= mxAX;
+    break;
+
+  case OP_CMPXCHG8B:
+    op->regmask_src |= op->regmask_dst | mxAX | mxBX | mxCX | mxDX;
+    op->regmask_dst |= mxAX | mxDX;
+    break;
+
+  case OP_MOVD:
+    if (is_mmx_reg(&op->operand[0]) == is_mmx_reg(&op->operand[1]))
+      aerr("movd needs one mm reg\n");
+    for (j = 0; j < 2; j++)
+      if (op->operand[j].lmod == OPLM_UNSPEC)
+        op->operand[j].lmod = OPLM_DWORD;
+    break;
+
+  case OP_PADD:
+  case OP_PADDS:
+  case OP_PADDUS:
+  case OP_PSUBS:
+  case OP_PSUBUS:
+  case OP_PMULL:
+  case OP_PMULH:
+  case OP_PMADD:
+  case OP_PAND:
+  case OP_PANDN:
+  case OP_POR:
+  case OP_PCMPEQ:
+  case OP_PCMPGT:
+  case OP_PSLL:
+  case OP_PSRL:
+  case OP_PSRA:
+  case OP_PACKSS:
+  case OP_PACKUS:
+  case OP_PUNPCKL:
+  case OP_PUNPCKH:
+  case OP_PSUB:
+  case OP_PXOR:
+    if (!is_mmx_reg(&op->operand[0]))
+      aerr("mmx op dst must be a mm reg\n");
+    if (op->operand[1].type == OPT_REGMEM
+        && op->operand[1].lmod == OPLM_UNSPEC)
+      op->operand[1].lmod = OPLM_QWORD;
+    if ((op->op == OP_PSUB || op->op == OP_PXOR)
+        && op->operand[1].type == OPT_REG
+        && op->operand[0].reg == op->operand[1].reg)
+    {
+      op->regmask_src = 0;
+    }
+    else
+      op->regmask_src |= op->regmask_dst;
+    break;
+
   case OP_SUB:
   case OP_SBB:
   case OP_XOR:
@@ -1574,6 +1803,10 @@ static const char *op_name(struct parsed_op *po)
     return buf;
   }
 
+  // mmx variants differ by element lmod
+  for (i = 0; i < ARRAY_SIZE(op_table); i++)
+    if (op_table[i].op == po->op && op_table[i].lmod == po->lmod)
+      return op_table[i].name;
   for (i = 0; i < ARRAY_SIZE(op_table); i++)
     if (op_table[i].op == po->op)
       return op_table[i].name;
@@ -1939,6 +2172,31 @@ static int parse_stack_esp_offset(struct parsed_op *po,
   return 0;
 }
 
+// render a frame slot that was turned into a separate local,
+// returns 0 if the slot lives in the sf union
+static int sf_scalar_access(struct parsed_op *po, char *buf,
+  size_t buf_size, const char *prefix, int sf_ofs, enum opr_lenmod lmod)
+{
+  static const char lm_c[] = { 0, 'b', 'w', 'd', 'q' };
+  int i, size;
+
+  if (g_sf_scalar == NULL || lmod < OPLM_BYTE || lmod > OPLM_QWORD)
+    return 0;
+
+  size = lmod_bytes(po, lmod);
+  if ((g_sf_scalar[sf_ofs] & ~SF_MMXQ) == lmod + 1) {
+    snprintf(buf, buf_size, "%ssf_%c%d", prefix, lm_c[lmod], sf_ofs);
+    return 1;
+  }
+
+  // scan must have seen all accesses
+  for (i = sf_ofs; i < sf_ofs + size && i < g_stack_fsz; i++)
+    if (g_sf_scalar[i] != 0)
+      ferr(po, "sf access overlaps scalar slot at %d\n", i);
+
+  return 0;
+}
+
 // returns g_func_pp arg number if arg is accessed
 // -1 otherwise (stack vars, va_list)
 // note: 'popr' must be from 'po', not some other op
@@ -1950,7 +2208,7 @@ static int stack_frame_access(struct parsed_op *po,
   const char *prefix = "";
   const char *bp_arg = NULL;
   char ofs_reg[16] = { 0, };
-  char argname[8], buf2[32];
+  char argname[16], buf2[32];
   int i, arg_i, arg_s;
   int unaligned = 0;
   int stack_ra = 0;
@@ -2103,7 +2361,6 @@ static int stack_frame_access(struct parsed_op *po,
   {
     if (g_stack_fsz == 0)
       ferr(po, "stack var access without stackframe\n");
-    g_stack_frame_used = 1;
 
     sf_ofs = g_stack_fsz + offset;
     if (ofs_reg[0] == 0 && (offset > 0 || sf_ofs < 0))
@@ -2114,6 +2371,12 @@ static int stack_frame_access(struct parsed_op *po,
     else
       prefix = cast;
 
+    if (ofs_reg[0] == 0
+      && sf_scalar_access(po, buf, buf_size, prefix, sf_ofs, popr->lmod))
+      return retval;
+    ferr_assert(po, !g_sf_all_scalar);
+    g_stack_frame_used = 1;
+
     switch (popr->lmod)
     {
     case OPLM_BYTE:
@@ -2150,9 +2413,11 @@ static int stack_frame_access(struct parsed_op *po,
     case OPLM_QWORD:
       ferr_assert(po, !(sf_ofs & 7));
       ferr_assert(po, ofs_reg[0] == 0);
-      // only used for x87 int64/float, float sets is_lea
+      // x87 int64/float or mmx, float sets is_lea
       if (!is_lea && (po->flags & OPF_FINT))
         prefix = "*(s64 *)&";
+      else if (!is_lea && is_mmx_mem_op(po))
+        prefix = "*(u64 *)&";
       snprintf(buf, buf_size, "%ssf.q[%d]", prefix, sf_ofs / 8);
       break;
 
@@ -2411,6 +2676,48 @@ static char *out_src_opr_u32(char *buf, size_t buf_size,
   return out_src_opr(buf, buf_size, po, popr, NULL, 0);
 }
 
+// mmx union member for packed elements of lmod
+static const char *mmx_member(struct parsed_op *po,
+  enum opr_lenmod lmod, int is_signed)
+{
+  switch (lmod) {
+  case OPLM_QWORD:
+    return "q";
+  case OPLM_DWORD:
+    return is_signed ? "vd" : "vud";
+  case OPLM_WORD:
+    return is_signed ? "vw" : "vuw";
+  case OPLM_BYTE:
+    return is_signed ? "vb" : "vub";
+  default:
+    ferr(po, "invalid mmx lmod: %d\n", lmod);
+    return "(_invalid_)";
+  }
+}
+
+// mmx src from mm reg or 64bit mem, as mmxr or its member
+static char *out_src_opr_mmx(char *buf, size_t buf_size,
+  struct parsed_op *po, struct parsed_opr *popr, const char *member)
+{
+  char tmp[224]; // room for the wrapper in buf
+
+  if (is_mmx_reg(popr)) {
+    snprintf(buf, buf_size, "%s%s%s", opr_reg_p(po, popr),
+      member ? "." : "", member ? member : "");
+    return buf;
+  }
+  if (popr->type != OPT_REGMEM || popr->lmod != OPLM_QWORD)
+    ferr(po, "unhandled mmx src\n");
+
+  if (member != NULL && IS(member, "q"))
+    return out_src_opr(buf, buf_size, po, popr, NULL, 0);
+
+  out_src_opr(tmp, sizeof(tmp), po, popr, NULL, 0);
+  snprintf(buf, buf_size, "mmx_q(%s)%s%s", tmp,
+    member ? "." : "", member ? member : "");
+  return buf;
+}
+
 // do we need a helper func to perform a float i/o?
 static int float_opr_needs_helper(struct parsed_op *po,
   struct parsed_opr *popr)
@@ -2425,6 +2732,19 @@ static int float_opr_needs_helper(struct parsed_op *po,
   return 1;
 }
 
+// st(n) before op i in "full stack" mode, either a fixed local
+// when the depth is static or a slot in the f_st[] ring
+static char *float_st_name(char *buf, size_t buf_size, int i, int n)
+{
+  if (g_f_depth != NULL)
+    snprintf(buf, buf_size, "f_s%d", (g_f_depth[i] - 1 - n) & 7);
+  else if (n == 0)
+    snprintf(buf, buf_size, "f_st[f_stp & 7]");
+  else
+    snprintf(buf, buf_size, "f_st[(f_stp + %d) & 7]", n);
+  return buf;
+}
+
 static char *out_opr_float(char *buf, size_t buf_size,
   struct parsed_op *po, struct parsed_opr *popr, int is_src,
   int need_float_stack)
@@ -2446,13 +2766,8 @@ static char *out_opr_float(char *buf, size_t buf_size,
       break;
     }
 
-    if (need_float_stack) {
-      if (popr->reg == xST0)
-        snprintf(buf, buf_size, "f_st[f_stp & 7]");
-      else
-        snprintf(buf, buf_size, "f_st[(f_stp + %d) & 7]",
-          popr->reg - xST0);
-    }
+    if (need_float_stack)
+      float_st_name(buf, buf_size, po - ops, popr->reg - xST0);
     else
       snprintf(buf, buf_size, "f_st%d", popr->reg - xST0);
     break;
@@ -2737,196 +3052,516 @@ static const char *op_to_c(struct parsed_op *po)
   if ((i) < 0) \
     ferr(po, "bad " #i ": %d\n", i)
 
+// -prof: wall time per pass and per function, recursion high-water marks
+enum prof_id {
+  PROF_PARSE,     // .asm reading and everything outside of below
+  PROF_CACHES,    // protoparse cache building
+  PROF_PASS1, PROF_PASS2, PROF_PASS3, PROF_PASS4, PROF_PASS5,
+  PROF_PASS6, PROF_PASS7, PROF_PASS8, PROF_PASS9,
+  PROF_OUTPUT,    // C text or header emission
+  PROF_CNT
+};
+
+static const char *prof_names[PROF_CNT] = {
+  "parse", "caches",
+  "pass1", "pass2", "pass3", "pass4", "pass5",
+  "pass6", "pass7", "pass8", "pass9",
+  "output",
+};
+
+enum prof_depth_id {
+  PROFD_SCAN_FOR_POP,
+  PROFD_REG_USE_PASS,
+  PROFD_CNT
+};
+
+static const char *prof_depth_names[PROFD_CNT] = {
+  "scan_for_pop", "reg_use_pass",
+};
+
+struct prof_func {
+  char name[64];
+  int opcnt;
+  double t;
+  double pass_t[PROF_CNT];
+};
+
+static int g_prof;
+static int g_prof_cur;
+static double g_prof_last;
+static double g_prof_t[PROF_CNT];
+static int g_prof_ops[PROF_CNT];
+static struct prof_func *g_prof_funcs;
+static int g_prof_func_cnt;
+static int g_prof_func_cur = -1;
+static int g_prof_depth_max[PROFD_CNT];
+
+static double prof_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// charge time since last switch to current pass, then switch to id
+static void prof_pass(enum prof_id id)
+{
+  struct prof_func *pf;
+  double now, t;
+
+  if (!g_prof)
+    return;
+
+  now = prof_now();
+  t = now - g_prof_last;
+  g_prof_t[g_prof_cur] += t;
+  if (g_prof_func_cur >= 0) {
+    pf = &g_prof_funcs[g_prof_func_cur];
+    pf->pass_t[g_prof_cur] += t;
+    pf->t += t;
+    if (id != g_prof_cur && id != PROF_PARSE)
+      g_prof_ops[id] += pf->opcnt;
+  }
+  g_prof_cur = id;
+  g_prof_last = now;
+}
+
+static void prof_func_start(const char *name, int opcnt)
+{
+  struct prof_func *pf;
+
+  if (!g_prof)
+    return;
+
+  prof_pass(PROF_PARSE);
+  if ((g_prof_func_cnt & 0xff) == 0) {
+    g_prof_funcs = realloc(g_prof_funcs,
+      (g_prof_func_cnt + 0x100) * sizeof(g_prof_funcs[0]));
+    my_assert_not(g_prof_funcs, NULL);
+  }
+  g_prof_func_cur = g_prof_func_cnt++;
+  pf = &g_prof_funcs[g_prof_func_cur];
+  memset(pf, 0, sizeof(*pf));
+  snprintf(pf->name, sizeof(pf->name), "%.63s", name);
+  pf->opcnt = opcnt;
+  prof_pass(PROF_PASS1);
+}
+
+static void prof_func_end(void)
+{
+  if (!g_prof)
+    return;
+
+  prof_pass(PROF_PARSE);
+  g_prof_func_cur = -1;
+}
+
+static void prof_depth_note(enum prof_depth_id id, int depth)
+{
+  if (depth > g_prof_depth_max[id])
+    g_prof_depth_max[id] = depth;
+}
+
+static int prof_func_cmp(const void *p1_, const void *p2_)
+{
+  const struct prof_func *p1 = p1_, *p2 = p2_;
+
+  if (p1->t != p2->t)
+    return p1->t < p2->t ? 1 : -1;
+  return strcmp(p1->name, p2->name);
+}
+
+static int prof_id_cmp(const void *p1_, const void *p2_)
+{
+  int i1 = *(const int *)p1_, i2 = *(const int *)p2_;
+
+  if (g_prof_t[i1] != g_prof_t[i2])
+    return g_prof_t[i1] < g_prof_t[i2] ? 1 : -1;
+  return i1 - i2;
+}
+
+// report to stderr, all data in long-form csv to csv_fn:
+// kind,func,pass,ops,value (usec for times)
+static void prof_dump(const char *csv_fn)
+{
+  const struct prof_func *pf;
+  int order[PROF_CNT];
+  double total = 0;
+  FILE *f;
+  int i, j, k;
+
+  if (!g_prof)
+    return;
+
+  prof_pass(PROF_PARSE);
+  qsort(g_prof_funcs, g_prof_func_cnt, sizeof(g_prof_funcs[0]),
+    prof_func_cmp);
+
+  for (i = 0; i < PROF_CNT; i++) {
+    order[i] = i;
+    total += g_prof_t[i];
+  }
+  qsort(order, PROF_CNT, sizeof(order[0]), prof_id_cmp);
+
+  fprintf(stderr, "%-14s %10s %6s %10s\n", "pass", "ms", "%", "ops");
+  for (i = 0; i < PROF_CNT; i++) {
+    j = order[i];
+    fprintf(stderr, "%-14s %10.3f %6.2f %10d\n", prof_names[j],
+      g_prof_t[j] * 1000.0, total > 0 ? g_prof_t[j] * 100.0 / total : 0,
+      g_prof_ops[j]);
+  }
+  fprintf(stderr, "%-14s %10.3f\n\n", "total", total * 1000.0);
+
+  fprintf(stderr, "slowest functions:\n");
+  for (i = 0; i < g_prof_func_cnt && i < 20; i++) {
+    pf = &g_prof_funcs[i];
+    k = PROF_PASS1;
+    for (j = PROF_PASS1 + 1; j < PROF_CNT; j++)
+      if (pf->pass_t[j] > pf->pass_t[k])
+        k = j;
+    fprintf(stderr, "  %-40s %10.3f ms %6d ops, mostly %s\n", pf->name,
+      pf->t * 1000.0, pf->opcnt, prof_names[k]);
+  }
+
+  fprintf(stderr, "\nmax walk stack depth:\n");
+  for (i = 0; i < PROFD_CNT; i++)
+    fprintf(stderr, "  %-14s %d\n", prof_depth_names[i],
+      g_prof_depth_max[i]);
+
+  f = fopen(csv_fn, "w");
+  if (f == NULL) {
+    perror(csv_fn);
+    return;
+  }
+  fprintf(f, "kind,func,pass,ops,value\n");
+  for (i = 0; i < PROF_CNT; i++)
+    fprintf(f, "pass,,%s,%d,%.0f\n", prof_names[i], g_prof_ops[i],
+      g_prof_t[i] * 1e6);
+  for (i = 0; i < g_prof_func_cnt; i++) {
+    pf = &g_prof_funcs[i];
+    fprintf(f, "func,%s,total,%d,%.0f\n", pf->name, pf->opcnt,
+      pf->t * 1e6);
+    for (j = PROF_PASS1; j < PROF_CNT; j++)
+      fprintf(f, "func,%s,%s,%d,%.0f\n", pf->name, prof_names[j],
+        pf->opcnt, pf->pass_t[j] * 1e6);
+  }
+  for (i = 0; i < PROFD_CNT; i++)
+    fprintf(f, "depth,,%s,,%d\n", prof_depth_names[i],
+      g_prof_depth_max[i]);
+  fclose(f);
+}
+
+// index stack shared by the iterative walkers, each user
+// pops back to the depth it started at
+static int *g_wstack;
+static int g_wstack_cnt;
+static int g_wstack_alloc;
+
+static void wstack_push(int i)
+{
+  if (g_wstack_cnt >= g_wstack_alloc) {
+    g_wstack_alloc = g_wstack_alloc * 2 + 64;
+    g_wstack = realloc(g_wstack, g_wstack_alloc * sizeof(g_wstack[0]));
+    my_assert_not(g_wstack, NULL);
+  }
+  g_wstack[g_wstack_cnt++] = i;
+}
+
+static int g_seen_stamp;
+
+// new visit mark for a walk, an op is visited once
+// g_op_seen[] of it holds the mark
+static int visit_stamp(void)
+{
+  return ++g_seen_stamp;
+}
+
+// frames for walking back over jumps to labels: each frame walks one
+// path back, starting a frame of its own for each jump to a label on it
+// before going past the label; the frame result goes to the parent's ret
+struct bwalk {
+  int i;                  // current op
+  int ret;                // results of the finished child frames
+  int lab;                // labels at i not expanded yet
+  struct label_ref *lr;   // next jump to start a frame for
+};
+
+static struct bwalk *g_bw;
+static int g_bw_cnt;
+static int g_bw_alloc;
+
+#define BW_END  -2 // no fallthrough to the frame's op
+#define BW_REF  -3 // a frame was started
+
+static void bw_push(int i)
+{
+  struct bwalk *f;
+
+  if (g_bw_cnt >= g_bw_alloc) {
+    g_bw_alloc = g_bw_alloc * 2 + 64;
+    g_bw = realloc(g_bw, g_bw_alloc * sizeof(g_bw[0]));
+    my_assert_not(g_bw, NULL);
+  }
+  f = &g_bw[g_bw_cnt++];
+  f->i = i;
+  f->ret = 0;
+  f->lab = 1;
+  f->lr = NULL;
+}
+
+// advance the top frame, returns the op to check next,
+// -1 if the function start was passed, BW_END or BW_REF
+static int bw_step(void)
+{
+  struct bwalk *f = &g_bw[g_bw_cnt - 1];
+  struct label_ref *lr;
+
+  if (f->lab) {
+    f->lab = 0;
+    if (g_labels[f->i] != NULL)
+      f->lr = &g_label_refs[f->i];
+  }
+
+  lr = f->lr;
+  if (lr != NULL) {
+    f->lr = lr->next;
+    check_i(&ops[f->i], lr->i);
+    bw_push(lr->i);
+    return BW_REF;
+  }
+
+  if (g_labels[f->i] != NULL && f->i > 0 && LAST_OP(f->i - 1))
+    return BW_END;
+
+  f->lab = 1;
+  return --f->i;
+}
+
 // note: this skips over calls and rm'd stuff assuming they're handled
 // so it's intended to use at one of final passes
 // exception: doesn't skip OPF_RSAVE stuff
-static int scan_for_pop(int i, int opcnt, int magic, int reg,
-  int depth, int seen_noreturn, int save_level, int flags_set)
+// paths are walked depth first, branch targets before fallthrough;
+// the stack holds the paths left to walk as (i, depth, seen_noreturn)
+static int scan_for_pop_do(int i, int opcnt, int stamp, int reg,
+  int seen_noreturn, int save_level, int flags_set)
 {
   struct parsed_op *po;
+  int base = g_wstack_cnt;
+  int depth = 0;
   int relevant;
   int ret = 0;
   int j;
 
-  for (; i < opcnt; i++) {
-    po = &ops[i];
-    if (po->cc_scratch == magic)
-      return ret; // already checked
-    po->cc_scratch = magic;
+  while (1) {
+    for (; i < opcnt; i++) {
+      po = &ops[i];
+      if (g_op_seen[i] == stamp)
+        goto next; // already checked
+      g_op_seen[i] = stamp;
 
-    if (po->flags & OPF_TAIL) {
-      if (po->op == OP_CALL && po->pp != NULL && po->pp->is_noreturn) {
-        // msvc sometimes generates stack cleanup code after
-        // noreturn, set a flag and continue
-        seen_noreturn = 1;
-
-        // ... but stop if there is another path to next insn -
-        // if msvc skipped something stack tracking may mess up
-        if (i + 1 < opcnt && g_labels[i + 1] != NULL)
+      if (po->flags & OPF_TAIL) {
+        if (po->op == OP_CALL && po->pp != NULL && po->pp->is_noreturn) {
+          // msvc sometimes generates stack cleanup code after
+          // noreturn, set a flag and continue
+          seen_noreturn = 1;
+
+          // ... but stop if there is another path to next insn -
+          // if msvc skipped something stack tracking may mess up
+          if (i + 1 < opcnt && g_labels[i + 1] != NULL)
+            goto out;
+        }
+        else
           goto out;
       }
-      else
-        goto out;
-    }
 
-    if (po->flags & OPF_FARG)
-      continue;
-    if (po->flags & (OPF_RMD|OPF_DONE)) {
-      if (!(po->flags & OPF_RSAVE))
+      if (po->flags & OPF_FARG)
         continue;
-      // reprocess, there might be another push in some "parallel"
-      // path that took a pop what we should also take
-    }
+      if (po->flags & (OPF_RMD|OPF_DONE)) {
+        if (!(po->flags & OPF_RSAVE))
+          continue;
+        // reprocess, there might be another push in some "parallel"
+        // path that took a pop what we should also take
+      }
+
+      if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+        if (po->btj != NULL) {
+          // jumptable
+          if (po->btj->count == 0)
+            goto next;
+          for (j = po->btj->count - 1; j >= 0; j--) {
+            check_i(po, po->btj->d[j].bt_i);
+            wstack_push(po->btj->d[j].bt_i);
+            wstack_push(depth);
+            wstack_push(seen_noreturn);
+          }
+          g_wstack_cnt -= 3;
+          i = po->btj->d[0].bt_i - 1;
+          continue;
+        }
 
-    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++) {
-          check_i(po, po->btj->d[j].bt_i);
-          ret |= scan_for_pop(po->btj->d[j].bt_i, opcnt, magic, reg,
-                   depth, seen_noreturn, save_level, flags_set);
-          if (ret < 0)
-            return ret; // dead end
+        check_i(po, po->bt_i);
+        if (po->flags & OPF_CJMP) {
+          wstack_push(i + 1);
+          wstack_push(depth);
+          wstack_push(seen_noreturn);
         }
-        return ret;
+        i = po->bt_i - 1;
+        continue;
       }
 
-      check_i(po, po->bt_i);
-      if (po->flags & OPF_CJMP) {
-        ret |= scan_for_pop(po->bt_i, opcnt, magic, reg,
-                 depth, seen_noreturn, save_level, flags_set);
-        if (ret < 0)
-          return ret; // dead end
+      relevant = 0;
+      if ((po->op == OP_POP || po->op == OP_PUSH)
+        && po->operand[0].type == OPT_REG && po->operand[0].reg == reg)
+      {
+        relevant = 1;
       }
-      else {
-        i = po->bt_i - 1;
+
+      if (po->op == OP_PUSH) {
+        depth++;
+      }
+      else if (po->op == OP_POP) {
+        if (relevant && depth == 0) {
+          if (flags_set == 0 && save_level > 0) {
+            j = scan_for_pop_do(i + 1, opcnt, stamp, reg,
+                  seen_noreturn, save_level - 1, flags_set);
+            if (j != 1) {
+              // no pop for other levels, current one must be false
+              g_wstack_cnt = base;
+              return -1;
+            }
+          }
+          po->flags |= flags_set;
+          ret = 1;
+          goto next;
+        }
+        depth--;
       }
-      continue;
     }
 
-    relevant = 0;
-    if ((po->op == OP_POP || po->op == OP_PUSH)
-      && po->operand[0].type == OPT_REG && po->operand[0].reg == reg)
-    {
-      relevant = 1;
+out:
+    // for noreturn, assume msvc skipped stack cleanup
+    if (!seen_noreturn) {
+      g_wstack_cnt = base;
+      return -1; // dead end
     }
+    ret = 1;
 
-    if (po->op == OP_PUSH) {
-      depth++;
-    }
-    else if (po->op == OP_POP) {
-      if (relevant && depth == 0) {
-        if (flags_set == 0 && save_level > 0) {
-          ret = scan_for_pop(i + 1, opcnt, magic, reg,
-                  depth, seen_noreturn, save_level - 1, flags_set);
-          if (ret != 1)
-            // no pop for other levels, current one must be false
-            return -1;
-        }
-        po->flags |= flags_set;
-        return 1;
-      }
-      depth--;
-    }
+next:
+    prof_depth_note(PROFD_SCAN_FOR_POP, (g_wstack_cnt - base) / 3);
+    if (g_wstack_cnt <= base)
+      return ret;
+    seen_noreturn = g_wstack[--g_wstack_cnt];
+    depth = g_wstack[--g_wstack_cnt];
+    i = g_wstack[--g_wstack_cnt];
   }
+}
 
-out:
-  // for noreturn, assume msvc skipped stack cleanup
-  return seen_noreturn ? 1 : -1;
+static int scan_for_pop(int i, int opcnt, int reg, int save_level,
+  int flags_set)
+{
+  return scan_for_pop_do(i, opcnt, visit_stamp(), reg,
+           0, save_level, flags_set);
 }
 
 // scan for 'reg' pop backwards starting from i
 // intended to use for register restore search, so other reg
 // references are considered an error
-static int scan_for_rsave_pop_reg(int i, int magic, int reg, int set_flags)
+static int scan_for_rsave_pop_reg(int i, int stamp, int reg, int set_flags)
 {
   struct parsed_op *po;
-  struct label_ref *lr;
-  int ret = 0;
+  int base = g_bw_cnt;
+  int ret;
 
-  ops[i].cc_scratch = magic;
+  g_op_seen[i] = stamp;
+  bw_push(i);
 
-  while (1)
-  {
-    if (g_labels[i] != NULL) {
-      lr = &g_label_refs[i];
-      for (; lr != NULL; lr = lr->next) {
-        check_i(&ops[i], lr->i);
-        ret |= scan_for_rsave_pop_reg(lr->i, magic, reg, set_flags);
-        if (ret < 0)
-          return ret;
-      }
-      if (i > 0 && LAST_OP(i - 1))
-        return ret;
+  while (1) {
+    i = bw_step();
+    if (i == BW_REF) {
+      g_op_seen[g_bw[g_bw_cnt - 1].i] = stamp;
+      continue;
     }
 
-    i--;
-    if (i < 0)
-      break;
-
-    if (ops[i].cc_scratch == magic)
-      return ret;
-    ops[i].cc_scratch = magic;
-
-    po = &ops[i];
-    if (po->op == OP_POP && po->operand[0].reg == reg) {
-      if (po->flags & (OPF_RMD|OPF_DONE))
-        return -1;
+    if (i == BW_END || i < 0 || g_op_seen[i] == stamp)
+      // nothing interesting on this path,
+      // still return ret for something the refs could find
+      ret = g_bw[g_bw_cnt - 1].ret;
+    else {
+      g_op_seen[i] = stamp;
 
-      po->flags |= set_flags;
-      return 1;
+      po = &ops[i];
+      if (po->op == OP_POP && po->operand[0].reg == reg) {
+        if (po->flags & (OPF_RMD|OPF_DONE))
+          ret = -1;
+        else {
+          po->flags |= set_flags;
+          ret = 1;
+        }
+      }
+      // this also covers the case where we reach corresponding push
+      else if ((po->regmask_dst | po->regmask_src) & (1 << reg))
+        ret = -1;
+      else
+        continue;
     }
 
-    // this also covers the case where we reach corresponding push
-    if ((po->regmask_dst | po->regmask_src) & (1 << reg))
-      return -1;
+    if (ret < 0) {
+      g_bw_cnt = base;
+      return ret;
+    }
+    if (--g_bw_cnt == base)
+      return ret;
+    g_bw[g_bw_cnt - 1].ret |= ret;
   }
-
-  // nothing interesting on this path,
-  // still return ret for something recursive calls could find
-  return ret;
 }
 
-static void find_reachable_exits(int i, int opcnt, int magic,
+static void find_reachable_exits(int i, int opcnt,
   int *exits, int *exit_count)
 {
   struct parsed_op *po;
+  int stamp = visit_stamp();
+  int base = g_wstack_cnt;
   int j;
 
-  for (; i < opcnt; i++)
-  {
-    po = &ops[i];
-    if (po->cc_scratch == magic)
-      return;
-    po->cc_scratch = magic;
+  while (1) {
+    for (; i < opcnt; i++)
+    {
+      po = &ops[i];
+      if (g_op_seen[i] == stamp)
+        break;
+      g_op_seen[i] = stamp;
 
-    if (po->flags & OPF_TAIL) {
-      ferr_assert(po, *exit_count < MAX_EXITS);
-      exits[*exit_count] = i;
-      (*exit_count)++;
-      return;
-    }
+      if (po->flags & OPF_TAIL) {
+        ferr_assert(po, *exit_count < MAX_EXITS);
+        exits[*exit_count] = i;
+        (*exit_count)++;
+        break;
+      }
 
-    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
-      if (po->flags & OPF_RMD)
-        continue;
+      if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+        if (po->flags & OPF_RMD)
+          continue;
 
-      if (po->btj != NULL) {
-        for (j = 0; j < po->btj->count; j++) {
-          check_i(po, po->btj->d[j].bt_i);
-          find_reachable_exits(po->btj->d[j].bt_i, opcnt, magic,
-                  exits, exit_count);
+        if (po->btj != NULL) {
+          for (j = po->btj->count - 1; j >= 0; j--) {
+            check_i(po, po->btj->d[j].bt_i);
+            wstack_push(po->btj->d[j].bt_i);
+          }
+          break;
         }
-        return;
-      }
 
-      check_i(po, po->bt_i);
-      if (po->flags & OPF_CJMP)
-        find_reachable_exits(po->bt_i, opcnt, magic, exits, exit_count);
-      else
+        check_i(po, po->bt_i);
+        if (po->flags & OPF_CJMP)
+          wstack_push(i + 1);
         i = po->bt_i - 1;
-      continue;
+        continue;
+      }
     }
+
+    if (g_wstack_cnt <= base)
+      return;
+    i = g_wstack[--g_wstack_cnt];
   }
 }
 
@@ -2935,20 +3570,19 @@ static int scan_for_pop_ret(int i, int opcnt, int reg, int set_flags)
 {
   static int exits[MAX_EXITS];
   static int exit_count;
+  int stamp = visit_stamp();
   int found = 0;
   int e, j, ret;
 
   if (!set_flags) {
     exit_count = 0;
-    find_reachable_exits(i, opcnt, i + opcnt * 15, exits,
-      &exit_count);
+    find_reachable_exits(i, opcnt, exits, &exit_count);
     ferr_assert(&ops[i], exit_count > 0);
   }
 
   for (j = 0; j < exit_count; j++) {
     e = exits[j];
-    ret = scan_for_rsave_pop_reg(e, i + opcnt * 16 + set_flags,
-            reg, set_flags);
+    ret = scan_for_rsave_pop_reg(e, stamp, reg, set_flags);
     if (ret != -1) {
       found |= ret;
       continue;
@@ -3271,6 +3905,37 @@ static int is_opr_modified(const struct parsed_opr *opr,
   return IS(po->operand[0].name, opr->name);
 }
 
+// regs the address of mem operand 'opr' is formed from
+static int opr_addr_regmask(const struct parsed_opr *opr)
+{
+  char buf[NAMELEN];
+  int mask = 0;
+
+  if (opr->type != OPT_REGMEM)
+    return 0;
+
+  snprintf(buf, sizeof(buf), "%s", opr->name);
+  parse_indmode(buf, &mask, 0);
+  return mask;
+}
+
+// like is_opr_modified(), but mem 'opr' also counts as modified if
+// 'po' changes a reg in addr_mask (from opr_addr_regmask()),
+// the operand name then refers to different memory
+static int is_opr_addr_modified(const struct parsed_opr *opr,
+  int addr_mask, const struct parsed_op *po)
+{
+  if (addr_mask != 0 && !(po->flags & OPF_RMD)) {
+    if (po->regmask_dst & addr_mask)
+      return 1;
+    if (po->op == OP_CALL
+        && (addr_mask & ((1 << xAX) | (1 << xCX) | (1 << xDX))))
+      return 1;
+  }
+
+  return is_opr_modified(opr, po);
+}
+
 // is any operand of parsed_op 'po_test' modified by parsed_op 'po'?
 static int is_any_opr_modified(const struct parsed_op *po_test,
   const struct parsed_op *po, int c_mode)
@@ -3323,186 +3988,697 @@ static int scan_for_mod(struct parsed_op *po_test, int i, int opcnt,
 static int scan_for_mod_opr0(struct parsed_op *po_test,
   int i, int opcnt)
 {
+  int addr_mask = opr_addr_regmask(&po_test->operand[0]);
+
   for (; i < opcnt; i++) {
-    if (is_opr_modified(&po_test->operand[0], &ops[i]))
+    if (is_opr_addr_modified(&po_test->operand[0], addr_mask, &ops[i]))
       return i;
   }
 
   return -1;
 }
 
-static int try_resolve_const(int i, const struct parsed_opr *opr,
-  int magic, unsigned int *val);
+// control flow graph of the current function, built for the late passes
+struct bblock {
+  int start, end;         // ops [start, end)
+  int *succ, *pred;
+  int succ_cnt, pred_cnt;
+  int wl_next;            // worklist link + 1, -1 if not queued
+};
+
+static struct bblock *g_bbs;
+static int g_bb_cnt;
+static int g_bb_alloc;
+static int *g_op_bb;
+static int g_op_bb_alloc;
 
-static int scan_for_flag_set(int i, int opcnt, int magic,
-  int *branched, int *setters, int *setter_cnt)
+static void bb_add_edge(int from, int to_op)
 {
-  struct label_ref *lr;
-  int ret;
+  struct bblock *f = &g_bbs[from], *t = &g_bbs[g_op_bb[to_op]];
+  int j;
 
-  while (i >= 0) {
-    if (ops[i].cc_scratch == magic) {
-      // is this a problem?
-      //ferr(&ops[i], "%s looped\n", __func__);
-      return 0;
-    }
-    ops[i].cc_scratch = magic;
+  for (j = 0; j < f->succ_cnt; j++)
+    if (f->succ[j] == g_op_bb[to_op])
+      return;
 
-    if (g_labels[i] != NULL) {
-      *branched = 1;
+  if ((f->succ_cnt & 7) == 0) {
+    f->succ = realloc(f->succ, (f->succ_cnt + 8) * sizeof(f->succ[0]));
+    my_assert_not(f->succ, NULL);
+  }
+  f->succ[f->succ_cnt++] = g_op_bb[to_op];
 
-      lr = &g_label_refs[i];
-      for (; lr->next; lr = lr->next) {
-        check_i(&ops[i], lr->i);
-        ret = scan_for_flag_set(lr->i, opcnt, magic,
-                branched, setters, setter_cnt);
-        if (ret < 0)
-          return ret;
-      }
+  if ((t->pred_cnt & 7) == 0) {
+    t->pred = realloc(t->pred, (t->pred_cnt + 8) * sizeof(t->pred[0]));
+    my_assert_not(t->pred, NULL);
+  }
+  t->pred[t->pred_cnt++] = from;
+}
 
-      check_i(&ops[i], lr->i);
-      if (i > 0 && LAST_OP(i - 1)) {
-        i = lr->i;
-        continue;
+static void cfg_free(void)
+{
+  int i;
+
+  for (i = 0; i < g_bb_cnt; i++) {
+    free(g_bbs[i].succ);
+    free(g_bbs[i].pred);
+  }
+  g_bb_cnt = 0;
+}
+
+// must be rebuilt if branches or OPF_RMD/OPF_TAIL on them change
+static void cfg_build(int opcnt)
+{
+  struct parsed_op *po;
+  struct bblock *bb;
+  int i, j;
+
+  cfg_free();
+
+  if (opcnt > g_op_bb_alloc) {
+    g_op_bb_alloc = opcnt;
+    free(g_op_bb);
+    g_op_bb = malloc(opcnt * sizeof(g_op_bb[0]));
+    my_assert_not(g_op_bb, NULL);
+  }
+
+  for (i = 0; i < opcnt; i++) {
+    if (i == 0 || g_labels[i] != NULL || LAST_OP(i - 1)
+        || ((ops[i - 1].flags & OPF_JMP) && ops[i - 1].op != OP_CALL
+            && !(ops[i - 1].flags & OPF_RMD)))
+    {
+      if (g_bb_cnt >= g_bb_alloc) {
+        g_bb_alloc = g_bb_alloc * 2 + 64;
+        g_bbs = realloc(g_bbs, g_bb_alloc * sizeof(g_bbs[0]));
+        my_assert_not(g_bbs, NULL);
       }
-      ret = scan_for_flag_set(lr->i, opcnt, magic,
-              branched, setters, setter_cnt);
-      if (ret < 0)
-        return ret;
+      bb = &g_bbs[g_bb_cnt++];
+      memset(bb, 0, sizeof(*bb));
+      bb->start = i;
+      bb->wl_next = -1;
     }
-    i--;
-
-    if (ops[i].flags & OPF_FLAGS) {
-      setters[*setter_cnt] = i;
-      (*setter_cnt)++;
+    g_bbs[g_bb_cnt - 1].end = i + 1;
+    g_op_bb[i] = g_bb_cnt - 1;
+  }
 
-      if (ops[i].flags & OPF_REP) {
-        struct parsed_opr opr = OPR_INIT(OPT_REG, OPLM_DWORD, xCX);
-        unsigned int uval;
+  for (i = 0; i < g_bb_cnt; i++) {
+    bb = &g_bbs[i];
+    po = &ops[bb->end - 1];
 
-        ret = try_resolve_const(i, &opr, i + opcnt * 7, &uval);
-        if (ret != 1 || uval == 0) {
-          // can't treat it as full setter because of ecx=0 case,
-          // also disallow delayed compare
-          *branched = 1;
-          continue;
+    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+      if (po->btj != NULL) {
+        for (j = 0; j < po->btj->count; j++) {
+          check_i(po, po->btj->d[j].bt_i);
+          bb_add_edge(i, po->btj->d[j].bt_i);
         }
+        continue;
+      }
+      if (!(po->flags & OPF_RMD)) {
+        check_i(po, po->bt_i);
+        bb_add_edge(i, po->bt_i);
+        if (!(po->flags & OPF_CJMP))
+          continue;
       }
-
-      return 0;
     }
+    else if (po->flags & OPF_TAIL)
+      continue;
 
-    if ((ops[i].flags & (OPF_JMP|OPF_CJMP)) == OPF_JMP)
-      return -1;
+    if (bb->end < opcnt)
+      bb_add_edge(i, bb->end);
   }
-
-  return -1;
 }
 
-// scan back for cdq, if anything modifies edx, fail
-static int scan_for_cdq_edx(int i)
+// generic worklist solver: transfer() recomputes the state of a block
+// from its neighbours and returns nonzero if the state changed, in which
+// case successors (forward) or predecessors (backward) get requeued
+static void cfg_solve(int forward, int (*transfer)(int b))
 {
-  while (i >= 0) {
-    if (g_labels[i] != NULL) {
-      if (g_label_refs[i].next != NULL)
-        return -1;
-      if (i > 0 && LAST_OP(i - 1)) {
-        i = g_label_refs[i].i;
+  struct bblock *bb;
+  int head = -1, tail = -1;
+  int i, j, cnt, *nb;
+
+  for (i = 0; i < g_bb_cnt; i++) {
+    j = forward ? i : g_bb_cnt - 1 - i;
+    g_bbs[j].wl_next = 0;
+    if (tail >= 0)
+      g_bbs[tail].wl_next = j + 1;
+    else
+      head = j;
+    tail = j;
+  }
+
+  while (head >= 0) {
+    i = head;
+    bb = &g_bbs[i];
+    head = bb->wl_next - 1;
+    if (head < 0)
+      tail = -1;
+    bb->wl_next = -1;
+
+    if (!transfer(i))
+      continue;
+
+    nb = forward ? bb->succ : bb->pred;
+    cnt = forward ? bb->succ_cnt : bb->pred_cnt;
+    for (j = 0; j < cnt; j++) {
+      if (g_bbs[nb[j]].wl_next != -1)
         continue;
-      }
-      return -1;
+      g_bbs[nb[j]].wl_next = 0;
+      if (tail >= 0)
+        g_bbs[tail].wl_next = nb[j] + 1;
+      else
+        head = nb[j];
+      tail = nb[j];
     }
-    i--;
+  }
+}
 
-    if (ops[i].op == OP_CDQ)
-      return i;
+static int try_resolve_const(int i, const struct parsed_opr *opr,
+  unsigned int *val);
 
-    if (ops[i].regmask_dst & (1 << xDX))
-      return -1;
+// rotates only set CF/OF, readers of other flags look past them
+static int is_rotate_op(const struct parsed_op *po)
+{
+  return po->op == OP_ROL || po->op == OP_ROR
+    || po->op == OP_RCL || po->op == OP_RCR;
+}
+
+static int is_flag_setter_for(const struct parsed_op *po,
+  enum parsed_flag_op pfo)
+{
+  if (!(po->flags & OPF_FLAGS))
+    return 0;
+  if (is_rotate_op(po))
+    return pfo != PFO_Z && pfo != PFO_S && pfo != PFO_P;
+  return 1;
+}
+
+// setter class of a flag reader, see is_flag_setter_for()
+static int flag_def_class(enum parsed_flag_op pfo)
+{
+  return pfo == PFO_Z || pfo == PFO_S || pfo == PFO_P;
+}
+
+// flag setter reaching the start of each block, per setter class:
+// setter op * 2, + 1 if it's reached across a label on some path,
+// or one of FD_*; the gen value of a block is what it leaves behind
+#define FD_NONE   -1 // not reached (yet)
+#define FD_MULTI  -2 // more than one setter, or a weak one
+#define FD_ENTRY  -3 // flags undefined on some path
+#define FD_PASS   -4 // gen: no setter
+#define FD_WEAK   -5 // gen: only weak setters
+#define FD_BB(b, c, n) g_fd_bb[((b) * 2 + (c)) * 3 + (n)] // gen, in, out
+
+static unsigned char *g_op_fdweak; // rep op that might not run at all
+static int *g_fd_bb;
+// for FD_MULTI, setters are traced back from the cc op over the CFG,
+// visiting each block at most once per state: "clean" setters reach
+// without crossing a label (or a weak setter), "lab" ones don't
+static int *g_fd_seen; // per bb: stamp for clean, lab
+static int *g_fd_stack;
+static int g_fd_stamp;
+
+static int flag_def_join(int a, int b)
+{
+  if (a == FD_NONE)
+    return b;
+  if (b == FD_NONE)
+    return a;
+  if (a == FD_ENTRY || b == FD_ENTRY)
+    return FD_ENTRY;
+  if (a == FD_MULTI || b == FD_MULTI || a / 2 != b / 2)
+    return FD_MULTI;
+  return a | b;
+}
+
+static int flag_def_transfer(int b)
+{
+  const struct bblock *bb = &g_bbs[b];
+  int c, j, in, out, changed = 0;
+
+  for (c = 0; c < 2; c++) {
+    in = FD_NONE;
+    if (b == 0 || bb->pred_cnt == 0)
+      in = FD_ENTRY; // entry or unreachable
+    for (j = 0; j < bb->pred_cnt && in != FD_ENTRY; j++)
+      in = flag_def_join(in, FD_BB(bb->pred[j], c, 2));
+    if (in >= 0 && g_labels[bb->start] != NULL)
+      in |= 1;
+    FD_BB(b, c, 1) = in;
+
+    out = FD_BB(b, c, 0);
+    if (out == FD_PASS)
+      out = in;
+    else if (out == FD_WEAK)
+      // can't treat it as full setter because of ecx=0 case
+      out = (in == FD_NONE || in == FD_ENTRY) ? in : FD_MULTI;
+
+    if (FD_BB(b, c, 2) != out) {
+      FD_BB(b, c, 2) = out;
+      changed = 1;
+    }
   }
 
-  return -1;
+  return changed;
 }
 
-static int scan_for_reg_clear(int i, int reg)
+// solve reaching flag setters for the whole function,
+// cfg_build() must have been done
+static void flag_defs_solve(int opcnt)
 {
-  while (i >= 0) {
-    if (g_labels[i] != NULL) {
-      if (g_label_refs[i].next != NULL)
-        return -1;
-      if (i > 0 && LAST_OP(i - 1)) {
-        i = g_label_refs[i].i;
-        continue;
-      }
-      return -1;
-    }
-    i--;
+  struct parsed_opr opr = OPR_INIT(OPT_REG, OPLM_DWORD, xCX);
+  unsigned int uval;
+  int b, c, i, gen, ret;
 
-    if (ops[i].op == OP_XOR
-     && ops[i].operand[0].lmod == OPLM_DWORD
-     && ops[i].operand[0].reg == ops[i].operand[1].reg
-     && ops[i].operand[0].reg == reg)
-      return i;
+  free(g_op_fdweak);
+  g_op_fdweak = calloc(opcnt, 1);
+  my_assert_not(g_op_fdweak, NULL);
 
-    if (ops[i].regmask_dst & (1 << reg))
-      return -1;
+  for (i = 0; i < opcnt; i++) {
+    if (!(ops[i].flags & OPF_FLAGS) || !(ops[i].flags & OPF_REP))
+      continue;
+    ret = try_resolve_const(i, &opr, &uval);
+    if (ret != 1 || uval == 0)
+      g_op_fdweak[i] = 1;
   }
 
-  return -1;
-}
+  free(g_fd_bb);
+  g_fd_bb = malloc(g_bb_cnt * 2 * 3 * sizeof(g_fd_bb[0]));
+  my_assert_not(g_fd_bb, NULL);
 
-static void patch_esp_adjust(struct parsed_op *po, int adj)
-{
-  ferr_assert(po, po->op == OP_ADD);
-  ferr_assert(po, IS(opr_name(po, 0), "esp"));
-  ferr_assert(po, po->operand[1].type == OPT_CONST);
+  for (b = 0; b < g_bb_cnt; b++) {
+    for (c = 0; c < 2; c++) {
+      gen = FD_PASS;
+      for (i = g_bbs[b].end - 1; i >= g_bbs[b].start; i--) {
+        if (!is_flag_setter_for(&ops[i], c ? PFO_Z : PFO_O))
+          continue;
+        if (!g_op_fdweak[i]) {
+          gen = gen == FD_PASS ? i * 2 : FD_MULTI;
+          break;
+        }
+        gen = FD_WEAK;
+      }
+      FD_BB(b, c, 0) = gen;
+      FD_BB(b, c, 1) = FD_BB(b, c, 2) = FD_NONE;
+    }
+  }
 
-  // this is a bit of a hack, but deals with use of
-  // single adj for multiple calls
-  po->operand[1].val -= adj;
-  po->flags |= OPF_RMD;
-  if (po->operand[1].val == 0)
-    po->flags |= OPF_DONE;
-  ferr_assert(po, (int)po->operand[1].val >= 0);
+  cfg_solve(1, flag_def_transfer);
+
+  free(g_fd_seen);
+  free(g_fd_stack);
+  g_fd_seen = calloc(g_bb_cnt * 2, sizeof(g_fd_seen[0]));
+  g_fd_stack = malloc(g_bb_cnt * 2 * sizeof(g_fd_stack[0]));
+  my_assert_not(g_fd_seen, NULL);
+  my_assert_not(g_fd_stack, NULL);
+  g_fd_stamp = 0;
 }
 
-// scan for positive, constant esp adjust
-// multipath case is preliminary
-static int scan_for_esp_adjust(int i, int opcnt,
-  int adj_expect, int *adj, int *is_multipath, int do_update)
+// find flag setters that may affect cc op i,
+// flag_defs_solve() must have been done;
+// *branched is set if any of them isn't straight-line or may not run
+static int scan_for_flag_set(int i, int *branched,
+  int *setters, int setter_max, int *setter_cnt)
 {
-  int adj_expect_unknown = 0;
-  struct parsed_op *po;
-  int first_pop = -1;
-  int adj_best = 0;
+  const struct bblock *bb;
+  int b = g_op_bb[i];
+  int sp = 0, first, lab, cnt0;
+  int j, k, t;
 
-  *adj = *is_multipath = 0;
-  if (adj_expect < 0) {
-    adj_expect_unknown = 1;
-    adj_expect = 32 * 4; // enough?
+  for (j = i - 1; j >= g_bbs[b].start; j--) {
+    if (!is_flag_setter_for(&ops[j], ops[i].pfo))
+      continue;
+    if (*setter_cnt < setter_max)
+      setters[*setter_cnt] = j;
+    (*setter_cnt)++;
+    if (!g_op_fdweak[j])
+      return 0;
+    *branched = 1;
   }
 
-  for (; i < opcnt && *adj < adj_expect; i++) {
-    if (g_labels[i] != NULL)
-      *is_multipath = 1;
+  t = FD_BB(b, flag_def_class(ops[i].pfo), 1);
+  if (t == FD_ENTRY)
+    return -1;
+  if (t >= 0) {
+    if (t & 1)
+      *branched = 1;
+    if (*setter_cnt < setter_max)
+      setters[*setter_cnt] = t / 2;
+    (*setter_cnt)++;
+    return 0;
+  }
 
-    po = &ops[i];
-    if (po->flags & OPF_DONE)
-      continue;
+  if (g_labels[g_bbs[b].start] != NULL)
+    *branched = 1;
+  cnt0 = *setter_cnt;
+
+  // the stack holds block starts to go past, as bb * 2 + lab;
+  // each block is visited at most twice, so is pushed at most twice
+  g_fd_stamp++;
+  g_fd_stack[sp++] = b * 2 + *branched;
+  while (sp > 0) {
+    b = g_fd_stack[--sp] / 2;
+    lab = g_fd_stack[sp] & 1;
+    bb = &g_bbs[b];
+    if (b == 0 || bb->pred_cnt == 0)
+      return -1; // entry or unreachable, flags undefined
+
+    for (k = 0; k < bb->pred_cnt; k++) {
+      b = bb->pred[k];
+      if (g_fd_seen[b * 2 + lab] == g_fd_stamp)
+        continue;
+      first = g_fd_seen[b * 2 + !lab] != g_fd_stamp;
+      g_fd_seen[b * 2 + lab] = g_fd_stamp;
 
-    if (po->op == OP_ADD && po->operand[0].reg == xSP) {
-      if (po->operand[1].type != OPT_CONST)
-        ferr(&ops[i], "non-const esp adjust?\n");
-      *adj += po->operand[1].val;
-      if (*adj & 3)
-        ferr(&ops[i], "unaligned esp adjust: %x\n", *adj);
-      if (do_update) {
-        if (!*is_multipath)
-          patch_esp_adjust(po, adj_expect);
-        else
-          po->flags |= OPF_RMD;
-      }
-      return i;
+      t = lab;
+      for (j = g_bbs[b].end - 1; j >= g_bbs[b].start; j--) {
+        if (!is_flag_setter_for(&ops[j], ops[i].pfo))
+          continue;
+        if (first) {
+          if (*setter_cnt < setter_max)
+            setters[*setter_cnt] = j;
+          (*setter_cnt)++;
+        }
+        if (t || g_op_fdweak[j])
+          *branched = 1;
+        if (!g_op_fdweak[j])
+          break;
+        // can't treat it as full setter because of ecx=0 case
+        t = 1;
+      }
+      if (j >= g_bbs[b].start)
+        continue;
+
+      if (g_labels[g_bbs[b].start] != NULL)
+        t = 1;
+      g_fd_stack[sp++] = b * 2 + t;
+    }
+  }
+
+  // keep the setters from other blocks in op order
+  if (*setter_cnt > setter_max)
+    return 0;
+  for (j = cnt0 + 1; j < *setter_cnt; j++) {
+    t = setters[j];
+    for (k = j; k > cnt0 && setters[k - 1] > t; k--)
+      setters[k] = setters[k - 1];
+    setters[k] = t;
+  }
+
+  return 0;
+}
+
+// regs read before being overwritten on some path, per op on entry:
+// bit reg - a dword read, a narrower write doesn't end it,
+// bit reg + 8 - a read of any size, any write ends it;
+// matches what find_next_read_reg() finds with OPLM_DWORD/OPLM_BYTE
+static int *g_op_live;
+static int *g_live_bb; // per bb: live on entry
+
+static int reg_live_transfer(int b)
+{
+  const struct bblock *bb = &g_bbs[b];
+  const struct parsed_op *po;
+  int live = 0, def, reg;
+  int i;
+
+  for (i = 0; i < bb->succ_cnt; i++)
+    live |= g_live_bb[bb->succ[i]];
+
+  for (i = bb->end - 1; i >= bb->start; i--) {
+    po = &ops[i];
+    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+      // branches are only followed
+      g_op_live[i] = live;
+      continue;
+    }
+
+    def = po->regmask_dst;
+    if (po->op == OP_CALL)
+      def |= (1 << xAX) | (1 << xCX) | (1 << xDX); // as is_opr_modified()
+    def = (def & 0xff) * 0x101;
+    reg = po->operand[0].reg;
+    if ((po->flags & OPF_DATA) && po->operand[0].type == OPT_REG
+        && reg >= 0 && reg < 8)
+    {
+      if (po->operand[0].lmod < OPLM_DWORD)
+        def &= ~(1 << reg);
+      if (po->operand[0].lmod < OPLM_BYTE)
+        def &= ~(1 << (reg + 8));
+    }
+
+    live = (live & ~def) | (po->regmask_src & 0xff) * 0x101;
+    g_op_live[i] = live;
+  }
+
+  if (g_live_bb[b] == live)
+    return 0;
+  g_live_bb[b] = live;
+  return 1;
+}
+
+// solve reg liveness for the whole function,
+// cfg_build() must have been done
+static void reg_live_solve(int opcnt)
+{
+  free(g_op_live);
+  free(g_live_bb);
+  g_op_live = malloc(opcnt * sizeof(g_op_live[0]));
+  g_live_bb = calloc(g_bb_cnt, sizeof(g_live_bb[0]));
+  my_assert_not(g_op_live, NULL);
+  my_assert_not(g_live_bb, NULL);
+
+  cfg_solve(0, reg_live_transfer);
+}
+
+// is reg read on some path from op i before being overwritten?
+// lmod is OPLM_DWORD or OPLM_BYTE, like for find_next_read_reg();
+// reg_live_solve() must have been done
+static int is_reg_live(int i, int opcnt, int reg, enum opr_lenmod lmod)
+{
+  if (i >= opcnt)
+    return 0;
+  if (lmod != OPLM_DWORD)
+    reg += 8;
+  return (g_op_live[i] >> reg) & 1;
+}
+
+static int opr_is_mem(const struct parsed_opr *popr)
+{
+  return popr->type == OPT_REGMEM || popr->type == OPT_LABEL;
+}
+
+// can po store to memory that a mem operand somewhere else aliases?
+static int op_may_write_mem(const struct parsed_op *po)
+{
+  if (po->flags & OPF_RMD)
+    return 0;
+
+  switch (po->op) {
+  case OP_CALL:
+  case OP_PUSH:
+  case OP_PUSHA:
+  case OP_STOS:
+  case OP_MOVS:
+    return 1;
+  case OP_XCHG:
+    if (opr_is_mem(&po->operand[1]))
+      return 1;
+    break;
+  case OP_FST:
+  case OP_FIST:
+    return opr_is_mem(&po->operand[0]);
+  default:
+    break;
+  }
+
+  return (po->flags & OPF_DATA) && opr_is_mem(&po->operand[0]);
+}
+
+// scan for po_test operand modification on all paths from its op
+// (setter_i) to cc op i, which must be the only flag setter for i;
+// with opr0 only operand[0] is checked, like scan_for_mod_opr0()
+static int scan_for_mod_cfg(struct parsed_op *po_test, int setter_i,
+  int i, int opcnt, int opr0)
+{
+  int stamp = visit_stamp();
+  int base = g_wstack_cnt;
+  int mem_src = 0, addr_mask;
+  int b, j, k, end;
+
+  if (!opr0 && po_test->operand_cnt == 1
+      && po_test->operand[0].type == OPT_CONST)
+    return -1;
+
+  // operands are compared by name only, so any store on the way
+  // may change a mem operand through another pointer
+  for (j = 0; j < (opr0 ? 1 : po_test->operand_cnt); j++)
+    if (opr_is_mem(&po_test->operand[j]))
+      mem_src = 1;
+  // is_any_opr_modified() covers the address regs through regmask_src
+  addr_mask = opr_addr_regmask(&po_test->operand[0]);
+
+  b = g_op_bb[i];
+  end = i;
+  for (;;) {
+    for (k = end - 1; k >= g_bbs[b].start; k--) {
+      if (k == setter_i)
+        break;
+      if ((opr0 ? is_opr_addr_modified(&po_test->operand[0], addr_mask,
+                    &ops[k])
+                : is_any_opr_modified(po_test, &ops[k], 0))
+          || (mem_src && op_may_write_mem(&ops[k])))
+      {
+        g_wstack_cnt = base;
+        return k;
+      }
+    }
+    if (k < g_bbs[b].start) {
+      for (j = 0; j < g_bbs[b].pred_cnt; j++) {
+        k = g_bbs[g_bbs[b].pred[j]].start;
+        if (g_op_seen[k] == stamp)
+          continue;
+        g_op_seen[k] = stamp;
+        wstack_push(g_bbs[b].pred[j]);
+      }
+    }
+    if (g_wstack_cnt <= base)
+      break;
+    b = g_wstack[--g_wstack_cnt];
+    end = g_bbs[b].end;
+  }
+
+  return -1;
+}
+
+// can cc op i be computed from the operands of its flag setter
+// in another block instead of materializing cond_* at the setter?
+static int flag_fwd_ok(struct parsed_op *po_set, const int *setters,
+  int cnt, int i, int opcnt, int opr0)
+{
+  if (cnt != 1 || setters[0] > i)
+    return 0;
+  if (opr0) {
+    // flags must be a plain function of the result
+    switch (po_set->op) {
+    case OP_AND: case OP_OR: case OP_XOR:
+    case OP_ADD: case OP_SUB: case OP_INC: case OP_DEC: case OP_NEG:
+      break;
+    case OP_SHL: case OP_SHR: case OP_SAR:
+      if (po_set->operand[1].type == OPT_CONST
+          && (po_set->operand[1].val & 0x1f) != 0)
+        break;
+      // fallthrough
+    default:
+      return 0;
+    }
+  }
+  return scan_for_mod_cfg(po_set, setters[0], i, opcnt, opr0) < 0;
+}
+
+// scan back for cdq, if anything modifies edx, fail
+static int scan_for_cdq_edx(int i)
+{
+  while (i >= 0) {
+    if (g_labels[i] != NULL) {
+      if (g_label_refs[i].next != NULL)
+        return -1;
+      if (i > 0 && LAST_OP(i - 1)) {
+        i = g_label_refs[i].i;
+        continue;
+      }
+      return -1;
+    }
+    i--;
+
+    if (ops[i].op == OP_CDQ)
+      return i;
+
+    if (ops[i].regmask_dst & (1 << xDX))
+      return -1;
+  }
+
+  return -1;
+}
+
+static int scan_for_reg_clear(int i, int reg)
+{
+  while (i >= 0) {
+    if (g_labels[i] != NULL) {
+      if (g_label_refs[i].next != NULL)
+        return -1;
+      if (i > 0 && LAST_OP(i - 1)) {
+        i = g_label_refs[i].i;
+        continue;
+      }
+      return -1;
+    }
+    i--;
+
+    if (ops[i].op == OP_XOR
+     && ops[i].operand[0].lmod == OPLM_DWORD
+     && ops[i].operand[0].reg == ops[i].operand[1].reg
+     && ops[i].operand[0].reg == reg)
+      return i;
+
+    if (ops[i].regmask_dst & (1 << reg))
+      return -1;
+  }
+
+  return -1;
+}
+
+static void patch_esp_adjust(struct parsed_op *po, int adj)
+{
+  ferr_assert(po, po->op == OP_ADD);
+  ferr_assert(po, IS(opr_name(po, 0), "esp"));
+  ferr_assert(po, po->operand[1].type == OPT_CONST);
+
+  // this is a bit of a hack, but deals with use of
+  // single adj for multiple calls
+  po->operand[1].val -= adj;
+  po->flags |= OPF_RMD;
+  if (po->operand[1].val == 0)
+    po->flags |= OPF_DONE;
+  ferr_assert(po, (int)po->operand[1].val >= 0);
+}
+
+// scan for positive, constant esp adjust
+// multipath case is preliminary
+static int scan_for_esp_adjust(int i, int opcnt,
+  int adj_expect, int *adj, int *is_multipath, int do_update)
+{
+  int adj_expect_unknown = 0;
+  struct parsed_op *po;
+  int first_pop = -1;
+  int adj_best = 0;
+
+  *adj = *is_multipath = 0;
+  if (adj_expect < 0) {
+    adj_expect_unknown = 1;
+    adj_expect = 32 * 4; // enough?
+  }
+
+  for (; i < opcnt && *adj < adj_expect; i++) {
+    if (g_labels[i] != NULL)
+      *is_multipath = 1;
+
+    po = &ops[i];
+    if (po->flags & OPF_DONE)
+      continue;
+
+    if (po->op == OP_ADD && po->operand[0].reg == xSP) {
+      if (po->operand[1].type != OPT_CONST)
+        ferr(&ops[i], "non-const esp adjust?\n");
+      *adj += po->operand[1].val;
+      if (*adj & 3)
+        ferr(&ops[i], "unaligned esp adjust: %x\n", *adj);
+      if (do_update) {
+        if (!*is_multipath)
+          patch_esp_adjust(po, adj_expect);
+        else
+          po->flags |= OPF_RMD;
+      }
+      return i;
     }
     else if (po->op == OP_PUSH) {
       //if (first_pop == -1)
@@ -3555,35 +4731,46 @@ static int scan_for_esp_adjust(int i, int opcnt,
   return -1;
 }
 
-static void scan_fwd_set_flags(int i, int opcnt, int magic, int flags)
+static void scan_fwd_set_flags(int i, int opcnt, int flags)
 {
   struct parsed_op *po;
+  int stamp = visit_stamp();
+  int base = g_wstack_cnt;
   int j;
 
-  if (i < 0)
-    ferr(ops, "%s: followed bad branch?\n", __func__);
+  wstack_push(i);
+  while (g_wstack_cnt > base)
+  {
+    i = g_wstack[--g_wstack_cnt];
+    if (i < 0)
+      ferr(ops, "%s: followed bad branch?\n", __func__);
 
-  for (; i < opcnt; i++) {
-    po = &ops[i];
-    if (po->cc_scratch == magic)
-      return;
-    po->cc_scratch = magic;
-    po->flags |= flags;
+    for (; i < opcnt; i++) {
+      po = &ops[i];
+      if (g_op_seen[i] == stamp)
+        break;
+      g_op_seen[i] = stamp;
+      po->flags |= flags;
+
+      if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+        if (po->btj != NULL) {
+          // jumptable
+          for (j = po->btj->count - 1; j >= 0; j--)
+            wstack_push(po->btj->d[j].bt_i);
+          break;
+        }
 
-    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++)
-          scan_fwd_set_flags(po->btj->d[j].bt_i, opcnt, magic, flags);
-        return;
+        if (!(po->flags & OPF_CJMP)) {
+          wstack_push(po->bt_i);
+          break;
+        }
+        wstack_push(i + 1);
+        i = po->bt_i - 1;
+        continue;
       }
-
-      scan_fwd_set_flags(po->bt_i, opcnt, magic, flags);
-      if (!(po->flags & OPF_CJMP))
-        return;
+      if (po->flags & OPF_TAIL)
+        break;
     }
-    if (po->flags & OPF_TAIL)
-      return;
   }
 }
 
@@ -3748,73 +4935,247 @@ static void scan_for_call_type(int i, const struct parsed_opr *opr,
   }
 }
 
-static void add_label_ref(struct label_ref *lr, int op_i)
+// per-function arena: labels, label refs, cloned protos and jumptables
+// live until the function's ops are reset, then go away at once
+#define FA_BLOCK_SIZE 0x10000
+
+struct fa_block {
+  struct fa_block *next;
+  size_t size;
+  size_t used;
+};
+
+static struct fa_block *g_fa_first;
+static struct fa_block *g_fa_cur;
+
+static struct fa_block *fa_block_new(size_t size)
 {
-  struct label_ref *lr_new;
+  struct fa_block *b;
 
-  if (lr->i == -1) {
-    lr->i = op_i;
-    return;
-  }
+  if (size < FA_BLOCK_SIZE)
+    size = FA_BLOCK_SIZE;
+  b = malloc(sizeof(*b) + size);
+  my_assert_not(b, NULL);
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
 
-  lr_new = calloc(1, sizeof(*lr_new));
-  lr_new->i = op_i;
-  lr_new->next = lr->next;
-  lr->next = lr_new;
+  return b;
 }
 
-static struct parsed_data *try_resolve_jumptab(int i, int opcnt)
+// returns zeroed memory
+static void *fa_calloc(size_t size)
 {
-  struct parsed_op *po = &ops[i];
-  struct parsed_data *pd;
-  char label[NAMELEN], *p;
-  int len, j, l;
+  struct fa_block *b;
+  void *p;
 
-  p = strchr(po->operand[0].name, '[');
-  if (p == NULL)
-    return NULL;
+  size = (size + 7) & ~7;
 
-  len = p - po->operand[0].name;
-  strncpy(label, po->operand[0].name, len);
-  label[len] = 0;
+  if (g_fa_first == NULL)
+    g_fa_first = g_fa_cur = fa_block_new(size);
 
-  for (j = 0, pd = NULL; j < g_func_pd_cnt; j++) {
-    if (IS(g_func_pd[j].label, label)) {
-      pd = &g_func_pd[j];
+  // blocks of earlier functions are reused in order
+  while (g_fa_cur->used + size > g_fa_cur->size) {
+    if (g_fa_cur->next == NULL) {
+      g_fa_cur->next = fa_block_new(size);
+      g_fa_cur = g_fa_cur->next;
       break;
     }
+    g_fa_cur = g_fa_cur->next;
+    g_fa_cur->used = 0;
   }
-  if (pd == NULL)
-    //ferr(po, "label '%s' not parsed?\n", label);
-    return NULL;
 
-  if (pd->type != OPT_OFFSET)
-    ferr(po, "label '%s' with non-offset data?\n", label);
+  b = g_fa_cur;
+  p = (char *)(b + 1) + b->used;
+  b->used += size;
+  memset(p, 0, size);
 
-  // find all labels, link
-  for (j = 0; j < pd->count; j++) {
-    for (l = 0; l < opcnt; l++) {
-      if (g_labels[l] != NULL && IS(g_labels[l], pd->d[j].u.label)) {
-        add_label_ref(&g_label_refs[l], i);
-        pd->d[j].bt_i = l;
-        break;
-      }
+  return p;
+}
+
+static char *fa_strdup(const char *s)
+{
+  size_t len = strlen(s) + 1;
+
+  return memcpy(fa_calloc(len), s, len);
+}
+
+// realloc counterpart, the old copy is just left behind
+static void *fa_grow(void *p, size_t old_size, size_t new_size)
+{
+  void *n;
+
+  n = fa_calloc(new_size);
+  if (p != NULL)
+    memcpy(n, p, old_size < new_size ? old_size : new_size);
+
+  return n;
+}
+
+static void fa_reset(void)
+{
+  if (g_fa_first != NULL) {
+    g_fa_cur = g_fa_first;
+    g_fa_cur->used = 0;
+  }
+}
+
+static struct parsed_proto *fa_proto_new(void)
+{
+  struct parsed_proto *pp;
+
+  pp = fa_calloc(sizeof(*pp));
+  pp->arg = fa_calloc(PP_MAX_ARGS * sizeof(pp->arg[0]));
+
+  return pp;
+}
+
+static void add_label_ref(struct label_ref *lr, int op_i)
+{
+  struct label_ref *lr_new;
+
+  if (lr->i == -1) {
+    lr->i = op_i;
+    return;
+  }
+
+  lr_new = fa_calloc(sizeof(*lr_new));
+  lr_new->i = op_i;
+  lr_new->next = lr->next;
+  lr->next = lr_new;
+}
+
+static unsigned int label_hash(const char *name)
+{
+  return str_hash(name) & (LABEL_HASH_SIZE - 1);
+}
+
+static void label_hash_add(int i)
+{
+  unsigned int h = label_hash(g_labels[i]);
+
+  g_label_hnext[i] = g_label_hash[h];
+  g_label_hash[h] = i + 1;
+}
+
+static void label_hash_del(int i)
+{
+  int *pl = &g_label_hash[label_hash(g_labels[i])];
+
+  for (; *pl != 0; pl = &g_label_hnext[*pl - 1]) {
+    if (*pl == i + 1) {
+      *pl = g_label_hnext[i];
+      g_label_hnext[i] = 0;
+      return;
     }
   }
+}
 
-  return pd;
+// returns op index of the label or -1
+static int find_label(const char *name, int opcnt)
+{
+  int l;
+
+  for (l = g_label_hash[label_hash(name)]; l != 0; l = g_label_hnext[l - 1])
+    if (l - 1 < opcnt && IS(g_labels[l - 1], name))
+      return l - 1;
+
+  return -1;
+}
+
+static void free_label(int i)
+{
+  if (g_labels[i] == NULL)
+    return;
+
+  label_hash_del(i);
+  g_labels[i] = NULL;
 }
 
 static void clear_labels(int count)
 {
   int i;
 
-  for (i = 0; i < count; i++) {
-    if (g_labels[i] != NULL) {
-      free(g_labels[i]);
-      g_labels[i] = NULL;
+  for (i = 0; i < count; i++)
+    free_label(i);
+}
+
+// make sure there is room for at least cnt ops,
+// new entries are left in the same state as after a reset
+static void ops_reserve(int cnt)
+{
+  int i, old = g_ops_alloc;
+
+  if (cnt <= g_ops_alloc)
+    return;
+
+  g_ops_alloc = g_ops_alloc * 2;
+  if (g_ops_alloc < cnt)
+    g_ops_alloc = cnt;
+
+  ops = realloc(ops, g_ops_alloc * sizeof(ops[0]));
+  g_labels = realloc(g_labels, g_ops_alloc * sizeof(g_labels[0]));
+  g_label_refs = realloc(g_label_refs,
+                   g_ops_alloc * sizeof(g_label_refs[0]));
+  g_label_hnext = realloc(g_label_hnext,
+                    g_ops_alloc * sizeof(g_label_hnext[0]));
+  g_cbits = realloc(g_cbits, (g_ops_alloc + 7) / 8);
+  g_op_seen = realloc(g_op_seen, g_ops_alloc * sizeof(g_op_seen[0]));
+  my_assert_not(ops, NULL);
+  my_assert_not(g_labels, NULL);
+  my_assert_not(g_label_refs, NULL);
+  my_assert_not(g_label_hnext, NULL);
+  my_assert_not(g_cbits, NULL);
+  my_assert_not(g_op_seen, NULL);
+
+  memset(ops + old, 0, (g_ops_alloc - old) * sizeof(ops[0]));
+  memset(g_op_seen + old, 0, (g_ops_alloc - old) * sizeof(g_op_seen[0]));
+  for (i = old; i < g_ops_alloc; i++) {
+    g_labels[i] = NULL;
+    g_label_refs[i].i = -1;
+    g_label_refs[i].next = NULL;
+    g_label_hnext[i] = 0;
+  }
+}
+
+static struct parsed_data *try_resolve_jumptab(int i, int opcnt)
+{
+  struct parsed_op *po = &ops[i];
+  struct parsed_data *pd;
+  char label[NAMELEN], *p;
+  int len, j, l;
+
+  p = strchr(po->operand[0].name, '[');
+  if (p == NULL)
+    return NULL;
+
+  len = p - po->operand[0].name;
+  strncpy(label, po->operand[0].name, len);
+  label[len] = 0;
+
+  for (j = 0, pd = NULL; j < g_func_pd_cnt; j++) {
+    if (IS(g_func_pd[j].label, label)) {
+      pd = &g_func_pd[j];
+      break;
     }
   }
+  if (pd == NULL)
+    //ferr(po, "label '%s' not parsed?\n", label);
+    return NULL;
+
+  if (pd->type != OPT_OFFSET)
+    ferr(po, "label '%s' with non-offset data?\n", label);
+
+  // find all labels, link
+  for (j = 0; j < pd->count; j++) {
+    l = find_label(pd->d[j].u.label, opcnt);
+    if (l >= 0) {
+      add_label_ref(&g_label_refs[l], i);
+      pd->d[j].bt_i = l;
+    }
+  }
+
+  return pd;
 }
 
 static int get_pp_arg_regmask_src(const struct parsed_proto *pp)
@@ -3904,15 +5265,15 @@ static void resolve_branches_parse_calls(int opcnt)
     po->btj = NULL;
 
     if (po->datap != NULL) {
-      pp = calloc(1, sizeof(*pp));
-      my_assert_not(pp, NULL);
+      pp = proto_new();
 
       ret = parse_protostr(po->datap, pp);
       if (ret < 0)
         ferr(po, "bad protostr supplied: %s\n", (char *)po->datap);
       free(po->datap);
       po->datap = NULL;
-      po->pp = pp;
+      po->pp = proto_clone(pp);
+      proto_release(pp);
     }
 
     if (po->op == OP_CALL) {
@@ -3990,20 +5351,17 @@ static void resolve_branches_parse_calls(int opcnt)
       continue;
     }
 
-    for (l = 0; l < opcnt; l++) {
-      if (g_labels[l] != NULL
-          && IS(po->operand[0].name, g_labels[l]))
-      {
-        if (l == i + 1 && po->op == OP_JMP) {
-          // yet another alignment type...
-          po->flags |= OPF_RMD | OPF_DONE;
-          po->flags &= ~OPF_JMP;
-          po->op = OP_NOP;
-          break;
-        }
+    l = find_label(po->operand[0].name, opcnt);
+    if (l >= 0) {
+      if (l == i + 1 && po->op == OP_JMP) {
+        // yet another alignment type...
+        po->flags |= OPF_RMD | OPF_DONE;
+        po->flags &= ~OPF_JMP;
+        po->op = OP_NOP;
+      }
+      else {
         add_label_ref(&g_label_refs[l], i);
         po->bt_i = l;
-        break;
       }
     }
 
@@ -4033,7 +5391,7 @@ tailcall:
 }
 
 static int resolve_origin(int i, const struct parsed_opr *opr,
-  int magic, int *op_i, int *is_caller);
+  int *op_i, int *is_caller);
 static void set_label(int i, const char *name);
 
 static void eliminate_seh_writes(int opcnt)
@@ -4096,19 +5454,10 @@ static void eliminate_seh_finally(int opcnt)
     return;
 
   // find finally code (bt_i is not set because it's call)
-  for (i = 0; i < opcnt; i++) {
-    if (g_labels[i] == NULL)
-      continue;
-    if (!IS(g_labels[i], target_name))
-      continue;
-
-    ferr_assert(&ops[i], target_i == -1);
-    target_i = i;
-  }
+  target_i = find_label(target_name, opcnt);
   ferr_assert(&ops[0], target_i != -1);
 
-  find_reachable_exits(target_i, opcnt, target_i + opcnt * 24,
-    exits, &exit_count);
+  find_reachable_exits(target_i, opcnt, exits, &exit_count);
   ferr_assert(&ops[target_i], exit_count == 1);
   ferr_assert(&ops[target_i], ops[exits[0]].op == OP_RET);
   tgend_i = exits[0];
@@ -4166,8 +5515,7 @@ static void eliminate_seh(int opcnt)
           break;
         if (ops[j].operand[0].type == OPT_REG) {
           k = -1;
-          ret = resolve_origin(j, &ops[j].operand[0],
-                  j + opcnt * 22, &k, NULL);
+          ret = resolve_origin(j, &ops[j].operand[0], &k, NULL);
           if (ret == 1)
             ops[k].flags |= OPF_RMD | OPF_DONE | OPF_NOREGS;
         }
@@ -4177,8 +5525,7 @@ static void eliminate_seh(int opcnt)
     }
     else {
       k = -1;
-      ret = resolve_origin(i, &ops[i].operand[1],
-              i + opcnt * 23, &k, NULL);
+      ret = resolve_origin(i, &ops[i].operand[1], &k, NULL);
       if (ret == 1)
         ops[k].flags |= OPF_RMD | OPF_DONE | OPF_NOREGS;
     }
@@ -4663,59 +6010,61 @@ static void scan_prologue_epilogue(int opcnt, int *stack_align)
 // returns 1 if found, *op_i is then set to origin
 // returns -1 if multiple origins are found
 static int resolve_origin(int i, const struct parsed_opr *opr,
-  int magic, int *op_i, int *is_caller)
+  int *op_i, int *is_caller)
 {
-  struct label_ref *lr;
-  int ret = 0;
+  int stamp = visit_stamp();
+  int base = g_bw_cnt;
+  int ret;
 
+  bw_push(i);
   while (1) {
-    if (g_labels[i] != NULL) {
-      lr = &g_label_refs[i];
-      for (; lr != NULL; lr = lr->next) {
-        check_i(&ops[i], lr->i);
-        ret |= resolve_origin(lr->i, opr, magic, op_i, is_caller);
-      }
-      if (i > 0 && LAST_OP(i - 1))
-        return ret;
-    }
+    i = bw_step();
+    if (i == BW_REF)
+      continue;
 
-    i--;
-    if (i < 0) {
+    if (i == BW_END)
+      ret = g_bw[g_bw_cnt - 1].ret;
+    else if (i < 0) {
       if (is_caller != NULL)
         *is_caller = 1;
-      return -1;
+      ret = -1;
     }
+    else if (g_op_seen[i] == stamp)
+      ret = g_bw[g_bw_cnt - 1].ret;
+    else {
+      g_op_seen[i] = stamp;
 
-    if (ops[i].cc_scratch == magic)
-      return ret;
-    ops[i].cc_scratch = magic;
-
-    if (!(ops[i].flags & OPF_DATA))
-      continue;
-    if (!is_opr_modified(opr, &ops[i]))
-      continue;
-
-    if (*op_i >= 0) {
-      if (*op_i == i || are_ops_same(&ops[*op_i], &ops[i]))
-        return ret | 1;
+      if (!(ops[i].flags & OPF_DATA))
+        continue;
+      if (!is_opr_modified(opr, &ops[i]))
+        continue;
 
-      return -1;
+      if (*op_i >= 0) {
+        if (*op_i == i || are_ops_same(&ops[*op_i], &ops[i]))
+          ret = g_bw[g_bw_cnt - 1].ret | 1;
+        else
+          ret = -1;
+      }
+      else {
+        *op_i = i;
+        ret = g_bw[g_bw_cnt - 1].ret | 1;
+      }
     }
 
-    *op_i = i;
-    return ret | 1;
+    if (--g_bw_cnt == base)
+      return ret;
+    g_bw[g_bw_cnt - 1].ret |= ret;
   }
 }
 
-static int resolve_origin_reg(int i, int reg, int magic, int *op_i,
-  int *is_caller)
+static int resolve_origin_reg(int i, int reg, int *op_i, int *is_caller)
 {
   struct parsed_opr opr = OPR_INIT(OPT_REG, OPLM_DWORD, reg);
 
   *op_i = -1;
   if (is_caller != NULL)
     *is_caller = 0;
-  return resolve_origin(i, &opr, magic, op_i, is_caller);
+  return resolve_origin(i, &opr, op_i, is_caller);
 }
 
 // find an instruction that previously referenced opr
@@ -4723,77 +6072,84 @@ static int resolve_origin_reg(int i, int reg, int magic, int *op_i,
 // *op_i must be set to -1 by the caller
 // returns 1 if found, *op_i is then set to referencer insn
 static int resolve_last_ref(int i, const struct parsed_opr *opr,
-  int magic, int *op_i)
+  int *op_i)
 {
-  struct label_ref *lr;
-  int ret = 0;
+  int stamp = visit_stamp();
+  int base = g_bw_cnt;
+  int ret;
 
+  bw_push(i);
   while (1) {
-    if (g_labels[i] != NULL) {
-      lr = &g_label_refs[i];
-      for (; lr != NULL; lr = lr->next) {
-        check_i(&ops[i], lr->i);
-        ret |= resolve_last_ref(lr->i, opr, magic, op_i);
-      }
-      if (i > 0 && LAST_OP(i - 1))
-        return ret;
-    }
-
-    i--;
-    if (i < 0)
-      return -1;
+    i = bw_step();
+    if (i == BW_REF)
+      continue;
 
-    if (ops[i].cc_scratch == magic)
-      return 0;
-    ops[i].cc_scratch = magic;
+    if (i == BW_END)
+      ret = g_bw[g_bw_cnt - 1].ret;
+    else if (i < 0)
+      ret = -1;
+    else if (g_op_seen[i] == stamp)
+      ret = 0;
+    else {
+      g_op_seen[i] = stamp;
 
-    if (!is_opr_referenced(opr, &ops[i]))
-      continue;
+      if (!is_opr_referenced(opr, &ops[i]))
+        continue;
 
-    if (*op_i >= 0)
-      return -1;
+      if (*op_i >= 0)
+        ret = -1;
+      else {
+        *op_i = i;
+        ret = 1;
+      }
+    }
 
-    *op_i = i;
-    return 1;
+    if (--g_bw_cnt == base)
+      return ret;
+    g_bw[g_bw_cnt - 1].ret |= ret;
   }
 }
 
 // adjust datap of all reachable 'op' insns when moving back
 // returns  1 if at least 1 op was found
 // returns -1 if path without an op was found
-static int adjust_prev_op(int i, enum op_op op, int magic, void *datap)
+static int adjust_prev_op(int i, enum op_op op, void *datap)
 {
-  struct label_ref *lr;
-  int ret = 0;
-
-  if (ops[i].cc_scratch == magic)
-    return 0;
-  ops[i].cc_scratch = magic;
+  int stamp = visit_stamp();
+  int base = g_bw_cnt;
+  int ret;
 
+  g_op_seen[i] = stamp;
+  bw_push(i);
   while (1) {
-    if (g_labels[i] != NULL) {
-      lr = &g_label_refs[i];
-      for (; lr != NULL; lr = lr->next) {
-        check_i(&ops[i], lr->i);
-        ret |= adjust_prev_op(lr->i, op, magic, datap);
+    i = bw_step();
+    if (i == BW_REF) {
+      i = g_bw[g_bw_cnt - 1].i;
+      if (g_op_seen[i] != stamp) {
+        g_op_seen[i] = stamp;
+        continue;
       }
-      if (i > 0 && LAST_OP(i - 1))
-        return ret;
+      ret = 0;
     }
+    else if (i == BW_END)
+      ret = g_bw[g_bw_cnt - 1].ret;
+    else if (i < 0)
+      ret = -1;
+    else if (g_op_seen[i] == stamp)
+      ret = 0;
+    else {
+      g_op_seen[i] = stamp;
 
-    i--;
-    if (i < 0)
-      return -1;
-
-    if (ops[i].cc_scratch == magic)
-      return 0;
-    ops[i].cc_scratch = magic;
+      if (ops[i].op != op)
+        continue;
 
-    if (ops[i].op != op)
-      continue;
+      ops[i].datap = datap;
+      ret = 1;
+    }
 
-    ops[i].datap = datap;
-    return 1;
+    if (--g_bw_cnt == base)
+      return ret;
+    g_bw[g_bw_cnt - 1].ret |= ret;
   }
 }
 
@@ -4802,143 +6158,160 @@ static int adjust_prev_op(int i, enum op_op op, int magic, void *datap)
 // on return, *op_i is set to first referencer insn
 // returns 1 if exactly 1 referencer is found
 static int find_next_read(int i, int opcnt,
-  const struct parsed_opr *opr, int magic, int *op_i)
+  const struct parsed_opr *opr, int *op_i)
 {
   struct parsed_op *po;
+  int stamp = visit_stamp();
+  int base = g_wstack_cnt;
   int j, ret = 0;
 
-  for (; i < opcnt; i++)
+  wstack_push(i);
+  while (g_wstack_cnt > base)
   {
-    if (ops[i].cc_scratch == magic)
-      return ret;
-    ops[i].cc_scratch = magic;
+    i = g_wstack[--g_wstack_cnt];
+    for (; i < opcnt; i++)
+    {
+      if (g_op_seen[i] == stamp)
+        break;
+      g_op_seen[i] = stamp;
 
-    po = &ops[i];
-    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++) {
-          check_i(po, po->btj->d[j].bt_i);
-          ret |= find_next_read(po->btj->d[j].bt_i, opcnt, opr,
-                   magic, op_i);
+      po = &ops[i];
+      if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+        if (po->btj != NULL) {
+          // jumptable
+          for (j = po->btj->count - 1; j >= 0; j--) {
+            check_i(po, po->btj->d[j].bt_i);
+            wstack_push(po->btj->d[j].bt_i);
+          }
+          break;
         }
-        return ret;
-      }
 
-      if (po->flags & OPF_RMD)
+        if (po->flags & OPF_RMD)
+          continue;
+        check_i(po, po->bt_i);
+        if (po->flags & OPF_CJMP)
+          wstack_push(po->bt_i);
+        else
+          i = po->bt_i - 1;
         continue;
-      check_i(po, po->bt_i);
-      if (po->flags & OPF_CJMP) {
-        ret |= find_next_read(po->bt_i, opcnt, opr, magic, op_i);
-        if (ret < 0)
-          return ret;
       }
-      else
-        i = po->bt_i - 1;
-      continue;
-    }
 
-    if (!is_opr_read(opr, po)) {
-      int full_opr = 1;
-      if (opr->type == OPT_REG && po->operand[0].type == OPT_REG
-          && opr->reg == po->operand[0].reg && (po->flags & OPF_DATA))
-      {
-        full_opr = po->operand[0].lmod >= opr->lmod;
+      if (!is_opr_read(opr, po)) {
+        int full_opr = 1;
+        if (opr->type == OPT_REG && po->operand[0].type == OPT_REG
+            && opr->reg == po->operand[0].reg && (po->flags & OPF_DATA))
+        {
+          full_opr = po->operand[0].lmod >= opr->lmod;
+        }
+        if (is_opr_modified(opr, po) && full_opr) {
+          // it's overwritten
+          break;
+        }
+        if (po->flags & OPF_TAIL)
+          break;
+        continue;
       }
-      if (is_opr_modified(opr, po) && full_opr) {
-        // it's overwritten
-        return ret;
+
+      if (*op_i >= 0) {
+        g_wstack_cnt = base;
+        return -1;
       }
-      if (po->flags & OPF_TAIL)
-        return ret;
-      continue;
-    }
 
-    if (*op_i >= 0)
-      return -1;
+      *op_i = i;
+      ret = 1;
+      break;
+    }
+  }
 
-    *op_i = i;
-    return 1;
-  }
-
-  return 0;
+  return ret;
 }
 
 static int find_next_read_reg(int i, int opcnt, int reg,
-  enum opr_lenmod lmod, int magic, int *op_i)
+  enum opr_lenmod lmod, int *op_i)
 {
   struct parsed_opr opr = OPR_INIT(OPT_REG, lmod, reg);
 
   *op_i = -1;
-  return find_next_read(i, opcnt, &opr, magic, op_i);
+  return find_next_read(i, opcnt, &opr, op_i);
 }
 
 // find next instruction that reads opr
 // *op_i must be set to -1 by the caller
 // on return, *op_i is set to first flag user insn
 // returns 1 if exactly 1 flag user is found
-static int find_next_flag_use(int i, int opcnt, int magic, int *op_i)
+static int find_next_flag_use(int i, int opcnt, int *op_i)
 {
   struct parsed_op *po;
+  int stamp = visit_stamp();
+  int base = g_wstack_cnt;
   int j, ret = 0;
 
-  for (; i < opcnt; i++)
+  wstack_push(i);
+  while (g_wstack_cnt > base)
   {
-    if (ops[i].cc_scratch == magic)
-      return ret;
-    ops[i].cc_scratch = magic;
+    i = g_wstack[--g_wstack_cnt];
+    for (; i < opcnt; i++)
+    {
+      if (g_op_seen[i] == stamp)
+        break;
+      g_op_seen[i] = stamp;
 
-    po = &ops[i];
-    if (po->op == OP_CALL)
-      return -1;
-    if (po->flags & OPF_JMP) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++) {
-          check_i(po, po->btj->d[j].bt_i);
-          ret |= find_next_flag_use(po->btj->d[j].bt_i, opcnt,
-                   magic, op_i);
+      po = &ops[i];
+      if (po->op == OP_CALL)
+        goto fail;
+      if (po->flags & OPF_JMP) {
+        if (po->btj != NULL) {
+          // jumptable
+          for (j = po->btj->count - 1; j >= 0; j--) {
+            check_i(po, po->btj->d[j].bt_i);
+            wstack_push(po->btj->d[j].bt_i);
+          }
+          break;
         }
-        return ret;
-      }
 
-      if (po->flags & OPF_RMD)
+        if (po->flags & OPF_RMD)
+          continue;
+        check_i(po, po->bt_i);
+        if (po->flags & OPF_CJMP)
+          goto found;
+        else
+          i = po->bt_i - 1;
         continue;
-      check_i(po, po->bt_i);
-      if (po->flags & OPF_CJMP)
-        goto found;
-      else
-        i = po->bt_i - 1;
-      continue;
-    }
+      }
 
-    if (!(po->flags & OPF_CC)) {
-      if (po->flags & OPF_FLAGS)
-        // flags changed
-        return ret;
-      if (po->flags & OPF_TAIL)
-        return ret;
-      continue;
-    }
+      if (!(po->flags & OPF_CC)) {
+        if (po->flags & OPF_FLAGS)
+          // flags changed
+          break;
+        if (po->flags & OPF_TAIL)
+          break;
+        continue;
+      }
 
 found:
-    if (*op_i >= 0)
-      return -1;
+      if (*op_i >= 0)
+        goto fail;
 
-    *op_i = i;
-    return 1;
+      *op_i = i;
+      ret = 1;
+      break;
+    }
   }
 
-  return 0;
+  return ret;
+
+fail:
+  g_wstack_cnt = base;
+  return -1;
 }
 
 static int try_resolve_const(int i, const struct parsed_opr *opr,
-  int magic, unsigned int *val)
+  unsigned int *val)
 {
   int s_i = -1;
   int ret;
 
-  ret = resolve_origin(i, opr, magic, &s_i, NULL);
+  ret = resolve_origin(i, opr, &s_i, NULL);
   if (ret == 1) {
     i = s_i;
     if (ops[i].op != OP_MOV && ops[i].operand[1].type != OPT_CONST)
@@ -4958,11 +6331,11 @@ static int resolve_used_bits(int i, int opcnt, int reg,
   int j = -1, k = -1;
   int ret;
 
-  ret = find_next_read(i, opcnt, &opr, i + opcnt * 20, &j);
+  ret = find_next_read(i, opcnt, &opr, &j);
   if (ret != 1)
     return -1;
 
-  find_next_read(j + 1, opcnt, &opr, i + opcnt * 20 + 1, &k);
+  find_next_read(j + 1, opcnt, &opr, &k);
   if (k != -1) {
     fnote(&ops[j], "(first read)\n");
     ferr(&ops[k], "TODO: bit resolve: multiple readers\n");
@@ -4983,14 +6356,14 @@ static int resolve_used_bits(int i, int opcnt, int reg,
   ferr_assert(&ops[j], (*mask & ~0xffff) == 0);
 
   *is_z_check = 0;
-  ret = find_next_flag_use(j + 1, opcnt, i + opcnt * 20 + 2, &k);
+  ret = find_next_flag_use(j + 1, opcnt, &k);
   if (ret == 1)
     *is_z_check = ops[k].pfo == PFO_Z;
 
   return 0;
 }
 
-static const struct parsed_proto *resolve_deref(int i, int magic,
+static const struct parsed_proto *resolve_deref(int i,
   const struct parsed_opr *opr, int level)
 {
   const struct parsed_proto *pp = NULL;
@@ -5014,7 +6387,7 @@ static const struct parsed_proto *resolve_deref(int i, int magic,
   if (reg < 0)
     return NULL;
 
-  ret = resolve_origin_reg(i, reg, i + magic, &j, NULL);
+  ret = resolve_origin_reg(i, reg, &j, NULL);
   if (ret != 1)
     return NULL;
 
@@ -5029,7 +6402,7 @@ static const struct parsed_proto *resolve_deref(int i, int magic,
             ops[j].operand[1].name);
     if (reg < 0)
       return NULL;
-    ret = resolve_origin_reg(j, reg, j + magic, &k, NULL);
+    ret = resolve_origin_reg(j, reg, &k, NULL);
     if (ret != 1)
       return NULL;
     j = k;
@@ -5045,7 +6418,7 @@ static const struct parsed_proto *resolve_deref(int i, int magic,
     pp = try_recover_pp(&ops[j], &ops[j].operand[1], 0, NULL);
     if (pp == NULL) {
       // maybe structure ptr in structure
-      pp = resolve_deref(j, magic, &ops[j].operand[1], level + 1);
+      pp = resolve_deref(j, &ops[j].operand[1], level + 1);
     }
   }
   else if (ops[j].operand[1].type == OPT_LABEL)
@@ -5053,8 +6426,7 @@ static const struct parsed_proto *resolve_deref(int i, int magic,
   else if (ops[j].operand[1].type == OPT_REG) {
     // maybe arg reg?
     k = -1;
-    ret = resolve_origin(j, &ops[j].operand[1], i + magic,
-            &k, &from_caller);
+    ret = resolve_origin(j, &ops[j].operand[1], &k, &from_caller);
     if (ret != 1 && from_caller && k == -1 && g_func_pp != NULL) {
       for (k = 0; k < g_func_pp->argc; k++) {
         if (g_func_pp->arg[k].reg == NULL)
@@ -5094,7 +6466,7 @@ static const struct parsed_proto *resolve_func_ptr(int i, int opcnt,
   switch (opr->type) {
   case OPT_REGMEM:
     // try to resolve struct member calls
-    pp = resolve_deref(i, i + opcnt * 19, opr, 0);
+    pp = resolve_deref(i, opr, 0);
     if (pp != NULL)
       break;
     // fallthrough
@@ -5187,13 +6559,11 @@ static struct parsed_proto *process_call(int i, int opcnt)
           && ops[call_i].operand[1].type == OPT_LABEL)
         {
           // no other source users?
-          ret = resolve_last_ref(i, &po->operand[0], i + opcnt * 10,
-                  &ref_i);
+          ret = resolve_last_ref(i, &po->operand[0], &ref_i);
           if (ret == 1 && call_i == ref_i) {
             // and nothing uses it after us?
             ref_i = -1;
-            find_next_read(i + 1, opcnt, &po->operand[0],
-              i + opcnt * 11, &ref_i);
+            find_next_read(i + 1, opcnt, &po->operand[0], &ref_i);
             if (ref_i == -1)
               // then also don't need the source mov
               ops[call_i].flags |= OPF_RMD | OPF_NOREGS;
@@ -5208,8 +6578,7 @@ static struct parsed_proto *process_call(int i, int opcnt)
       }
     }
     if (pp == NULL) {
-      pp = calloc(1, sizeof(*pp));
-      my_assert_not(pp, NULL);
+      pp = fa_proto_new();
 
       pp->is_fptr = 1;
       ret = scan_for_esp_adjust(i + 1, opcnt,
@@ -5221,12 +6590,12 @@ static struct parsed_proto *process_call(int i, int opcnt)
         adj = 0;
       }
       adj /= 4;
-      if (adj > ARRAY_SIZE(pp->arg))
+      if (adj > PP_MAX_ARGS)
         ferr(po, "esp adjust too large: %d\n", adj);
-      pp->ret_type.name = strdup("int");
+      pp->ret_type.name = fa_strdup("int");
       pp->argc = pp->argc_stack = adj;
       for (arg = 0; arg < pp->argc; arg++)
-        pp->arg[arg].type.name = strdup("int");
+        pp->arg[arg].type.name = fa_strdup("int");
     }
     po->pp = pp;
   }
@@ -5250,10 +6619,10 @@ static struct parsed_proto *process_call(int i, int opcnt)
       arg = pp->argc;
       pp->argc += adj / 4 - pp->argc_stack;
       for (; arg < pp->argc; arg++) {
-        pp->arg[arg].type.name = strdup("int");
+        pp->arg[arg].type.name = fa_strdup("int");
         pp->argc_stack++;
       }
-      if (pp->argc > ARRAY_SIZE(pp->arg))
+      if (pp->argc > PP_MAX_ARGS)
         ferr(po, "too many args for '%s'\n", tmpname);
     }
     if (pp->argc_stack > adj / 4) {
@@ -5342,8 +6711,8 @@ static void pp_insert_reg_arg(struct parsed_proto *pp, const char *reg)
     memmove(&pp->arg[i + 1], &pp->arg[i],
       sizeof(pp->arg[0]) * pp->argc_stack);
   memset(&pp->arg[i], 0, sizeof(pp->arg[i]));
-  pp->arg[i].reg = strdup(reg);
-  pp->arg[i].type.name = strdup("int");
+  pp->arg[i].reg = fa_strdup(reg);
+  pp->arg[i].type.name = fa_strdup("int");
   pp->argc++;
   pp->argc_reg++;
 }
@@ -5357,17 +6726,20 @@ static void pp_insert_stack_args(struct parsed_proto *pp, int count)
 
   for (a = 0; a < pp->argc; a++)
     if (pp->arg[a].type.name == NULL)
-      pp->arg[a].type.name = strdup("int");
+      pp->arg[a].type.name = fa_strdup("int");
 }
 
 static void pp_add_push_ref(struct parsed_proto *pp,
   int arg, struct parsed_op *po)
 {
-  pp->arg[arg].push_refs = realloc(pp->arg[arg].push_refs,
-                             (pp->arg[arg].push_ref_cnt + 1)
-                              * sizeof(pp->arg[arg].push_refs[0]));
-  ferr_assert(po, pp->arg[arg].push_refs != NULL);
-  pp->arg[arg].push_refs[pp->arg[arg].push_ref_cnt++] = po;
+  struct parsed_proto_arg *a = &pp->arg[arg];
+
+  // room for powers of 2
+  if ((a->push_ref_cnt & (a->push_ref_cnt - 1)) == 0)
+    a->push_refs = fa_grow(a->push_refs,
+                     a->push_ref_cnt * sizeof(a->push_refs[0]),
+                     (a->push_ref_cnt * 2 + 1) * sizeof(a->push_refs[0]));
+  a->push_refs[a->push_ref_cnt++] = po;
 }
 
 static void mark_float_arg(struct parsed_op *po,
@@ -5763,8 +7135,7 @@ static int collect_call_args_r(struct parsed_op *po, int i,
         && pp->arg[arg].type.is_va_list)
       {
         k = -1;
-        ret = resolve_origin(j, &ops[j].operand[0],
-                magic + 1, &k, NULL);
+        ret = resolve_origin(j, &ops[j].operand[0], &k, NULL);
         if (ret == 1 && k >= 0)
         {
           if (ops[k].op == OP_LEA) {
@@ -5863,12 +7234,16 @@ static int collect_call_args(struct parsed_op *po, int i, int opcnt,
   return ret;
 }
 
+// paths are walked depth first, branch targets before fallthrough;
+// the stack holds the paths left to walk as (i, regmask_now,
+// regmask_save_now)
 static void reg_use_pass(int i, int opcnt, unsigned char *cbits,
   int regmask_now, int *regmask,
   int regmask_save_now, int *regmask_save,
   int *regmask_init, int regmask_arg)
 {
   struct parsed_op *po;
+  int base = g_wstack_cnt;
   int already_saved;
   int regmask_new;
   int regmask_op;
@@ -5876,33 +7251,35 @@ static void reg_use_pass(int i, int opcnt, unsigned char *cbits,
   int ret, reg;
   int j;
 
+next:
+  prof_depth_note(PROFD_REG_USE_PASS, (g_wstack_cnt - base) / 3);
   for (; i < opcnt; i++)
   {
     po = &ops[i];
     if (cbits[i >> 3] & (1 << (i & 7)))
-      return;
+      break;
     cbits[i >> 3] |= (1 << (i & 7));
 
     if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
       if (po->flags & (OPF_RMD|OPF_DONE))
         continue;
       if (po->btj != NULL) {
-        for (j = 0; j < po->btj->count; j++) {
+        for (j = po->btj->count - 1; j >= 0; j--) {
           check_i(po, po->btj->d[j].bt_i);
-          reg_use_pass(po->btj->d[j].bt_i, opcnt, cbits,
-            regmask_now, regmask, regmask_save_now, regmask_save,
-            regmask_init, regmask_arg);
+          wstack_push(po->btj->d[j].bt_i);
+          wstack_push(regmask_now);
+          wstack_push(regmask_save_now);
         }
-        return;
+        break;
       }
 
       check_i(po, po->bt_i);
-      if (po->flags & OPF_CJMP)
-        reg_use_pass(po->bt_i, opcnt, cbits,
-          regmask_now, regmask, regmask_save_now, regmask_save,
-          regmask_init, regmask_arg);
-      else
-        i = po->bt_i - 1;
+      if (po->flags & OPF_CJMP) {
+        wstack_push(i + 1);
+        wstack_push(regmask_now);
+        wstack_push(regmask_save_now);
+      }
+      i = po->bt_i - 1;
       continue;
     }
 
@@ -5923,12 +7300,9 @@ static void reg_use_pass(int i, int opcnt, unsigned char *cbits,
         save_level++;
       }
 
-      ret = scan_for_pop(i + 1, opcnt, i + opcnt * 3,
-              reg, 0, 0, save_level, 0);
-      if (ret == 1) {
-        scan_for_pop(i + 1, opcnt, i + opcnt * 4,
-          reg, 0, 0, save_level, flags_set);
-      }
+      ret = scan_for_pop(i + 1, opcnt, reg, save_level, 0);
+      if (ret == 1)
+        scan_for_pop(i + 1, opcnt, reg, save_level, flags_set);
       else {
         ret = scan_for_pop_ret(i + 1, opcnt, po->operand[0].reg, 0);
         if (ret == 1) {
@@ -5965,8 +7339,7 @@ static void reg_use_pass(int i, int opcnt, unsigned char *cbits,
           // don't need eax, will do "return f();" or "f(); return;"
           po->regmask_dst &= ~(1 << xAX);
         else {
-          find_next_read_reg(i + 1, opcnt, xAX, OPLM_DWORD,
-            i + opcnt * 17, &j);
+          find_next_read_reg(i + 1, opcnt, xAX, OPLM_DWORD, &j);
           if (j == -1)
             // not used
             po->regmask_dst &= ~(1 << xAX);
@@ -6007,7 +7380,7 @@ static void reg_use_pass(int i, int opcnt, unsigned char *cbits,
       if (g_bp_frame && !(po->flags & OPF_EBP_S)) {
         if (po->regmask_dst & (1 << xBP))
           // compiler decided to drop bp frame and use ebp as scratch
-          scan_fwd_set_flags(i + 1, opcnt, i + opcnt * 5, OPF_EBP_S);
+          scan_fwd_set_flags(i + 1, opcnt, OPF_EBP_S);
         else
           regmask_op &= ~(1 << xBP);
       }
@@ -6060,9 +7433,16 @@ static void reg_use_pass(int i, int opcnt, unsigned char *cbits,
 
       // there is support for "conditional tailcall", sort of
       if (!(po->flags & OPF_CC))
-        return;
+        break;
     }
   }
+
+  if (g_wstack_cnt > base) {
+    regmask_save_now = g_wstack[--g_wstack_cnt];
+    regmask_now = g_wstack[--g_wstack_cnt];
+    i = g_wstack[--g_wstack_cnt];
+    goto next;
+  }
 }
 
 static void output_std_flag_z(FILE *fout, struct parsed_op *po,
@@ -6092,6 +7472,195 @@ static void output_std_flags(FILE *fout, struct parsed_op *po,
   output_std_flag_s(fout, po, pfomask, dst_opr_text);
 }
 
+// ops done with __atomic builtins: anything locked, xadd/cmpxchg*
+// and xchg with memory, which the cpu always locks
+static int is_atomic_op(struct parsed_op *po)
+{
+  int i;
+
+  if (po->flags & OPF_LOCK)
+    return 1;
+
+  switch (po->op) {
+  case OP_XADD:
+  case OP_CMPXCHG:
+    // unlocked reg or local var dst is plain, like xchg below
+    return po->operand[0].type != OPT_REG
+      && !is_stack_access(po, &po->operand[0]);
+  case OP_CMPXCHG8B:
+    return 1;
+  case OP_XCHG:
+    for (i = 0; i < 2; i++)
+      if (po->operand[i].type != OPT_REG
+          && !is_stack_access(po, &po->operand[i]))
+        return 1;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+// flags come from the value the builtin returned, never
+// from re-reading memory that another thread may have changed
+static void out_atomic_op(FILE *fout, struct parsed_op *po,
+  int *pfomask)
+{
+  const char *seq = "__ATOMIC_SEQ_CST";
+  struct parsed_opr *m = &po->operand[0];
+  struct parsed_opr *r = &po->operand[1];
+  char addr[256], src[256], dst[256], newv[256];
+  const char *name = NULL;
+  const char *type, *cast;
+
+  if (po->op == OP_XCHG && m->type == OPT_REG) {
+    m = &po->operand[1];
+    r = &po->operand[0];
+  }
+  if (m->type == OPT_REG || m->type == OPT_CONST)
+    ferr(po, "atomic op on a reg\n");
+  if (po->op != OP_INC && po->op != OP_DEC && po->op != OP_CMPXCHG8B)
+    propagate_lmod(po, m, r);
+
+  out_src_opr(addr, sizeof(addr), po, m, "", 1);
+  type = lmod_type_u(po, m->lmod);
+  cast = lmod_cast_u(po, m->lmod);
+
+  switch (po->op) {
+  case OP_INC: name = "add"; break;
+  case OP_DEC: name = "sub"; break;
+  case OP_ADD: name = "add"; break;
+  case OP_SUB: name = "sub"; break;
+  case OP_AND: name = "and"; break;
+  case OP_OR:  name = "or";  break;
+  case OP_XOR: name = "xor"; break;
+
+  case OP_XCHG:
+    fprintf(fout, "  %s = __atomic_exchange_n((%s *)(%s), %s, %s);",
+      out_dst_opr(dst, sizeof(dst), po, r), type, addr,
+      out_src_opr_u32(src, sizeof(src), po, r), seq);
+    return;
+
+  case OP_XADD:
+    // tmp is the old value, reg gets it after the flags are done
+    out_src_opr_u32(src, sizeof(src), po, r);
+    fprintf(fout, "  tmp = __atomic_fetch_add((%s *)(%s), %s, %s);",
+      type, addr, src, seq);
+    snprintf(newv, sizeof(newv), "(tmp + %s)", src);
+    if (*pfomask & PFOB_C) {
+      fprintf(fout, "\n  cond_c = (%s%s < %stmp);", cast, newv, cast);
+      *pfomask &= ~PFOB_C;
+    }
+    output_std_flags(fout, po, pfomask, newv);
+    if (*pfomask & (1 << PFO_P)) {
+      fprintf(fout, "\n  cond_p = do_parity(%s);", newv);
+      *pfomask &= ~(1 << PFO_P);
+    }
+    fprintf(fout, "\n  %s = tmp;", out_dst_opr(dst, sizeof(dst), po, r));
+    return;
+
+  case OP_CMPXCHG:
+    fprintf(fout, "  { %s t = %s;\n", type,
+      out_src_opr_u32(dst, sizeof(dst), po, &po->operand[2]));
+    fprintf(fout, "    %s__atomic_compare_exchange_n((%s *)(%s), &t, %s, "
+      "0, %s, %s);\n", (*pfomask & PFOB_Z) ? "cond_z = " : "", type, addr,
+      out_src_opr_u32(src, sizeof(src), po, r), seq, seq);
+    fprintf(fout, "    %s = t; }",
+      out_dst_opr(dst, sizeof(dst), po, &po->operand[2]));
+    *pfomask &= ~PFOB_Z;
+    return;
+
+  case OP_CMPXCHG8B:
+    fprintf(fout, "  tmp64 = ((u64)edx << 32) | eax;\n");
+    fprintf(fout, "  %s__atomic_compare_exchange_n((u64 *)(%s), &tmp64, "
+      "((u64)ecx << 32) | ebx, 0, %s, %s);\n",
+      (*pfomask & PFOB_Z) ? "cond_z = " : "", addr, seq, seq);
+    fprintf(fout, "  edx = tmp64 >> 32; eax = tmp64;");
+    *pfomask &= ~PFOB_Z;
+    return;
+
+  default:
+    ferr(po, "unhandled lock\n");
+  }
+
+  // locked arith
+  if (po->op == OP_INC || po->op == OP_DEC)
+    strcpy(src, "1");
+  else
+    out_src_opr_u32(src, sizeof(src), po, r);
+  if (*pfomask == 0) {
+    fprintf(fout, "  __atomic_fetch_%s((%s *)(%s), %s, %s);",
+      name, type, addr, src, seq);
+    return;
+  }
+
+  fprintf(fout, "  tmp = __atomic_%s_fetch((%s *)(%s), %s, %s);",
+    name, type, addr, src, seq);
+  if (*pfomask & PFOB_C) {
+    if (po->op == OP_ADD)
+      fprintf(fout, "\n  cond_c = (%stmp < %s%s);", cast, cast, src);
+    else if (po->op == OP_SUB)
+      fprintf(fout, "\n  cond_c = (%s(tmp + %s) < %s%s);",
+        cast, src, cast, src);
+    else if (po->op == OP_INC || po->op == OP_DEC)
+      ferr(po, "carry propagation needed\n");
+    else
+      fprintf(fout, "\n  cond_c = 0;");
+    *pfomask &= ~PFOB_C;
+  }
+  output_std_flags(fout, po, pfomask, "tmp");
+  if (*pfomask & (1 << PFO_P)) {
+    fprintf(fout, "\n  cond_p = do_parity(tmp);");
+    *pfomask &= ~(1 << PFO_P);
+  }
+}
+
+// unlocked xadd/cmpxchg on a reg or local var
+static void out_xadd_cmpxchg(FILE *fout, struct parsed_op *po,
+  int *pfomask)
+{
+  struct parsed_opr *d = &po->operand[0];
+  struct parsed_opr *r = &po->operand[1];
+  char dst[256], src[256], acc[256];
+  const char *cast;
+
+  propagate_lmod(po, d, r);
+  out_src_opr_u32(dst, sizeof(dst), po, d);
+  out_src_opr_u32(src, sizeof(src), po, r);
+  cast = lmod_cast_u(po, d->lmod);
+
+  if (po->op == OP_XADD) {
+    // sum first, src may be the same reg as dst
+    fprintf(fout, "  tmp = %s + %s;", dst, src);
+    if (*pfomask & PFOB_C) {
+      fprintf(fout, "\n  cond_c = (%stmp < %s);", cast, dst);
+      *pfomask &= ~PFOB_C;
+    }
+    output_std_flags(fout, po, pfomask, "tmp");
+    if (*pfomask & (1 << PFO_P)) {
+      fprintf(fout, "\n  cond_p = do_parity(tmp);");
+      *pfomask &= ~(1 << PFO_P);
+    }
+    if (!IS(d->name, r->name))
+      fprintf(fout, "\n  %s = %s;", out_dst_opr(acc, sizeof(acc), po, r),
+        dst);
+    fprintf(fout, "\n  %s = tmp;", out_dst_opr(acc, sizeof(acc), po, d));
+    return;
+  }
+
+  out_src_opr_u32(acc, sizeof(acc), po, &po->operand[2]);
+  if (*pfomask & PFOB_Z) {
+    fprintf(fout, "  cond_z = (%s%s == %s%s);\n", cast, acc, cast, dst);
+    fprintf(fout, "  if (cond_z)");
+    *pfomask &= ~PFOB_Z;
+  }
+  else
+    fprintf(fout, "  if (%s%s == %s%s)", cast, acc, cast, dst);
+  fprintf(fout, "\n    %s = %s;", out_dst_opr(acc, sizeof(acc), po, d),
+    src);
+  fprintf(fout, "\n  else\n    %s = %s;",
+    out_dst_opr(acc, sizeof(acc), po, &po->operand[2]), dst);
+}
+
 enum {
   OPP_FORCE_NORETURN = (1 << 0),
   OPP_SIMPLE_ARGS    = (1 << 1),
@@ -6172,6 +7741,308 @@ static char *saved_arg_name(char *buf, size_t buf_size, int grp, int num)
   return buf;
 }
 
+// taint sf bytes [start, end) as aliased
+static void sf_scalar_taint(int *own, int start, int end)
+{
+  if (end > g_stack_fsz)
+    end = g_stack_fsz;
+  for (; start < end; start++)
+    own[start] = -1;
+}
+
+// end of the IDA stack var starting at or before sf_ofs,
+// assumed to be the start of the next declared var
+static int sf_var_end(int sf_ofs)
+{
+  int end = g_stack_fsz;
+  int i, o;
+
+  for (i = 0; i < g_eqcnt; i++) {
+    o = g_stack_fsz + g_eqs[i].offset;
+    if (sf_ofs < o && o < end)
+      end = o;
+  }
+  return end;
+}
+
+// find stack frame slots that are always accessed whole with the
+// same size and never have their address taken, those are emitted
+// as separate locals so that the compiler can keep them in regs,
+// anything that may alias stays in the sf union
+static void sf_scalar_scan(int opcnt)
+{
+  const struct parsed_proto *pp;
+  struct parsed_op *po;
+  struct parsed_opr *popr;
+  enum opr_lenmod lmod;
+  char ofs_reg[16];
+  int i, j, k, key, size, end;
+  int offset, stack_ra;
+  int sf_ofs, alias;
+  int *own;
+
+  g_sf_scalar = NULL;
+  g_sf_all_scalar = 0;
+  if (g_stack_fsz <= 0 || (g_sct_func_attr & SCTFA_CLEAR_SF))
+    return;
+
+  // per byte: (slot offset << 4 | SF_MMXQ? | lmod) + 1, -1 if aliased
+  own = fa_calloc((g_stack_fsz + 1) * sizeof(own[0]));
+
+  for (i = 0; i < opcnt; i++)
+  {
+    po = &ops[i];
+
+    // frame pointer escapes (bp_ref, esp/ebp copies)
+    if (po->op == OP_CALL && (pp = po->pp) != NULL) {
+      for (j = 0; j < pp->argc; j++)
+        if (pp->arg[j].reg != NULL && IS(pp->arg[j].reg, "ebp")
+            && g_bp_frame && !(po->flags & OPF_EBP_S))
+          return;
+    }
+
+    for (j = 0; j < po->operand_cnt; j++)
+    {
+      popr = &po->operand[j];
+      if (popr->type == OPT_REG && !(po->flags & OPF_RMD)
+          && (popr->reg == xSP
+              || (popr->reg == xBP && g_bp_frame
+                  && !(po->flags & OPF_EBP_S))))
+        return;
+      if (popr->type != OPT_REGMEM || !is_stack_access(po, popr))
+        continue;
+
+      parse_stack_access(po, popr->name, ofs_reg, &offset,
+        &stack_ra, NULL, 1);
+      if (offset > stack_ra)
+        continue; // arg
+      sf_ofs = g_stack_fsz + offset;
+      if (ofs_reg[0] != 0)
+        return;
+      if (sf_ofs < 0) {
+        // outgoing args below the frame
+        sf_scalar_taint(own, 0, sf_ofs + 8);
+        continue;
+      }
+      if (sf_ofs >= g_stack_fsz)
+        continue;
+
+      lmod = popr->lmod;
+      if (po->op == OP_LEA) {
+        // the pointer is not bound to the IDA var, may be indexed
+        // or offset to reach anything higher up in the frame
+        sf_scalar_taint(own, sf_ofs, g_stack_fsz);
+        continue;
+      }
+      if (lmod == OPLM_UNSPEC) {
+        // may cover the whole var, the lmod is only known
+        // at output (propagate_lmod)
+        end = sf_var_end(sf_ofs);
+        if (end < sf_ofs + 8)
+          end = sf_ofs + 8;
+        sf_scalar_taint(own, sf_ofs, end);
+        continue;
+      }
+
+      size = lmod_bytes(po, lmod);
+      alias = (sf_ofs & (size - 1)) != 0;
+      // x87 accesses that reinterpret the slot
+      if (OP_FLD <= po->op && po->op <= OP_FYL2X)
+        alias |= (po->flags & OPF_FINT) ? lmod == OPLM_QWORD
+                                        : lmod == OPLM_DWORD;
+      if (alias) {
+        sf_scalar_taint(own, sf_ofs, sf_ofs + size);
+        continue;
+      }
+
+      key = sf_ofs << 4 | lmod;
+      if (lmod == OPLM_QWORD && is_mmx_mem_op(po))
+        key |= SF_MMXQ;
+      key++;
+      end = sf_ofs + size;
+      if (end > g_stack_fsz)
+        end = g_stack_fsz;
+      for (k = sf_ofs; k < end; k++) {
+        if (own[k] == 0)
+          own[k] = key;
+        else if (own[k] != key)
+          own[k] = -1;
+      }
+    }
+  }
+
+  // keep slots that are wholly owned by a single key,
+  // own[] below k is already rewritten to the result
+  alias = 0;
+  for (k = 0; k < g_stack_fsz; k++) {
+    key = own[k];
+    if (key <= 0 || ((key - 1) >> 4) != k) {
+      alias |= key < 0;
+      own[k] = 0;
+      continue;
+    }
+    lmod = (key - 1) & 7;
+    size = lmod_bytes(NULL, lmod);
+    for (j = 1; j < size && k + j < g_stack_fsz; j++)
+      if (own[k + j] != key)
+        break;
+    if (j < size) {
+      alias = 1;
+      own[k] = 0;
+      continue;
+    }
+    own[k] = ((key - 1) & SF_MMXQ) | (lmod + 1);
+    for (j = 1; j < size; j++)
+      own[k + j] = -1;
+    k += size - 1;
+  }
+
+  g_sf_scalar = own;
+  g_sf_all_scalar = !alias;
+}
+
+static int float_depth_merge(int *depth, int i, int d)
+{
+  if (depth[i] == -1) {
+    depth[i] = d;
+    return 1;
+  }
+  return depth[i] == d ? 0 : -1;
+}
+
+// "full stack" mode: find x87 stack depth before each op, when
+// it's the same on every path into each op the stack is emitted
+// as fixed locals, else the f_st[f_stp & 7] ring is kept
+static void float_depth_scan(int opcnt)
+{
+  struct parsed_op *po;
+  int base = g_wstack_cnt;
+  int i, j, d, n, ret;
+  int slots = 0;
+  int *depth;
+
+  g_f_depth = NULL;
+  g_f_slots = 0;
+
+  depth = fa_calloc(opcnt * sizeof(depth[0]));
+  for (i = 0; i < opcnt; i++)
+    depth[i] = -1;
+
+  depth[0] = 0;
+  wstack_push(0);
+  while (g_wstack_cnt > base)
+  {
+    i = g_wstack[--g_wstack_cnt];
+    for (;;)
+    {
+      po = &ops[i];
+      d = depth[i];
+      if (!(po->flags & OPF_RMD)) {
+        if (po->flags & OPF_FPUSH)
+          d++;
+        if (po->flags & OPF_FPOPP)
+          d -= 2;
+        else if (po->flags & OPF_FPOP)
+          d--;
+      }
+
+      if (po->flags & OPF_TAIL) {
+        if (!(po->flags & OPF_CJMP))
+          break;
+      }
+      else if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
+        if (po->btj != NULL) {
+          // jumptable
+          for (j = po->btj->count - 1; j >= 0; j--) {
+            n = po->btj->d[j].bt_i;
+            check_i(po, n);
+            ret = float_depth_merge(depth, n, d);
+            if (ret < 0)
+              goto fail;
+            if (ret)
+              wstack_push(n);
+          }
+          break;
+        }
+
+        if (!(po->flags & OPF_RMD)) {
+          if (po->bt_i < 0)
+            goto fail;
+          ret = float_depth_merge(depth, po->bt_i, d);
+          if (ret < 0)
+            goto fail;
+          if (!(po->flags & OPF_CJMP)) {
+            if (ret == 0)
+              break;
+            i = po->bt_i;
+            continue;
+          }
+          if (ret)
+            wstack_push(po->bt_i);
+        }
+      }
+
+      if (i + 1 >= opcnt)
+        break;
+      ret = float_depth_merge(depth, i + 1, d);
+      if (ret < 0)
+        goto fail;
+      if (ret == 0)
+        break;
+      i++;
+    }
+  }
+
+  // every op touching the stack must have been reached
+  for (i = 0; i < opcnt; i++) {
+    po = &ops[i];
+    if (po->flags & OPF_RMD)
+      continue;
+    n = ((po->regmask_src | po->regmask_dst) & mxSTa) >> xST0;
+    if (n == 0 && !(po->flags & (OPF_FPUSH|OPF_FPOP|OPF_FPOPP)))
+      continue;
+    d = depth[i];
+    if (d == -1)
+      return;
+
+    // st0 is implied by most ops, for pushes it's the new slot
+    n = (po->regmask_src & mxSTa) >> xST0;
+    if (!(po->flags & OPF_FPUSH))
+      n |= 1 | ((po->regmask_dst & mxSTa) >> xST0);
+    for (j = 0; j < po->operand_cnt; j++)
+      if (po->operand[j].type == OPT_REG
+          && xST0 <= po->operand[j].reg && po->operand[j].reg <= xST7)
+        n |= 1 << (po->operand[j].reg - xST0);
+    for (j = 0; j < 8; j++)
+      if (n & (1 << j))
+        slots |= 1 << ((d - 1 - j) & 7);
+    if (po->flags & OPF_FPUSH)
+      slots |= 1 << (d & 7);
+  }
+
+  g_f_depth = depth;
+  g_f_slots = slots;
+  return;
+
+fail:
+  g_wstack_cnt = base;
+}
+
+// final reg values after a rep op done by a mem* call,
+// only those that are read later
+static void out_memf_regs(FILE *fout, const struct parsed_op *po,
+  int size)
+{
+  int live = (long)po->datap;
+
+  if (live & (1 << xDI))
+    fprintf(fout, " edi += ecx * %d;", size);
+  if (live & (1 << xSI))
+    fprintf(fout, " esi += ecx * %d;", size);
+  if (live & (1 << xCX))
+    fprintf(fout, " ecx = 0;");
+}
+
 static void gen_x_cleanup(int opcnt);
 
 static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
@@ -6182,10 +8053,12 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
   struct parsed_proto *pp, *pp_tmp;
   struct parsed_data *pd;
   int save_arg_vars[MAX_ARG_GRP] = { 0, };
-  unsigned char cbits[MAX_OPS / 8];
+  unsigned char *cbits = g_cbits;
   const char *float_type;
   const char *float_st0;
   const char *float_st1;
+  char f_st0_buf[32];
+  char f_st1_buf[32];
   int need_float_stack = 0;
   int need_float_sw = 0; // status word
   int need_tmp_var = 0;
@@ -6232,6 +8105,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
   // - parse calls with labels
   resolve_branches_parse_calls(opcnt);
 
+  prof_pass(PROF_PASS2);
   // pass2:
   // - handle ebp/esp frame, remove ops related to it
   scan_prologue_epilogue(opcnt, &stack_align);
@@ -6250,20 +8124,20 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
   }
 
+  prof_pass(PROF_PASS3);
   // pass3:
   // - remove dead labels
   // - set regs needed at ret
   for (i = 0; i < opcnt; i++)
   {
-    if (g_labels[i] != NULL && g_label_refs[i].i == -1) {
-      free(g_labels[i]);
-      g_labels[i] = NULL;
-    }
+    if (g_labels[i] != NULL && g_label_refs[i].i == -1)
+      free_label(i);
 
     if (ops[i].op == OP_RET)
       ops[i].regmask_src |= regmask_ret;
   }
 
+  prof_pass(PROF_PASS4);
   // pass4:
   // - process trivial calls
   for (i = 0; i < opcnt; i++)
@@ -6304,6 +8178,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
   }
 
+  prof_pass(PROF_PASS5);
   // pass5:
   // - process calls, stage 2
   // - handle some push/pop pairs
@@ -6372,7 +8247,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       ret = resolve_used_bits(i + 1, opcnt, xAX, &mask, &z_check);
       if (ret != 0)
         ferr(po, "fnstsw resolve failed\n");
-      ret = adjust_prev_op(i, OP_FCOM, i + opcnt * 21,
+      ret = adjust_prev_op(i, OP_FCOM,
               (void *)(long)(mask | (z_check << 16)));
       if (ret != 1)
         ferr(po, "failed to find fcom: %d\n", ret);
@@ -6383,20 +8258,26 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
   }
 
+  prof_pass(PROF_PASS6);
   // pass6:
   // - find POPs for PUSHes, rm both
   // - scan for all used registers
-  memset(cbits, 0, sizeof(cbits));
+  memset(cbits, 0, (opcnt + 7) / 8);
   reg_use_pass(0, opcnt, cbits, regmask_init, &regmask,
     0, &regmask_save, &regmask_init, regmask_arg);
 
   need_float_stack = !!(regmask & mxST7_2);
 
+  prof_pass(PROF_PASS7);
   // pass7:
   // - find flag set ops for their users
   // - do unresolved calls
   // - declare indirect functions
   // - other op specific processing
+  cfg_build(opcnt);
+  flag_defs_solve(opcnt);
+  reg_live_solve(opcnt);
+
   for (i = 0; i < opcnt; i++)
   {
     po = &ops[i];
@@ -6407,8 +8288,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     {
       int setters[16], cnt = 0, branched = 0;
 
-      ret = scan_for_flag_set(i, opcnt, i + opcnt * 6,
-              &branched, setters, &cnt);
+      ret = scan_for_flag_set(i, &branched,
+              setters, ARRAY_SIZE(setters), &cnt);
       if (ret < 0 || cnt <= 0)
         ferr(po, "unable to trace flag setter(s)\n");
       if (cnt > ARRAY_SIZE(setters))
@@ -6419,27 +8300,49 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         tmp_op = &ops[setters[j]]; // flag setter
         pfomask = 0;
 
+        // rotates leave ZF/SF/PF alone, a reader that mixes those
+        // with CF/OF would need two setters
+        if (is_rotate_op(tmp_op) && po->pfo != PFO_C && po->pfo != PFO_O)
+          ferr(po, "%s doesn't set %s\n", op_name(tmp_op),
+            parsed_flag_op_names[po->pfo]);
+
         // to get nicer code, we try to delay test and cmp;
         // if we can't because of operand modification, or if we
         // have arith op, or branch, make it calculate flags explicitly
         if (tmp_op->op == OP_TEST || tmp_op->op == OP_CMP)
         {
-          if (branched || scan_for_mod(tmp_op, setters[j] + 1, i, 0) >= 0)
+          if (!branched) {
+            if (scan_for_mod(tmp_op, setters[j] + 1, i, 0) >= 0)
+              pfomask = 1 << po->pfo;
+          }
+          else if (!flag_fwd_ok(tmp_op, setters, cnt, i, opcnt, 0))
             pfomask = 1 << po->pfo;
+          else
+            po->flags |= OPF_FFWD;
         }
-        else if (tmp_op->op == OP_CMPS || tmp_op->op == OP_SCAS) {
+        else if (tmp_op->op == OP_CMPS || tmp_op->op == OP_SCAS
+          || tmp_op->op == OP_XADD || tmp_op->op == OP_CMPXCHG
+          || is_atomic_op(tmp_op))
+        {
+          // atomic: the flags come from the value the op returned
           pfomask = 1 << po->pfo;
         }
         else {
           // see if we'll be able to handle based on op result
-          if ((tmp_op->op != OP_AND && tmp_op->op != OP_OR
+          if (tmp_op->op != OP_AND && tmp_op->op != OP_OR
                && po->pfo != PFO_Z && po->pfo != PFO_S
                && po->pfo != PFO_P)
-              || branched
-              || scan_for_mod_opr0(tmp_op, setters[j] + 1, i) >= 0)
           {
             pfomask = 1 << po->pfo;
           }
+          else if (!branched) {
+            if (scan_for_mod_opr0(tmp_op, setters[j] + 1, i) >= 0)
+              pfomask = 1 << po->pfo;
+          }
+          else if (!flag_fwd_ok(tmp_op, setters, cnt, i, opcnt, 1))
+            pfomask = 1 << po->pfo;
+          else
+            po->flags |= OPF_FFWD;
 
           if (tmp_op->op == OP_ADD && po->pfo == PFO_C) {
             propagate_lmod(tmp_op, &tmp_op->operand[0],
@@ -6465,6 +8368,30 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     case OP_CMPS:
     case OP_SCAS:
       cond_vars |= 1 << PFO_Z;
+      // fallthrough
+    case OP_MOVS:
+    case OP_STOS:
+      if ((po->flags & (OPF_REP|OPF_DF)) != OPF_REP)
+        break;
+      // only forward ops that map to libc,
+      // cmps only for the all equal case
+      if (po->op == OP_CMPS && !(po->flags & OPF_REPZ))
+        break;
+      if (po->op == OP_SCAS && (!(po->flags & OPF_REPNZ)
+          || po->operand[1].lmod != OPLM_BYTE))
+        break;
+      po->flags |= OPF_MEMF;
+
+      // skip final reg updates nobody reads
+      l = 0;
+      if (is_reg_live(i + 1, opcnt, xCX, OPLM_DWORD))
+        l |= 1 << xCX;
+      if (is_reg_live(i + 1, opcnt, xDI, OPLM_DWORD))
+        l |= 1 << xDI;
+      if ((po->op == OP_MOVS || po->op == OP_CMPS)
+          && is_reg_live(i + 1, opcnt, xSI, OPLM_DWORD))
+        l |= 1 << xSI;
+      po->datap = (void *)(long)l;
       break;
 
     case OP_MUL:
@@ -6536,18 +8463,21 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       if (!(po->flags & OPF_TAIL)
           && !(g_sct_func_attr & SCTFA_NOWARN) && !g_nowarn_reguse)
       {
-        // treat al write as overwrite to avoid many false positives
-        if (IS(pp->ret_type.name, "void") || pp->ret_type.is_float) {
-          find_next_read_reg(i + 1, opcnt, xAX, OPLM_BYTE,
-            i + opcnt * 25, &j);
+        // treat al write as overwrite to avoid many false positives;
+        // the liveness says if there is a reader, the walks find it
+        if ((IS(pp->ret_type.name, "void") || pp->ret_type.is_float)
+            && is_reg_live(i + 1, opcnt, xAX, OPLM_BYTE))
+        {
+          find_next_read_reg(i + 1, opcnt, xAX, OPLM_BYTE, &j);
           if (j != -1) {
             fnote(po, "eax used after void/float ret call\n");
             fnote(&ops[j], "(used here)\n");
           }
         }
-        if (!strstr(pp->ret_type.name, "int64")) {
-          find_next_read_reg(i + 1, opcnt, xDX, OPLM_BYTE,
-            i + opcnt * 26, &j);
+        if (!strstr(pp->ret_type.name, "int64")
+            && is_reg_live(i + 1, opcnt, xDX, OPLM_BYTE))
+        {
+          find_next_read_reg(i + 1, opcnt, xDX, OPLM_BYTE, &j);
           // indirect calls are often guessed, don't warn
           if (j != -1 && !IS_OP_INDIRECT_CALL(&ops[j])) {
             fnote(po, "edx used after 32bit ret call\n");
@@ -6562,9 +8492,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
             break;
           }
         }
-        if (j != 0) {
-          find_next_read_reg(i + 1, opcnt, xCX, OPLM_BYTE,
-            i + opcnt * 27, &j);
+        if (j != 0 && is_reg_live(i + 1, opcnt, xCX, OPLM_BYTE)) {
+          find_next_read_reg(i + 1, opcnt, xCX, OPLM_BYTE, &j);
           if (j != -1 && !IS_OP_INDIRECT_CALL(&ops[j])) {
             fnote(po, "ecx used after call\n");
             fnote(&ops[j], "(used here)\n");
@@ -6617,10 +8546,21 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
 
     case OP_RCL:
     case OP_RCR:
+      // variable count goes to do_rcl/do_rcr()
+      if (po->operand[1].type == OPT_CONST)
+        need_tmp_var = 1;
+      break;
+
     case OP_XCHG:
+    case OP_XADD:
+    case OP_CMPXCHG:
       need_tmp_var = 1;
       break;
 
+    case OP_CMPXCHG8B:
+      need_tmp64 = 1;
+      break;
+
     case OP_FLD:
       if (po->operand[0].lmod == OPLM_QWORD)
         need_double = 1;
@@ -6633,9 +8573,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       break;
 
     case OPP_FTOL:
-      find_next_read_reg(i + 1, opcnt, xDX, OPLM_DWORD,
-        i + opcnt * 18, &j);
-      if (j == -1)
+      if (!is_reg_live(i + 1, opcnt, xDX, OPLM_DWORD))
         po->flags |= OPF_32BIT;
       break;
 
@@ -6644,6 +8582,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
   }
 
+  prof_pass(PROF_PASS8);
   // pass8: sync all push arg numbers
   // some calls share args and not all of them
   // (there's only partial intersection)
@@ -6678,6 +8617,10 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
   }
   while (found);
 
+  if (need_float_stack)
+    float_depth_scan(opcnt);
+
+  prof_pass(PROF_PASS9);
   // pass9: final adjustments
   for (i = 0; i < opcnt; i++)
   {
@@ -6688,17 +8631,31 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     if (po->op != OP_FST && po->p_argnum > 0)
       save_arg_vars[po->p_arggrp] |= 1 << (po->p_argnum - 1);
 
-    // correct for "full stack" mode late enable
+    // correct for "full stack" mode late enable,
+    // with static depth there is no f_stp to shift
     if ((po->flags & (OPF_PPUSH|OPF_FPOP|OPF_FPOPP))
         && need_float_stack)
-      po->flags |= OPF_FSHIFT;
+    {
+      if (g_f_depth != NULL)
+        po->flags &= ~OPF_FSHIFT;
+      else
+        po->flags |= OPF_FSHIFT;
+    }
   }
 
+  sf_scalar_scan(opcnt);
+
   float_type = need_double ? "double" : "float";
   float_st0 = need_float_stack ? "f_st[f_stp & 7]" : "f_st0";
   float_st1 = need_float_stack ? "f_st[(f_stp + 1) & 7]" : "f_st1";
+  if (g_f_depth != NULL) {
+    // set per op
+    float_st0 = f_st0_buf;
+    float_st1 = f_st1_buf;
+  }
 
   // output starts here
+  prof_pass(PROF_OUTPUT);
 
   if (g_seh_found)
     fprintf(fout, "// had SEH\n");
@@ -6790,25 +8747,53 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     if (stack_fsz_adj)
       fprintf(fout, "  // stack_fsz_adj %d\n", stack_fsz_adj);
 
-    fprintf(fout, "  union { u32 d[%d];", (g_stack_fsz + 3) / 4);
-    if (g_func_lmods & (1 << OPLM_WORD))
-      fprintf(fout, " u16 w[%d];", (g_stack_fsz + 1) / 2);
-    if (g_func_lmods & (1 << OPLM_BYTE))
-      fprintf(fout, " u8 b[%d];", g_stack_fsz);
-    if (g_func_lmods & (1 << OPLM_QWORD))
-      fprintf(fout, " double q[%d];", (g_stack_fsz + 7) / 8);
-
     if (stack_align > 8)
       ferr(ops, "unhandled stack align of %d\n", stack_align);
-    else if (stack_align == 8)
-      fprintf(fout, " u64 align;");
-    fprintf(fout, " } sf;\n");
-    had_decl = 1;
-  }
 
-  if ((g_sct_func_attr & SCTFA_ARGFRAME) && g_func_pp->argc_stack) {
-    fprintf(fout, "  struct { u32 ");
-    for (i = j = 0; i < g_func_pp->argc; i++) {
+    // not needed if all slots are separate locals
+    if (!g_sf_all_scalar) {
+      fprintf(fout, "  union { u32 d[%d];", (g_stack_fsz + 3) / 4);
+      if (g_func_lmods & (1 << OPLM_WORD))
+        fprintf(fout, " u16 w[%d];", (g_stack_fsz + 1) / 2);
+      if (g_func_lmods & (1 << OPLM_BYTE))
+        fprintf(fout, " u8 b[%d];", g_stack_fsz);
+      if (g_func_lmods & (1 << OPLM_QWORD))
+        fprintf(fout, " double q[%d];", (g_stack_fsz + 7) / 8);
+      if (stack_align == 8)
+        fprintf(fout, " u64 align;");
+      fprintf(fout, " } sf;\n");
+    }
+
+    // slots that were replaced by scalars
+    for (j = 0; g_sf_scalar != NULL && j < 5; j++) {
+      static const struct { int v; const char *t; } sf_t[] = {
+        { OPLM_BYTE + 1, "u8" }, { OPLM_WORD + 1, "u16" },
+        { OPLM_DWORD + 1, "u32" }, { OPLM_QWORD + 1, "double" },
+        { SF_MMXQ | (OPLM_QWORD + 1), "u64" },
+      };
+      int lm = (sf_t[j].v & ~SF_MMXQ) - 1;
+      int sz = lmod_bytes(NULL, lm);
+      int n = 0;
+
+      for (i = 0; i < g_stack_fsz; i += sz) {
+        if (g_sf_scalar[i] != sf_t[j].v)
+          continue;
+        sf_scalar_access(NULL, buf1, sizeof(buf1), "", i, lm);
+        if (n++ == 0)
+          fprintf(fout, "  %s", sf_t[j].t);
+        else
+          fprintf(fout, ",");
+        fprintf(fout, " %s", buf1);
+      }
+      if (n)
+        fprintf(fout, ";\n");
+    }
+    had_decl = 1;
+  }
+
+  if ((g_sct_func_attr & SCTFA_ARGFRAME) && g_func_pp->argc_stack) {
+    fprintf(fout, "  struct { u32 ");
+    for (i = j = 0; i < g_func_pp->argc; i++) {
       if (g_func_pp->arg[i].reg != NULL)
         continue;
       if (j++ != 0)
@@ -6890,7 +8875,15 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
   }
   // ... x87
-  if (need_float_stack) {
+  if (need_float_stack && g_f_depth != NULL) {
+    for (reg = 0; reg < 8; reg++) {
+      if (g_f_slots & (1 << reg)) {
+        fprintf(fout, "  %s f_s%d;\n", float_type, reg);
+        had_decl = 1;
+      }
+    }
+  }
+  else if (need_float_stack) {
     fprintf(fout, "  %s f_st[8];\n", float_type);
     fprintf(fout, "  int f_stp = 0;\n");
     had_decl = 1;
@@ -7015,6 +9008,11 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     if (po->flags & OPF_RMD)
       continue;
 
+    if (g_f_depth != NULL && g_f_depth[i] != -1) {
+      float_st_name(f_st0_buf, sizeof(f_st0_buf), i, 0);
+      float_st_name(f_st1_buf, sizeof(f_st1_buf), i, 1);
+    }
+
     lock_handled = 0;
     no_output = 0;
 
@@ -7025,19 +9023,21 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     // conditional/flag using op?
     if (po->flags & OPF_CC)
     {
-      int is_delayed = 0;
+      int is_delayed = 0, rot_cf;
 
       tmp_op = po->datap;
+      // CF/OF from a rotate, the delayed op below it is for ZF/SF/PF
+      rot_cf = tmp_op != NULL && is_rotate_op(tmp_op);
 
       // we go through all this trouble to avoid using parsed_flag_op,
       // which makes generated code much nicer
-      if (delayed_flag_op != NULL)
+      if (delayed_flag_op != NULL && !rot_cf)
       {
         out_cmp_test(buf1, sizeof(buf1), delayed_flag_op,
           po->pfo, po->pfo_inv);
         is_delayed = 1;
       }
-      else if (last_arith_dst != NULL
+      else if (last_arith_dst != NULL && !rot_cf
         && (po->pfo == PFO_Z || po->pfo == PFO_S || po->pfo == PFO_P
            || (tmp_op && (tmp_op->op == OP_AND || tmp_op->op == OP_OR))
            ))
@@ -7050,6 +9050,17 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
           last_arith_dst->lmod, buf3);
         is_delayed = 1;
       }
+      else if (tmp_op != NULL && (po->flags & OPF_FFWD)) {
+        // setter is in another block, its operands still hold
+        if (tmp_op->op == OP_TEST || tmp_op->op == OP_CMP)
+          out_cmp_test(buf1, sizeof(buf1), tmp_op, po->pfo, po->pfo_inv);
+        else {
+          out_src_opr_u32(buf3, sizeof(buf3), tmp_op, &tmp_op->operand[0]);
+          out_test_for_cc(buf1, sizeof(buf1), po, po->pfo, po->pfo_inv,
+            tmp_op->operand[0].lmod, buf3);
+        }
+        is_delayed = 1;
+      }
       else if (tmp_op != NULL) {
         // use preprocessed flag calc results
         if (!(tmp_op->pfomask & (1 << po->pfo)))
@@ -7133,6 +9144,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       case OP_XCHG:
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
+        if (is_atomic_op(po))
+          goto atomic_op;
         fprintf(fout, "  tmp = %s;",
           out_src_opr(buf1, sizeof(buf1), po, &po->operand[0], "", 0));
         fprintf(fout, " %s = %s;",
@@ -7145,6 +9158,26 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         snprintf(g_comment, sizeof(g_comment), "xchg");
         break;
 
+      case OP_XADD:
+      case OP_CMPXCHG:
+        if (!is_atomic_op(po)) {
+          out_xadd_cmpxchg(fout, po, &pfomask);
+          last_arith_dst = NULL;
+          delayed_flag_op = NULL;
+          break;
+        }
+        // fallthrough
+      case OP_CMPXCHG8B:
+      atomic_op:
+        out_atomic_op(fout, po, &pfomask);
+        if (po->flags & OPF_LOCK) {
+          strcat(g_comment, " lock");
+          lock_handled = 1;
+        }
+        last_arith_dst = NULL;
+        delayed_flag_op = NULL;
+        break;
+
       case OP_NOT:
         assert_operand_cnt(1);
         out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
@@ -7191,7 +9224,15 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         break;
 
       case OP_STOS:
-        if (po->flags & OPF_REP) {
+        if (po->flags & OPF_MEMF) {
+          assert_operand_cnt(3);
+          j = lmod_bytes(po, po->operand[1].lmod);
+          fprintf(fout, "  rep_stos(edi, eax, ecx, %d);", j);
+          out_memf_regs(fout, po, j);
+          fprintf(fout, "\n  barrier();");
+          strcpy(g_comment, "^ rep stos");
+        }
+        else if (po->flags & OPF_REP) {
           assert_operand_cnt(3);
           fprintf(fout, "  for (; ecx != 0; ecx--, edi %c= %d)\n",
             (po->flags & OPF_DF) ? '-' : '+',
@@ -7215,7 +9256,14 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         j = lmod_bytes(po, po->operand[0].lmod);
         strcpy(buf1, lmod_cast_u_ptr(po, po->operand[0].lmod));
         l = (po->flags & OPF_DF) ? '-' : '+';
-        if (po->flags & OPF_REP) {
+        if (po->flags & OPF_MEMF) {
+          assert_operand_cnt(3);
+          fprintf(fout, "  rep_movs(edi, esi, ecx, %d);", j);
+          out_memf_regs(fout, po, j);
+          fprintf(fout, "\n  barrier();");
+          strcpy(g_comment, "^ rep movs");
+        }
+        else if (po->flags & OPF_REP) {
           assert_operand_cnt(3);
           fprintf(fout,
             "  for (; ecx != 0; ecx--, edi %c= %d, esi %c= %d)\n",
@@ -7241,8 +9289,20 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         l = (po->flags & OPF_DF) ? '-' : '+';
         if (po->flags & OPF_REP) {
           assert_operand_cnt(3);
+          if (po->flags & OPF_MEMF) {
+            // all equal is the common case, else find the mismatch
+            fprintf(fout, "  if (ecx != 0 && memcmp((void *)esi, "
+              "(void *)edi, ecx * %d) == 0) {\n", j);
+            fprintf(fout, "    cond_z = 1;");
+            if (pfomask & (1 << PFO_C))
+              fprintf(fout, " cond_c = 0;");
+            out_memf_regs(fout, po, j);
+            fprintf(fout, "\n  }\n  else ");
+          }
+          else
+            fprintf(fout, "  ");
           fprintf(fout,
-            "  while (ecx != 0) {\n");
+            "while (ecx != 0) {\n");
           if (pfomask & (1 << PFO_C)) {
             // ugh..
             fprintf(fout,
@@ -7278,7 +9338,25 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         // repe ~ repeat while ZF=1
         j = lmod_bytes(po, po->operand[1].lmod);
         l = (po->flags & OPF_DF) ? '-' : '+';
-        if (po->flags & OPF_REP) {
+        if (po->flags & OPF_MEMF) {
+          assert_operand_cnt(3);
+          l = (long)po->datap;
+          fprintf(fout, "  if (ecx != 0) {\n");
+          fprintf(fout, "    u32 p = (u32)memchr((void *)edi, (u8)eax, ecx);"
+            "\n");
+          fprintf(fout, "    cond_z = p != 0;\n");
+          if (l & ((1 << xDI) | (1 << xCX))) {
+            fprintf(fout, "    p = p ? p + 1 - edi : ecx;\n   ");
+            if (l & (1 << xDI))
+              fprintf(fout, " edi += p;");
+            if (l & (1 << xCX))
+              fprintf(fout, " ecx -= p;");
+            fprintf(fout, "\n");
+          }
+          fprintf(fout, "  }");
+          strcpy(g_comment, "repne scas");
+        }
+        else if (po->flags & OPF_REP) {
           assert_operand_cnt(3);
           fprintf(fout,
             "  while (ecx != 0) {\n");
@@ -7319,12 +9397,16 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
 
       // arithmetic w/flags
       case OP_AND:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         if (po->operand[1].type == OPT_CONST && !po->operand[1].val)
           goto dualop_arith_const;
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         goto dualop_arith;
 
       case OP_OR:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         if (po->operand[1].type == OPT_CONST) {
           j = lmod_bytes(po, po->operand[0].lmod);
@@ -7442,11 +9524,19 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
             buf1, buf1, j, buf1,
             lmod_bytes(po, po->operand[0].lmod) * 8 - j);
         }
-        else
-          ferr(po, "TODO\n");
+        else {
+          // the count is masked to 5 bits, which for 8/16 bit
+          // operands leaves the same rotation as masking to width;
+          // the form is what gcc matches as a single rol/ror
+          j = lmod_bytes(po, po->operand[0].lmod) * 8 - 1;
+          out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]);
+          fprintf(fout, po->op == OP_ROL ?
+            "  %s = (%s << (%s & %d)) | (%s >> (-(u32)%s & %d));" :
+            "  %s = (%s >> (%s & %d)) | (%s << (-(u32)%s & %d));",
+            buf1, buf1, buf2, j, buf1, buf2, j);
+        }
         output_std_flags(fout, po, &pfomask, buf1);
-        last_arith_dst = &po->operand[0];
-        delayed_flag_op = NULL;
+        // ZF/SF/PF readers still use the previous setter
         break;
 
       case OP_RCL:
@@ -7477,15 +9567,20 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
           fprintf(fout, ";\n");
           fprintf(fout, "  cond_c = tmp;");
         }
-        else
-          ferr(po, "TODO\n");
+        else {
+          fprintf(fout, "  %s = do_%s(%s, %s & 0x1f, &cond_c, %d);",
+            buf1, (po->op == OP_RCL) ? "rcl" : "rcr", buf1,
+            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]), l);
+        }
         strcpy(g_comment, (po->op == OP_RCL) ? "rcl" : "rcr");
+        pfomask &= ~PFOB_C; // cond_c is always updated
         output_std_flags(fout, po, &pfomask, buf1);
-        last_arith_dst = &po->operand[0];
-        delayed_flag_op = NULL;
+        // ZF/SF/PF readers still use the previous setter
         break;
 
       case OP_XOR:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         if (IS(opr_name(po, 0), opr_name(po, 1))) {
@@ -7507,6 +9602,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         goto dualop_arith;
 
       case OP_ADD:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         if (pfomask & (1 << PFO_C)) {
@@ -7541,6 +9638,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         goto dualop_arith;
 
       case OP_SUB:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         if (pfomask & ~((1 << PFO_Z) | (1 << PFO_S))) {
@@ -7598,6 +9697,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         break;
 
       case OP_DEC:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         if (pfomask & ~(PFOB_S | PFOB_S | PFOB_C)) {
           for (j = 0; j <= PFO_LE; j++) {
             if (!(pfomask & (1 << j)))
@@ -7614,6 +9715,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         // fallthrough
 
       case OP_INC:
+        if (po->flags & OPF_LOCK)
+          goto atomic_op;
         if (pfomask & (1 << PFO_C))
           // carry is unaffected by inc/dec.. wtf?
           ferr(po, "carry propagation needed\n");
@@ -7624,14 +9727,6 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
           strcpy(buf2, po->op == OP_INC ? "++" : "--");
           fprintf(fout, "  %s%s;", buf1, buf2);
         }
-        else if (po->flags & OPF_LOCK) {
-          out_src_opr(buf2, sizeof(buf2), po, &po->operand[0], "", 1);
-          fprintf(fout, "  __sync_fetch_and_%s((%s *)(%s), 1);",
-            po->op == OP_INC ? "add" : "sub",
-            lmod_type_u(po, po->operand[0].lmod), buf2);
-          strcat(g_comment, " lock");
-          lock_handled = 1;
-        }
         else {
           strcpy(buf2, po->op == OP_INC ? "+" : "-");
           fprintf(fout, "  %s %s= 1;", buf1, buf2);
@@ -7846,7 +9941,10 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
           }
           else if (po->regmask_dst & mxST0) {
             ferr_assert(po, po->flags & OPF_FPUSH);
-            if (need_float_stack)
+            if (g_f_depth != NULL)
+              fprintf(fout, "%s = ",
+                float_st_name(buf2, sizeof(buf2), i, -1));
+            else if (need_float_stack)
               fprintf(fout, "f_st[--f_stp & 7] = ");
             else
               fprintf(fout, "f_st0 = ");
@@ -8131,7 +10229,11 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         if (need_float_stack) {
           out_src_opr_float(buf1, sizeof(buf1),
             po, &po->operand[0], 1);
-          if (po->regmask_src & mxSTa) {
+          if (g_f_depth != NULL) {
+            fprintf(fout, "  %s = %s;",
+              float_st_name(buf2, sizeof(buf2), i, -1), buf1);
+          }
+          else if (po->regmask_src & mxSTa) {
             fprintf(fout, "  f_st[(f_stp - 1) & 7] = %s; f_stp--;",
               buf1);
           }
@@ -8158,7 +10260,11 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         out_src_opr(buf1, sizeof(buf1), po, &po->operand[0],
           lmod_cast(po, po->operand[0].lmod, 1), 0);
         snprintf(buf2, sizeof(buf2), "(%s)%s", float_type, buf1);
-        if (need_float_stack) {
+        if (g_f_depth != NULL) {
+          fprintf(fout, "  %s = %s;",
+            float_st_name(buf3, sizeof(buf3), i, -1), buf2);
+        }
+        else if (need_float_stack) {
           fprintf(fout, "  f_st[--f_stp & 7] = %s;", buf2);
         }
         else {
@@ -8170,7 +10276,10 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         break;
 
       case OP_FLDc:
-        if (need_float_stack)
+        if (g_f_depth != NULL)
+          fprintf(fout, "  %s = ",
+            float_st_name(buf1, sizeof(buf1), i, -1));
+        else if (need_float_stack)
           fprintf(fout, "  f_st[--f_stp & 7] = ");
         else {
           if (po->flags & OPF_FSHIFT)
@@ -8397,7 +10506,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         if (need_float_stack) {
           fprintf(fout, "  %s = atan%s(%s / %s);", float_st1,
             need_double ? "" : "f", float_st1, float_st0);
-          fprintf(fout, " f_stp++;");
+          if (po->flags & OPF_FSHIFT)
+            fprintf(fout, " f_stp++;");
         }
         else {
           fprintf(fout, "  f_st0 = atan%s(f_st1 / f_st0);",
@@ -8409,7 +10519,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         if (need_float_stack) {
           fprintf(fout, "  %s = %s * log2%s(%s);", float_st1,
             float_st1, need_double ? "" : "f", float_st0);
-          fprintf(fout, " f_stp++;");
+          if (po->flags & OPF_FSHIFT)
+            fprintf(fout, " f_stp++;");
         }
         else {
           fprintf(fout, "  f_st0 = f_st1 * log2%s(f_st0);",
@@ -8458,7 +10569,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         if (need_float_stack) {
           fprintf(fout, "  %s = pow%s(%s, %s);", float_st1,
             need_double ? "" : "f", float_st1, float_st0);
-          fprintf(fout, " f_stp++;");
+          if (po->flags & OPF_FSHIFT)
+            fprintf(fout, " f_stp++;");
         }
         else {
           fprintf(fout, "  f_st0 = pow%s(f_st1, f_st0);",
@@ -8476,6 +10588,102 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         fprintf(fout, "  do_emms();");
         break;
 
+      case OP_MOVD:
+        if (is_mmx_reg(&po->operand[0])) {
+          fprintf(fout, "  %s.q = %s;", opr_reg_p(po, &po->operand[0]),
+            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
+        }
+        else {
+          fprintf(fout, "  %s = %s.d[0];",
+            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
+            opr_reg_p(po, &po->operand[1]));
+        }
+        break;
+
+      // packed ops that map to plain vector expressions,
+      // unsigned elements for wraparound
+      case OP_PADD:
+      case OP_PSUB:
+      case OP_PMULL:
+      case OP_PAND:
+      case OP_POR:
+      case OP_PXOR:
+        strcpy(buf1, opr_reg_p(po, &po->operand[0]));
+        strcpy(buf3, mmx_member(po, po->lmod, 0));
+        if ((po->op == OP_PSUB || po->op == OP_PXOR)
+            && po->regmask_src == 0)
+        {
+          fprintf(fout, "  %s.q = 0;", buf1);
+          break;
+        }
+        switch (po->op) {
+        case OP_PADD: l = '+'; break;
+        case OP_PSUB: l = '-'; break;
+        case OP_PMULL: l = '*'; break;
+        case OP_PAND: l = '&'; break;
+        case OP_POR:  l = '|'; break;
+        default:      l = '^'; break;
+        }
+        fprintf(fout, "  %s.%s %c= %s;", buf1, buf3, l,
+          out_src_opr_mmx(buf2, sizeof(buf2), po, &po->operand[1], buf3));
+        break;
+
+      case OP_PANDN:
+        strcpy(buf1, opr_reg_p(po, &po->operand[0]));
+        fprintf(fout, "  %s.q = ~%s.q & %s;", buf1, buf1,
+          out_src_opr_mmx(buf2, sizeof(buf2), po, &po->operand[1], "q"));
+        break;
+
+      // lanes become all ones or zero
+      case OP_PCMPEQ:
+      case OP_PCMPGT:
+        strcpy(buf1, opr_reg_p(po, &po->operand[0]));
+        strcpy(buf3, mmx_member(po, po->lmod, 1));
+        fprintf(fout, "  %s.%s = %s.%s %s %s;", buf1, buf3,
+          buf1, buf3, po->op == OP_PCMPEQ ? "==" : ">",
+          out_src_opr_mmx(buf2, sizeof(buf2), po, &po->operand[1], buf3));
+        break;
+
+      case OP_PSLL:
+      case OP_PSRL:
+      case OP_PSRA:
+        strcpy(buf1, opr_reg_p(po, &po->operand[0]));
+        if (po->operand[1].type != OPT_CONST) {
+          // count from mm reg or mem, large counts in the helper
+          fprintf(fout, "  %s = mmx_%s(%s, %s);", buf1, op_name(po), buf1,
+            out_src_opr_mmx(buf2, sizeof(buf2), po, &po->operand[1], "q"));
+          break;
+        }
+        l = lmod_bytes(po, po->lmod) * 8;
+        j = po->operand[1].val;
+        strcpy(buf3, mmx_member(po, po->lmod, po->op == OP_PSRA));
+        if (po->operand[1].val >= l) {
+          if (po->op != OP_PSRA) {
+            fprintf(fout, "  %s.q = 0;", buf1);
+            break;
+          }
+          j = l - 1;
+        }
+        fprintf(fout, "  %s.%s %s= %d;", buf1, buf3,
+          po->op == OP_PSLL ? "<<" : ">>", j);
+        break;
+
+      // saturation, pack, unpack and multiply-high are helpers
+      case OP_PADDS:
+      case OP_PADDUS:
+      case OP_PSUBS:
+      case OP_PSUBUS:
+      case OP_PMULH:
+      case OP_PMADD:
+      case OP_PACKSS:
+      case OP_PACKUS:
+      case OP_PUNPCKL:
+      case OP_PUNPCKH:
+        strcpy(buf1, opr_reg_p(po, &po->operand[0]));
+        fprintf(fout, "  %s = mmx_%s(%s, %s);", buf1, op_name(po), buf1,
+          out_src_opr_mmx(buf2, sizeof(buf2), po, &po->operand[1], NULL));
+        break;
+
       tail_check:
         if (po->flags & OPF_TAIL) {
           fprintf(fout, "\n");
@@ -8528,7 +10736,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
 
     if (last_arith_dst != NULL && last_arith_dst != &po->operand[0]) {
-      if (is_opr_modified(last_arith_dst, po))
+      if (is_opr_addr_modified(last_arith_dst,
+            opr_addr_regmask(last_arith_dst), po))
         last_arith_dst = NULL;
     }
 
@@ -8536,7 +10745,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       label_pending = 0;
   }
 
-  if (g_stack_fsz && !g_stack_frame_used)
+  if (g_stack_fsz && !g_stack_frame_used && !g_sf_all_scalar)
     fprintf(fout, "  (void)sf;\n");
 
   fprintf(fout, "}\n\n");
@@ -8548,23 +10757,15 @@ static void gen_x_cleanup(int opcnt)
 {
   int i;
 
+  // refs and protos are in the function arena
   for (i = 0; i < opcnt; i++) {
-    struct label_ref *lr, *lr_del;
-
-    lr = g_label_refs[i].next;
-    while (lr != NULL) {
-      lr_del = lr;
-      lr = lr->next;
-      free(lr_del);
-    }
     g_label_refs[i].i = -1;
     g_label_refs[i].next = NULL;
-
-    if (ops[i].op == OP_CALL) {
-      if (ops[i].pp)
-        proto_release(ops[i].pp);
-    }
   }
+  g_sf_scalar = NULL;
+  g_sf_all_scalar = 0;
+  g_f_depth = NULL;
+  cfg_free();
   g_func_pp = NULL;
 }
 
@@ -8578,17 +10779,19 @@ struct func_prototype {
   int regmask_use;               // used registers
   int has_ret:3;                 // -1, 0, 1: unresolved, no, yes
   unsigned int has_ret64:1;
-  unsigned int dep_resolved:1;
   unsigned int is_stdcall:1;
   unsigned int eax_pass:1;       // returns without touching eax
   unsigned int ptr_taken:1;      // pointer taken of this func
   struct func_proto_dep *dep_func;
   int dep_func_cnt;
+  int *dep_hash;                 // dep_func index + 1, by sym/ptr_taken
+  int dep_hash_size;
   const struct parsed_proto *pp; // seed pp, if any
 };
 
 struct func_proto_dep {
-  char *name;
+  const char *name;             // hg_syms[sym]
+  int sym;
   struct func_prototype *proto;
   int regmask_live;             // .. at the time of call
   unsigned int ret_dep:1;       // return from this is caller's return
@@ -8600,6 +10803,12 @@ struct func_proto_dep {
 static struct func_prototype *hg_fp;
 static int hg_fp_cnt;
 
+// interned dep names, open addressing hash of id + 1
+static char **hg_syms;
+static int hg_sym_cnt;
+static int *hg_sym_hash;
+static int hg_sym_hash_size;
+
 static struct scanned_var {
   char name[NAMELEN];
   enum opr_lenmod lmod;
@@ -8634,26 +10843,131 @@ static struct func_prototype *hg_fp_add(const char *funcn)
   return fp;
 }
 
+// returns sym id or -1
+static int hg_sym_find(const char *name)
+{
+  unsigned int h;
+  int i;
+
+  if (hg_sym_hash_size == 0)
+    return -1;
+
+  for (h = str_hash(name); ; h++) {
+    h &= hg_sym_hash_size - 1;
+    if (hg_sym_hash[h] == 0)
+      return -1;
+    i = hg_sym_hash[h] - 1;
+    if (IS(hg_syms[i], name))
+      return i;
+  }
+}
+
+static int hg_sym_intern(const char *name)
+{
+  unsigned int h;
+  int i;
+
+  i = hg_sym_find(name);
+  if (i >= 0)
+    return i;
+
+  if (hg_sym_cnt * 2 >= hg_sym_hash_size) {
+    hg_sym_hash_size = hg_sym_hash_size ? hg_sym_hash_size * 2 : 0x400;
+    free(hg_sym_hash);
+    hg_sym_hash = calloc(hg_sym_hash_size, sizeof(hg_sym_hash[0]));
+    my_assert_not(hg_sym_hash, NULL);
+    for (i = 0; i < hg_sym_cnt; i++) {
+      for (h = str_hash(hg_syms[i]); ; h++) {
+        h &= hg_sym_hash_size - 1;
+        if (hg_sym_hash[h] == 0)
+          break;
+      }
+      hg_sym_hash[h] = i + 1;
+    }
+  }
+
+  if ((hg_sym_cnt & 0xff) == 0) {
+    hg_syms = realloc(hg_syms, sizeof(hg_syms[0]) * (hg_sym_cnt + 0x100));
+    my_assert_not(hg_syms, NULL);
+  }
+  hg_syms[hg_sym_cnt] = strdup(name);
+  my_assert_not(hg_syms[hg_sym_cnt], NULL);
+
+  for (h = str_hash(name); ; h++) {
+    h &= hg_sym_hash_size - 1;
+    if (hg_sym_hash[h] == 0)
+      break;
+  }
+  hg_sym_hash[h] = hg_sym_cnt + 1;
+
+  return hg_sym_cnt++;
+}
+
+static unsigned int hg_dep_hash(int sym, unsigned int ptr_taken)
+{
+  return ((unsigned int)sym * 2 + ptr_taken) * 2654435761u;
+}
+
+// returns the dep_hash slot for sym/ptr_taken, empty if not there
+static int *hg_fp_dep_slot(struct func_prototype *fp, int sym,
+  unsigned int ptr_taken)
+{
+  struct func_proto_dep *dep;
+  unsigned int h;
+
+  for (h = hg_dep_hash(sym, ptr_taken); ; h++) {
+    h &= fp->dep_hash_size - 1;
+    if (fp->dep_hash[h] == 0)
+      return &fp->dep_hash[h];
+    dep = &fp->dep_func[fp->dep_hash[h] - 1];
+    if (dep->sym == sym && dep->ptr_taken == ptr_taken)
+      return &fp->dep_hash[h];
+  }
+}
+
+// finds the call (not ptr_taken) dep
 static struct func_proto_dep *hg_fp_find_dep(struct func_prototype *fp,
   const char *name)
 {
-  int i;
+  int sym;
+  int *slot;
 
-  for (i = 0; i < fp->dep_func_cnt; i++)
-    if (IS(fp->dep_func[i].name, name))
-      return &fp->dep_func[i];
+  if (fp->dep_hash_size == 0)
+    return NULL;
+  sym = hg_sym_find(name);
+  if (sym < 0)
+    return NULL;
 
-  return NULL;
+  slot = hg_fp_dep_slot(fp, sym, 0);
+  if (*slot == 0)
+    return NULL;
+  return &fp->dep_func[*slot - 1];
 }
 
 static void hg_fp_add_dep(struct func_prototype *fp, const char *name,
   unsigned int ptr_taken)
 {
-  struct func_proto_dep * dep;
+  struct func_proto_dep *dep;
+  int sym;
+  int *slot;
+  int i;
+
+  sym = hg_sym_intern(name);
+
+  if (fp->dep_func_cnt * 2 >= fp->dep_hash_size) {
+    fp->dep_hash_size = fp->dep_hash_size ? fp->dep_hash_size * 2 : 16;
+    free(fp->dep_hash);
+    fp->dep_hash = calloc(fp->dep_hash_size, sizeof(fp->dep_hash[0]));
+    my_assert_not(fp->dep_hash, NULL);
+    for (i = 0; i < fp->dep_func_cnt; i++) {
+      dep = &fp->dep_func[i];
+      *hg_fp_dep_slot(fp, dep->sym, dep->ptr_taken) = i + 1;
+    }
+  }
 
   // is it a dupe?
-  dep = hg_fp_find_dep(fp, name);
-  if (dep != NULL && dep->ptr_taken == ptr_taken)
+  slot = hg_fp_dep_slot(fp, sym, ptr_taken);
+  if (*slot != 0)
     return;
 
   if ((fp->dep_func_cnt & 0xff) == 0) {
@@ -8663,9 +10977,11 @@ static void hg_fp_add_dep(struct func_prototype *fp, const char *name,
     memset(&fp->dep_func[fp->dep_func_cnt], 0,
       sizeof(fp->dep_func[0]) * 0x100);
   }
-  fp->dep_func[fp->dep_func_cnt].name = strdup(name);
-  fp->dep_func[fp->dep_func_cnt].ptr_taken = ptr_taken;
-  fp->dep_func_cnt++;
+  dep = &fp->dep_func[fp->dep_func_cnt];
+  dep->name = hg_syms[sym];
+  dep->sym = sym;
+  dep->ptr_taken = ptr_taken;
+  *slot = ++fp->dep_func_cnt;
 }
 
 static int hg_fp_cmp_name(const void *p1_, const void *p2_)
@@ -8699,21 +11015,26 @@ static void hg_ref_add(const char *name)
 // - track saved regs (part 2)
 // - try to figure out arg-regs
 // - calculate reg deps
+// paths are walked depth first, branch targets before fallthrough;
+// the stack holds the paths left to walk as (i, regmask_save,
+// regmask_dst)
 static void gen_hdr_dep_pass(int i, int opcnt, unsigned char *cbits,
   struct func_prototype *fp, int regmask_save, int regmask_dst,
   int *regmask_dep, int *regmask_use, int *has_ret)
 {
   struct func_proto_dep *dep;
   struct parsed_op *po;
+  int base = g_wstack_cnt;
   int from_caller = 0;
   int j, l;
   int reg;
   int ret;
 
+next:
   for (; i < opcnt; i++)
   {
     if (cbits[i >> 3] & (1 << (i & 7)))
-      return;
+      break;
     cbits[i >> 3] |= (1 << (i & 7));
 
     po = &ops[i];
@@ -8724,24 +11045,22 @@ static void gen_hdr_dep_pass(int i, int opcnt, unsigned char *cbits,
 
       if (po->btj != NULL) {
         // jumptable
-        for (j = 0; j < po->btj->count; j++) {
+        for (j = po->btj->count - 1; j >= 0; j--) {
           check_i(po, po->btj->d[j].bt_i);
-          gen_hdr_dep_pass(po->btj->d[j].bt_i, opcnt, cbits, fp,
-            regmask_save, regmask_dst, regmask_dep, regmask_use,
-            has_ret);
+          wstack_push(po->btj->d[j].bt_i);
+          wstack_push(regmask_save);
+          wstack_push(regmask_dst);
         }
-        return;
+        break;
       }
 
       check_i(po, po->bt_i);
       if (po->flags & OPF_CJMP) {
-        gen_hdr_dep_pass(po->bt_i, opcnt, cbits, fp,
-          regmask_save, regmask_dst, regmask_dep, regmask_use,
-          has_ret);
-      }
-      else {
-        i = po->bt_i - 1;
+        wstack_push(i + 1);
+        wstack_push(regmask_save);
+        wstack_push(regmask_dst);
       }
+      i = po->bt_i - 1;
       continue;
     }
 
@@ -8759,13 +11078,11 @@ static void gen_hdr_dep_pass(int i, int opcnt, unsigned char *cbits,
       if (po->flags & OPF_DONE)
         continue;
 
-      ret = scan_for_pop(i + 1, opcnt, i + opcnt * 2,
-              reg, 0, 0, 0, 0);
+      ret = scan_for_pop(i + 1, opcnt, reg, 0, 0);
       if (ret == 1) {
         regmask_save |= 1 << reg;
         po->flags |= OPF_RMD;
-        scan_for_pop(i + 1, opcnt, i + opcnt * 3,
-          reg, 0, 0, 0, OPF_RMD);
+        scan_for_pop(i + 1, opcnt, reg, 0, OPF_RMD);
         continue;
       }
     }
@@ -8802,7 +11119,7 @@ static void gen_hdr_dep_pass(int i, int opcnt, unsigned char *cbits,
       else {
         j = -1;
         from_caller = 0;
-        ret = resolve_origin_reg(i, xAX, i + opcnt * 4, &j, &from_caller);
+        ret = resolve_origin_reg(i, xAX, &j, &from_caller);
       }
 
       if (ret != 1 && from_caller) {
@@ -8852,14 +11169,21 @@ static void gen_hdr_dep_pass(int i, int opcnt, unsigned char *cbits,
 
     if (po->flags & OPF_TAIL) {
       if (!(po->flags & OPF_CC)) // not cond. tailcall
-        return;
+        break;
     }
   }
+
+  if (g_wstack_cnt > base) {
+    regmask_dst = g_wstack[--g_wstack_cnt];
+    regmask_save = g_wstack[--g_wstack_cnt];
+    i = g_wstack[--g_wstack_cnt];
+    goto next;
+  }
 }
 
 static void gen_hdr(const char *funcn, int opcnt)
 {
-  unsigned char cbits[MAX_OPS / 8];
+  unsigned char *cbits = g_cbits;
   const struct parsed_proto *pp_c;
   struct parsed_proto *pp;
   struct func_prototype *fp;
@@ -8890,20 +11214,20 @@ static void gen_hdr(const char *funcn, int opcnt)
   // - parse calls with labels
   resolve_branches_parse_calls(opcnt);
 
+  prof_pass(PROF_PASS2);
   // pass2:
   // - handle ebp/esp frame, remove ops related to it
   scan_prologue_epilogue(opcnt, NULL);
 
+  prof_pass(PROF_PASS3);
   // pass3:
   // - remove dead labels
   // - collect calls
   // - collect function ptr refs
   for (i = 0; i < opcnt; i++)
   {
-    if (g_labels[i] != NULL && g_label_refs[i].i == -1) {
-      free(g_labels[i]);
-      g_labels[i] = NULL;
-    }
+    if (g_labels[i] != NULL && g_label_refs[i].i == -1)
+      free_label(i);
 
     po = &ops[i];
     if (po->flags & (OPF_RMD|OPF_DONE))
@@ -8927,6 +11251,7 @@ static void gen_hdr(const char *funcn, int opcnt)
     }
   }
 
+  prof_pass(PROF_PASS4);
   // pass4:
   // - handle push <const>/pop pairs
   for (i = 0; i < opcnt; i++)
@@ -8939,6 +11264,7 @@ static void gen_hdr(const char *funcn, int opcnt)
       scan_for_pop_const(i, opcnt, i + opcnt * 13);
   }
 
+  prof_pass(PROF_PASS5);
   // pass5:
   // - process trivial calls
   for (i = 0; i < opcnt; i++)
@@ -8973,6 +11299,7 @@ static void gen_hdr(const char *funcn, int opcnt)
     }
   }
 
+  prof_pass(PROF_PASS6);
   // pass6:
   // - track saved regs (simple)
   // - process calls
@@ -9007,18 +11334,17 @@ static void gen_hdr(const char *funcn, int opcnt)
         dep = hg_fp_find_dep(fp, opr_name(po, 0));
         ferr_assert(po, dep != NULL);
         // treat al write as overwrite to avoid many false positives
-        find_next_read_reg(i + 1, opcnt, xAX, OPLM_BYTE,
-          i + opcnt * 25, &j);
+        find_next_read_reg(i + 1, opcnt, xAX, OPLM_BYTE, &j);
         if (j != -1)
           dep->has_ret = 1;
-        find_next_read_reg(i + 1, opcnt, xDX, OPLM_BYTE,
-          i + opcnt * 26, &j);
+        find_next_read_reg(i + 1, opcnt, xDX, OPLM_BYTE, &j);
         if (j != -1 && !IS_OP_INDIRECT_CALL(&ops[j]))
           dep->has_ret64 = 1;
       }
     }
   }
 
+  prof_pass(PROF_PASS7);
   // pass7
   memset(cbits, 0, (opcnt + 7) / 8);
   regmask_dep = regmask_use = 0;
@@ -9072,45 +11398,160 @@ static void gen_hdr(const char *funcn, int opcnt)
   gen_x_cleanup(opcnt);
 }
 
-static void hg_fp_resolve_deps(struct func_prototype *fp)
+// iterate deps within one SCC of the call graph until nothing changes,
+// callee SCCs are final by the time this is called
+static void hg_fp_scc_solve(const int *scc, int cnt)
 {
-  struct func_prototype fp_s;
+  struct func_prototype *fp;
   struct func_proto_dep *dep;
   int regmask_dep;
-  int i;
+  int changed;
+  int i, j;
 
-  // this thing is recursive, so mark first..
-  fp->dep_resolved = 1;
+  do {
+    changed = 0;
+    for (i = 0; i < cnt; i++) {
+      fp = &hg_fp[scc[i]];
+      for (j = 0; j < fp->dep_func_cnt; j++) {
+        dep = &fp->dep_func[j];
+        if (dep->proto == NULL || dep->ptr_taken)
+          continue;
 
-  for (i = 0; i < fp->dep_func_cnt; i++) {
-    dep = &fp->dep_func[i];
+        regmask_dep = ~dep->regmask_live
+                     & dep->proto->regmask_dep;
+        if (regmask_dep & ~fp->regmask_dep) {
+          fp->regmask_dep |= regmask_dep;
+          changed = 1;
+        }
+        // printf("dep %s %s |= %x\n", fp->name,
+        //   fp->dep_func[j].name, regmask_dep);
 
-    strcpy(fp_s.name, dep->name);
-    dep->proto = bsearch(&fp_s, hg_fp, hg_fp_cnt,
-      sizeof(hg_fp[0]), hg_fp_cmp_name);
-    if (dep->proto != NULL) {
-      if (dep->ptr_taken) {
-        dep->proto->ptr_taken = 1;
-        continue;
+        if (fp->has_ret == -1 && dep->ret_dep
+            && dep->proto->has_ret != -1)
+        {
+          fp->has_ret = dep->proto->has_ret;
+          changed = 1;
+        }
       }
+    }
+  }
+  while (changed);
+}
 
-      if (!dep->proto->dep_resolved)
-        hg_fp_resolve_deps(dep->proto);
+static void hg_fp_resolve_deps(void)
+{
+  struct func_prototype *fp;
+  struct func_proto_dep *dep;
+  int *index, *low, *stk, *cs, *cs_dep;
+  int stk_cnt = 0, cs_cnt;
+  int next_index = 1;
+  int *sym_fp;
+  char *on_stk;
+  int i, j, v, w;
+
+  // sym id -> hg_fp index + 1
+  sym_fp = calloc(hg_sym_cnt + 1, sizeof(sym_fp[0]));
+  my_assert_not(sym_fp, NULL);
+  for (i = 0; i < hg_fp_cnt; i++) {
+    j = hg_sym_find(hg_fp[i].name);
+    if (j >= 0 && sym_fp[j] == 0)
+      sym_fp[j] = i + 1;
+  }
 
-      regmask_dep = ~dep->regmask_live
-                   & dep->proto->regmask_dep;
-      fp->regmask_dep |= regmask_dep;
-      // printf("dep %s %s |= %x\n", fp->name,
-      //   fp->dep_func[i].name, regmask_dep);
+  // link deps and apply what callers tell about callees,
+  // that only depends on the caller's own scan
+  for (i = 0; i < hg_fp_cnt; i++) {
+    fp = &hg_fp[i];
+    for (j = 0; j < fp->dep_func_cnt; j++) {
+      dep = &fp->dep_func[j];
+      if (sym_fp[dep->sym] == 0)
+        continue;
+      dep->proto = &hg_fp[sym_fp[dep->sym] - 1];
 
+      if (dep->ptr_taken) {
+        dep->proto->ptr_taken = 1;
+        continue;
+      }
       if (dep->has_ret && (dep->proto->regmask_use & mxAX))
         dep->proto->has_ret = 1;
       if (dep->has_ret64 && (dep->proto->regmask_use & mxDX))
         dep->proto->has_ret64 = 1;
-      if (fp->has_ret == -1 && dep->ret_dep)
-        fp->has_ret = dep->proto->has_ret;
     }
   }
+
+  // Tarjan's SCC, iterative; SCCs come out callees first,
+  // so each one can be solved as soon as it's complete
+  index = calloc(hg_fp_cnt, sizeof(index[0]));
+  low = malloc(hg_fp_cnt * sizeof(low[0]));
+  stk = malloc(hg_fp_cnt * sizeof(stk[0]));
+  cs = malloc(hg_fp_cnt * sizeof(cs[0]));
+  cs_dep = malloc(hg_fp_cnt * sizeof(cs_dep[0]));
+  on_stk = calloc(hg_fp_cnt, 1);
+  my_assert_not(index, NULL);
+  my_assert_not(low, NULL);
+  my_assert_not(stk, NULL);
+  my_assert_not(cs, NULL);
+  my_assert_not(cs_dep, NULL);
+  my_assert_not(on_stk, NULL);
+
+  for (i = 0; i < hg_fp_cnt; i++) {
+    if (index[i])
+      continue;
+
+    w = i;
+    cs_cnt = 0;
+    goto visit;
+
+    while (cs_cnt > 0) {
+      v = cs[cs_cnt - 1];
+      fp = &hg_fp[v];
+      if (cs_dep[cs_cnt - 1] < fp->dep_func_cnt) {
+        dep = &fp->dep_func[cs_dep[cs_cnt - 1]++];
+        if (dep->proto == NULL || dep->ptr_taken)
+          continue;
+
+        w = dep->proto - hg_fp;
+        if (index[w] == 0)
+          goto visit;
+        if (on_stk[w] && index[w] < low[v])
+          low[v] = index[w];
+        continue;
+      }
+
+      // all deps of v done
+      cs_cnt--;
+      if (cs_cnt > 0 && low[v] < low[cs[cs_cnt - 1]])
+        low[cs[cs_cnt - 1]] = low[v];
+
+      if (low[v] == index[v]) {
+        j = stk_cnt;
+        do {
+          w = stk[--j];
+          on_stk[w] = 0;
+        }
+        while (w != v);
+
+        hg_fp_scc_solve(&stk[j], stk_cnt - j);
+        stk_cnt = j;
+      }
+      continue;
+
+visit:
+      index[w] = low[w] = next_index++;
+      stk[stk_cnt++] = w;
+      on_stk[w] = 1;
+      cs[cs_cnt] = w;
+      cs_dep[cs_cnt++] = 0;
+    }
+  }
+
+  free(index);
+  free(low);
+  free(stk);
+  free(cs);
+  free(cs_dep);
+  free(on_stk);
+  free(sym_fp);
 }
 
 // make all thiscall/edx arg functions referenced from .data fastcall
@@ -9246,7 +11687,9 @@ static void output_hdr_fp(FILE *fout, const struct func_prototype *fp,
   }
 }
 
-static void output_hdr(FILE *fout)
+// if gen isn't NULL, the generated part (without the seed)
+// is also returned there, to be freed by the caller
+static void output_hdr(FILE *fout_hdr, char **gen, size_t *gen_size)
 {
   static const char *lmod_c_names[] = {
     [OPLM_UNSPEC] = "???",
@@ -9257,6 +11700,7 @@ static void output_hdr(FILE *fout)
   };
   const struct scanned_var *var;
   struct func_prototype *fp;
+  FILE *fout = fout_hdr;
   char line[256] = { 0, };
   char name[256];
   int i;
@@ -9277,8 +11721,7 @@ static void output_hdr(FILE *fout)
 
   // resolve deps
   qsort(hg_fp, hg_fp_cnt, sizeof(hg_fp[0]), hg_fp_cmp_name);
-  for (i = 0; i < hg_fp_cnt; i++)
-    hg_fp_resolve_deps(&hg_fp[i]);
+  hg_fp_resolve_deps();
 
   // adjust functions referenced from data segment
   do_func_refs_from_data();
@@ -9292,6 +11735,11 @@ static void output_hdr(FILE *fout)
   // note: messes up .proto ptr, don't use
   //qsort(hg_fp, hg_fp_cnt, sizeof(hg_fp[0]), hg_fp_cmp_id);
 
+  if (gen != NULL) {
+    fout = open_memstream(gen, gen_size);
+    my_assert_not(fout, NULL);
+  }
+
   // output variables
   for (i = 0; i < hg_var_cnt; i++) {
     var = &hg_vars[i];
@@ -9315,6 +11763,12 @@ static void output_hdr(FILE *fout)
   // output function prototypes
   output_hdr_fp(fout, hg_fp, hg_fp_cnt);
 
+  if (gen != NULL) {
+    fclose(fout);
+    fout = fout_hdr;
+    fwrite(*gen, 1, *gen_size, fout);
+  }
+
   // seed passthrough
   fprintf(fout, "\n// - seed -\n");
 
@@ -9358,16 +11812,123 @@ static char *next_word_s(char *w, size_t wsize, char *s)
   return s + i;
 }
 
-static int cmpstringp(const void *p1, const void *p2)
+// names of functions to skip, with open addressing hash of index + 1
+static char **g_rlist;
+static int g_rlist_len;
+static int *g_rlist_hash;
+static int g_rlist_hash_size;
+
+static unsigned int rlist_hash(const char *name, int len)
+{
+  unsigned int h = 0;
+
+  for (; len > 0; name++, len--)
+    h = h * 31 + (unsigned char)*name;
+
+  return h;
+}
+
+// returns the hash slot for name[len], empty if it's not in the list
+static int *rlist_slot(const char *name, int len)
+{
+  const char *r;
+  unsigned int h;
+
+  for (h = rlist_hash(name, len); ; h++) {
+    h &= g_rlist_hash_size - 1;
+    if (g_rlist_hash[h] == 0)
+      return &g_rlist_hash[h];
+    r = g_rlist[g_rlist_hash[h] - 1];
+    if (strncmp(r, name, len) == 0 && r[len] == 0)
+      return &g_rlist_hash[h];
+  }
+}
+
+static int rlist_find(const char *name, int len)
+{
+  return *rlist_slot(name, len) != 0;
+}
+
+// .asm input: whole file is mapped and indexed by line,
+// so seeking is just setting g_asm_pos
+static const char *g_asm_text;
+static size_t g_asm_size;
+static size_t *g_asm_lines; // line start offsets, [cnt] = size
+static int g_asm_line_cnt;
+static int g_asm_pos;       // next line to read
+
+static void asm_open(const char *fn)
+{
+  struct stat st;
+  size_t i;
+  int alloc;
+  int fd;
+
+  fd = open(fn, O_RDONLY);
+  my_assert_not(fd, -1);
+  my_assert(fstat(fd, &st), 0);
+  g_asm_size = st.st_size;
+  if (g_asm_size != 0) {
+    g_asm_text = mmap(NULL, g_asm_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    my_assert_not(g_asm_text, MAP_FAILED);
+  }
+  close(fd);
+
+  alloc = g_asm_size / 32 + 16;
+  g_asm_lines = malloc(alloc * sizeof(g_asm_lines[0]));
+  my_assert_not(g_asm_lines, NULL);
+
+  g_asm_lines[g_asm_line_cnt++] = 0;
+  for (i = 0; i < g_asm_size; i++) {
+    if (g_asm_text[i] != '\n')
+      continue;
+    if (g_asm_line_cnt + 1 >= alloc) {
+      alloc *= 2;
+      g_asm_lines = realloc(g_asm_lines, alloc * sizeof(g_asm_lines[0]));
+      my_assert_not(g_asm_lines, NULL);
+    }
+    g_asm_lines[g_asm_line_cnt++] = i + 1;
+  }
+  if (g_asm_lines[g_asm_line_cnt - 1] == g_asm_size)
+    g_asm_line_cnt--; // no partial last line
+  g_asm_lines[g_asm_line_cnt] = g_asm_size;
+  g_asm_pos = 0;
+}
+
+static void asm_close(void)
 {
-  return strcmp(*(char * const *)p1, *(char * const *)p2);
+  if (g_asm_size != 0)
+    munmap((void *)g_asm_text, g_asm_size);
+  free(g_asm_lines);
+  g_asm_text = NULL;
+  g_asm_lines = NULL;
+  g_asm_line_cnt = 0;
 }
 
-static int is_xref_needed(char *p, char **rlist, int rlist_len)
+// copies next line (with newline, like fgets) to *buf, growing it
+static char *asm_getline(char **buf, int *buf_size)
 {
-  char *p2;
+  size_t len;
+
+  if (g_asm_pos >= g_asm_line_cnt)
+    return NULL;
+
+  len = g_asm_lines[g_asm_pos + 1] - g_asm_lines[g_asm_pos];
+  if (len + 1 > *buf_size) {
+    *buf_size = len + 256;
+    *buf = realloc(*buf, *buf_size);
+    my_assert_not(*buf, NULL);
+  }
+  memcpy(*buf, g_asm_text + g_asm_lines[g_asm_pos], len);
+  (*buf)[len] = 0;
+  g_asm_pos++;
+
+  return *buf;
+}
 
-  p = sskip(p);
+static int is_xref_needed(const char *p)
+{
+  p = sskip_c(p);
   if (strstr(p, "..."))
     // unable to determine, assume needed
     return 1;
@@ -9376,326 +11937,1306 @@ static int is_xref_needed(char *p, char **rlist, int rlist_len)
     // ref from other data or non-function -> no
     return 0;
 
-  p2 = strpbrk(p, "+:\r\n\x18");
-  if (p2 != NULL)
-    *p2 = 0;
-  if (bsearch(&p, rlist, rlist_len, sizeof(rlist[0]), cmpstringp))
+  if (rlist_find(p, strcspn(p, "+:\r\n\x18")))
     // referenced from removed code
     return 0;
 
   return 1;
 }
 
-static int ida_xrefs_show_need(FILE *fasm, char *p,
-  char **rlist, int rlist_len)
+// checks the refs comment of a data line
+static int ida_xrefs_show_need(const char *p)
 {
-  int found_need = 0;
-  char line[256];
-  long pos;
-
   p = strrchr(p, ';');
-  if (p != NULL && *p == ';') {
-    if (IS_START(p + 2, "sctref"))
-      return 1;
-    if (IS_START(p + 2, "DATA XREF: ")) {
-      p += 13;
-      if (is_xref_needed(p, rlist, rlist_len))
-        return 1;
-    }
-  }
+  if (p == NULL)
+    return 0;
+  if (IS_START(p + 2, "sctref"))
+    return 1;
+  if (IS_START(p + 2, "DATA XREF: "))
+    return is_xref_needed(p + 13);
 
-  pos = ftell(fasm);
-  while (1)
-  {
-    if (!my_fgets(line, sizeof(line), fasm))
+  return 0;
+}
+
+// checks a comment only line that may continue refs of the last var,
+// returns -1 if it's not one
+static int ida_xrefs_cont_need(const char *line)
+{
+  const char *p;
+
+  // non-first line is always indented
+  if (!my_isblank(line[0]))
+    return -1;
+
+  // should be no content, just comment
+  p = sskip_c(line);
+  if (*p != ';')
+    return -1;
+
+  p = strrchr(p, ';');
+  p += 2;
+
+  if (IS_START(p, "sctref"))
+    return 1;
+
+  // it's printed once, but no harm to check again
+  if (IS_START(p, "DATA XREF: "))
+    p += 11;
+
+  return is_xref_needed(p);
+}
+
+static void scan_var_add(char words[][256], int wordc)
+{
+  struct scanned_var *var;
+  int l;
+
+  if ((hg_var_cnt & 0xff) == 0) {
+    hg_vars = realloc(hg_vars, sizeof(hg_vars[0])
+               * (hg_var_cnt + 0x100));
+    my_assert_not(hg_vars, NULL);
+    memset(hg_vars + hg_var_cnt, 0, sizeof(hg_vars[0]) * 0x100);
+  }
+
+  var = &hg_vars[hg_var_cnt++];
+  snprintf(var->name, sizeof(var->name), "%s", words[0]);
+
+  // maybe already in seed header?
+  var->pp = proto_parse(g_fhdr, var->name, 1);
+  if (var->pp != NULL) {
+    if (var->pp->is_fptr) {
+      var->lmod = OPLM_DWORD;
+      //var->is_ptr = 1;
+    }
+    else if (var->pp->is_func)
+      aerr("func?\n");
+    else if (!guess_lmod_from_c_type(&var->lmod, &var->pp->type))
+      aerr("unhandled C type '%s' for '%s'\n",
+        var->pp->type.name, var->name);
+
+    var->is_seeded = 1;
+    return;
+  }
+
+  if      (IS(words[1], "dd")) {
+    var->lmod = OPLM_DWORD;
+    if (wordc >= 4 && IS(words[2], "offset"))
+      hg_ref_add(words[3]);
+  }
+  else if (IS(words[1], "dw"))
+    var->lmod = OPLM_WORD;
+  else if (IS(words[1], "db")) {
+    var->lmod = OPLM_BYTE;
+    if (wordc >= 3 && (l = strlen(words[2])) > 4) {
+      if (words[2][0] == '\'' && IS(words[2] + l - 2, ",0"))
+        var->is_c_str = 1;
+    }
+  }
+  else if (IS(words[1], "dq"))
+    var->lmod = OPLM_QWORD;
+  //else if (IS(words[1], "dt"))
+  else
+    aerr("type '%s' not known\n", words[1]);
+}
+
+// single pass over the .asm; a var's refs may continue on the
+// following comment lines, so it's kept pending until they end
+static void scan_variables(void)
+{
+  static char *line;
+  static int line_size;
+  char words[4][256];
+  char pwords[4][256];
+  int pending = 0;  // 1 - unknown yet, 2 - needed
+  int no_identifier;
+  char *p = NULL;
+  int pwordc = 0;
+  int wordc;
+  int ret;
+
+  while (g_asm_pos < g_asm_line_cnt)
+  {
+    // skip to next data section
+    while (asm_getline(&line, &line_size))
+    {
+      asmln++;
+
+      p = sskip(line);
+      if (*p == 0 || *p == ';')
+        continue;
+
+      p = sskip(next_word_s(words[0], sizeof(words[0]), p));
+      if (*p == 0 || *p == ';')
+        continue;
+
+      if (*p != 's' || !IS_START(p, "segment para public"))
+        continue;
+
+      break;
+    }
+
+    if (p == NULL || !IS_START(p, "segment para public"))
+      break;
+    p = sskip(p + 19);
+
+    if (!IS_START(p, "'DATA'"))
+      continue;
+
+    // now process it
+    while (asm_getline(&line, &line_size))
+    {
+      asmln++;
+
+      if (pending) {
+        ret = ida_xrefs_cont_need(line);
+        if (ret == 1)
+          pending = 2;
+        if (ret >= 0)
+          continue;
+        if (pending == 2)
+          scan_var_add(pwords, pwordc);
+        pending = 0;
+      }
+
+      p = line;
+      no_identifier = my_isblank(*p);
+
+      p = sskip(p);
+      if (*p == 0 || *p == ';')
+        continue;
+
+      for (wordc = 0; wordc < ARRAY_SIZE(words); wordc++) {
+        words[wordc][0] = 0;
+        p = sskip(next_word_s(words[wordc], sizeof(words[0]), p));
+        if (*p == 0 || *p == ';') {
+          wordc++;
+          break;
+        }
+      }
+
+      if (wordc == 2 && IS(words[1], "ends"))
+        break;
+      if (wordc < 2)
+        continue;
+
+      if (no_identifier) {
+        if (wordc >= 3 && IS(words[0], "dd") && IS(words[1], "offset"))
+          hg_ref_add(words[2]);
+        continue;
+      }
+
+      if (IS_START(words[0], "__IMPORT_DESCRIPTOR_")) {
+        // when this starts, we don't need anything from this section
+        break;
+      }
+
+      // check refs comment(s)
+      pending = ida_xrefs_show_need(p) ? 2 : 1;
+      memcpy(pwords, words, sizeof(pwords));
+      pwordc = wordc;
+    }
+
+    if (pending == 2)
+      scan_var_add(pwords, pwordc);
+    pending = 0;
+  }
+
+  g_asm_pos = 0;
+  asmln = 0;
+}
+
+static void set_label(int i, const char *name)
+{
+  const char *p;
+  int len;
+
+  len = strlen(name);
+  p = strchr(name, ':');
+  if (p != NULL)
+    len = p - name;
+
+  if (g_labels[i] != NULL && !IS_START(g_labels[i], "algn_"))
+    aerr("dupe label '%s' vs '%s'?\n", name, g_labels[i]);
+  free_label(i);
+  g_labels[i] = fa_calloc(len + 1);
+  memcpy(g_labels[i], name, len);
+  g_labels[i][len] = 0;
+  label_hash_add(i);
+}
+
+// "; START OF FUNCTION CHUNK FOR" lines of the whole .asm,
+// sorted by function, then by position
+struct chunk_item {
+  char *name;
+  int pos;    // .asm line index to continue from
+  int asmln;
+};
+
+static struct chunk_item *func_chunks;
+static int func_chunk_cnt;
+
+static int cmp_chunks(const void *p1, const void *p2)
+{
+  const struct chunk_item *c1 = p1, *c2 = p2;
+  int ret;
+
+  ret = strcmp(c1->name, c2->name);
+  if (ret != 0)
+    return ret;
+  return c1->pos - c2->pos;
+}
+
+// one pass over the mapped .asm, so that functions can jump
+// to their chunks wherever they are
+static void build_chunk_index(void)
+{
+  static char *line;
+  static int line_size;
+  int chunk_alloc = 0;
+  char word[256];
+  int oldpos;
+  char *p;
+  int i;
+
+  oldpos = g_asm_pos;
+  g_asm_pos = 0;
+
+  while (asm_getline(&line, &line_size))
+  {
+    p = sskip(line);
+    if (*p != ';')
+      continue;
+
+    // get rid of random tabs
+    for (i = 0; line[i] != 0; i++)
+      if (line[i] == '\t')
+        line[i] = ' ';
+
+    if (p[2] == 'S' && IS_START(p, "; START OF FUNCTION CHUNK FOR "))
+    {
+      next_word(word, sizeof(word), p + 30);
+      if (word[0] == 0) {
+        asmln = g_asm_pos;
+        aerr("missing name for func chunk?\n");
+      }
+
+      if (func_chunk_cnt >= chunk_alloc) {
+        chunk_alloc = chunk_alloc * 2 + 32;
+        func_chunks = realloc(func_chunks,
+          chunk_alloc * sizeof(func_chunks[0]));
+        my_assert_not(func_chunks, NULL);
+      }
+      func_chunks[func_chunk_cnt].pos = g_asm_pos;
+      func_chunks[func_chunk_cnt].name = strdup(word);
+      func_chunks[func_chunk_cnt].asmln = g_asm_pos;
+      func_chunk_cnt++;
+    }
+    else if (IS_START(p, "; sctend"))
       break;
-    // non-first line is always indented
-    if (!my_isblank(line[0]))
+  }
+
+  qsort(func_chunks, func_chunk_cnt, sizeof(func_chunks[0]), cmp_chunks);
+  g_asm_pos = oldpos;
+}
+
+// returns index of the first chunk of a function, -1 if none
+static int find_func_chunks(const char *name)
+{
+  int lo = 0, hi = func_chunk_cnt;
+  int mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (strcmp(func_chunks[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < func_chunk_cnt && IS(func_chunks[lo].name, name))
+    return lo;
+  return -1;
+}
+
+// -shard: C goes to n files in contiguous runs of functions, so that
+// neighbours (which tend to call each other) stay together; runs are
+// balanced by the functions' line counts, found with a quick pre-pass
+static FILE **g_shards;
+static int g_shard_cnt;
+static int *g_func_shard; // func_no -> shard
+static int g_func_shard_cnt;
+
+static void shard_plan(int count)
+{
+  static char *line;
+  static int line_size;
+  int alloc = 0;
+  char word0[256], word1[256];
+  long long total = 0, sum = 0;
+  int in_proc = 0;
+  int oldpos;
+  char *p;
+  int i, s;
+
+  oldpos = g_asm_pos;
+  g_asm_pos = 0;
+
+  // sizes first
+  while (asm_getline(&line, &line_size))
+  {
+    p = sskip(line);
+    if (*p == ';') {
+      if (IS_START(p, "; sctend"))
+        break;
+      continue;
+    }
+    if (*p == 0)
+      continue;
+
+    if (!my_isblank(line[0])) {
+      p = next_word_s(word0, sizeof(word0), p);
+      next_word_s(word1, sizeof(word1), sskip(p));
+      if (IS(word1, "proc")) {
+        if (g_func_shard_cnt >= alloc) {
+          alloc = alloc * 2 + 256;
+          g_func_shard = realloc(g_func_shard,
+            alloc * sizeof(g_func_shard[0]));
+          my_assert_not(g_func_shard, NULL);
+        }
+        g_func_shard[g_func_shard_cnt++] = 0;
+        in_proc = 1;
+        continue;
+      }
+      if (IS(word1, "endp")) {
+        in_proc = 0;
+        continue;
+      }
+    }
+    if (in_proc) {
+      g_func_shard[g_func_shard_cnt - 1]++;
+      total++;
+    }
+  }
+  g_asm_pos = oldpos;
+
+  // shard s ends once the running sum reaches (s + 1) / count of total
+  for (i = s = 0; i < g_func_shard_cnt; i++) {
+    sum += g_func_shard[i];
+    g_func_shard[i] = s;
+    if (s < count - 1 && sum * count >= total * (s + 1))
+      s++;
+  }
+}
+
+static void shards_open(const char *cfn, const char *inc, int count,
+  const char *mode)
+{
+  char fn[256];
+  int len;
+  int i;
+
+  len = strlen(cfn);
+  if (len > 2 && IS(cfn + len - 2, ".c"))
+    len -= 2;
+
+  g_shards = calloc(count, sizeof(g_shards[0]));
+  my_assert_not(g_shards, NULL);
+  g_shard_cnt = count;
+
+  for (i = 0; i < count; i++) {
+    snprintf(fn, sizeof(fn), "%.*s_%d.c", len, cfn, i);
+    g_shards[i] = fopen(fn, mode);
+    if (g_shards[i] == NULL)
+      aerr("can't open %s: %s\n", fn, strerror(errno));
+    fprintf(g_shards[i], "#include \"%s\"\n\n", inc);
+  }
+}
+
+static FILE *shard_fout(int func_no)
+{
+  if (func_no < 0)
+    func_no = 0;
+  // the pre-pass may miss some with odd segment layouts
+  if (func_no >= g_func_shard_cnt)
+    return g_shards[g_shard_cnt - 1];
+  return g_shards[g_func_shard[func_no]];
+}
+
+// -j: functions are dealt round-robin to forked workers, each writes
+// its C to a tmpfile plus "<func_no> <end offset>" lines to an index,
+// parent then stitches the output back together in original order
+struct job {
+  pid_t pid;
+  FILE *fout;
+  FILE *fidx;
+};
+
+static struct job *g_jobs;
+static int g_job_cnt;
+static int g_job_id = -1; // worker's own number, -1 in parent
+
+// closes fout, or all the shards if it's one of them
+static void out_close(FILE *fout)
+{
+  int i;
+
+  if (g_shards == NULL || g_job_id >= 0) {
+    fclose(fout);
+    return;
+  }
+
+  for (i = 0; i < g_shard_cnt; i++)
+    fclose(g_shards[i]);
+  free(g_shards);
+  g_shards = NULL;
+}
+
+// returns 1 in worker, 0 in parent once all workers are started
+static int jobs_start(int count)
+{
+  pid_t pid;
+  int i;
+
+  g_jobs = calloc(count, sizeof(g_jobs[0]));
+  my_assert_not(g_jobs, NULL);
+  g_job_cnt = count;
+
+  for (i = 0; i < count; i++) {
+    g_jobs[i].fout = tmpfile();
+    my_assert_not(g_jobs[i].fout, NULL);
+    g_jobs[i].fidx = tmpfile();
+    my_assert_not(g_jobs[i].fidx, NULL);
+  }
+
+  fflush(NULL);
+  for (i = 0; i < count; i++) {
+    pid = fork();
+    my_assert_not(pid, -1);
+    if (pid == 0) {
+      g_job_id = i;
+      return 1;
+    }
+    g_jobs[i].pid = pid;
+  }
+
+  return 0;
+}
+
+static int jobs_finish(FILE *fout)
+{
+  struct {
+    int func_no;  // next function in this worker's output, -1 if none
+    long end;     // its end offset in the tmpfile
+    long pos;     // what's been copied so far
+  } *h;
+  char buf[4096];
+  int failed = 0;
+  int status;
+  size_t n;
+  long len;
+  int i, best;
+
+  for (i = 0; i < g_job_cnt; i++) {
+    if (waitpid(g_jobs[i].pid, &status, 0) == -1
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      printf("job %d failed\n", i);
+      failed = 1;
+    }
+  }
+  if (failed)
+    return 1;
+
+  h = calloc(g_job_cnt, sizeof(h[0]));
+  my_assert_not(h, NULL);
+
+  for (i = 0; i < g_job_cnt; i++) {
+    rewind(g_jobs[i].fout);
+    rewind(g_jobs[i].fidx);
+    if (fscanf(g_jobs[i].fidx, "%d %ld", &h[i].func_no, &h[i].end) != 2)
+      h[i].func_no = -1;
+  }
+
+  while (1) {
+    best = -1;
+    for (i = 0; i < g_job_cnt; i++) {
+      if (h[i].func_no == -1)
+        continue;
+      if (best == -1 || h[i].func_no < h[best].func_no)
+        best = i;
+    }
+    if (best == -1)
       break;
 
-    // should be no content, just comment
-    p = sskip(line);
-    if (*p != ';')
-      break;
+    if (g_shards != NULL)
+      fout = shard_fout(h[best].func_no);
+    for (len = h[best].end - h[best].pos; len > 0; len -= n) {
+      n = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf),
+            g_jobs[best].fout);
+      my_assert_not(n, 0);
+      fwrite(buf, 1, n, fout);
+    }
+    h[best].pos = h[best].end;
+
+    if (fscanf(g_jobs[best].fidx, "%d %ld",
+          &h[best].func_no, &h[best].end) != 2)
+      h[best].func_no = -1;
+  }
+
+  for (i = 0; i < g_job_cnt; i++) {
+    fclose(g_jobs[i].fout);
+    fclose(g_jobs[i].fidx);
+  }
+  free(h);
+  free(g_jobs);
+  g_jobs = NULL;
+
+  return 0;
+}
+
+// -cache: per-function results kept in a directory, one file per
+// function named by a hash of its parsed lines, attributes and options;
+// the file also lists the protos looked up while translating, those
+// must still be the same for the entry to be used
+struct fc_lookup {
+  char *name;
+  int offset;
+  uint64_t hash;
+};
+
+static const char *g_fc_dir;
+static uint64_t g_fc_hash;      // of current function's lines
+static uint64_t g_fc_key;
+static struct fc_lookup *g_fc_lookups;
+static int g_fc_lookup_cnt;
+
+// fnv64() is in protoparse.h
+static uint64_t fnv64_str(uint64_t h, const char *s)
+{
+  // include the terminator so that "ab","c" != "a","bc"
+  return fnv64(h, s != NULL ? s : "", s != NULL ? strlen(s) + 1 : 1);
+}
+
+static uint64_t fnv64_int(uint64_t h, int v)
+{
+  return fnv64(h, &v, sizeof(v));
+}
+
+static uint64_t fc_type_hash(uint64_t h, const struct parsed_type *t)
+{
+  h = fnv64_str(h, t->name);
+  return fnv64_int(h, t->is_array | (t->is_ptr << 1) | (t->is_struct << 2)
+    | (t->is_retreg << 3) | (t->is_va_list << 4) | (t->is_64bit << 5)
+    | (t->is_float << 6));
+}
+
+static uint64_t fc_pp_hash(uint64_t h, const struct parsed_proto *pp)
+{
+  int i;
+
+  if (pp == NULL)
+    return fnv64_int(h, -1);
+
+  h = fnv64_str(h, pp->name);
+  h = fc_type_hash(h, &pp->type);
+  h = fnv64_int(h, pp->argc);
+  h = fnv64_int(h, pp->argc_stack);
+  h = fnv64_int(h, pp->argc_reg);
+  h = fnv64_int(h, pp->is_func | (pp->is_stdcall << 1)
+    | (pp->is_fastcall << 2) | (pp->is_vararg << 3) | (pp->is_fptr << 4)
+    | (pp->is_import << 5) | (pp->is_noreturn << 6)
+    | (pp->is_unresolved << 7) | (pp->is_guessed << 8)
+    | (pp->is_userstack << 9) | (pp->is_include << 10)
+    | (pp->is_osinc << 11) | (pp->is_cinc << 12) | (pp->is_arg << 13)
+    | (pp->has_structarg << 14) | (pp->has_retreg << 15));
+  for (i = 0; i < pp->argc; i++) {
+    h = fnv64_str(h, pp->arg[i].reg);
+    h = fc_type_hash(h, &pp->arg[i].type);
+    h = fc_pp_hash(h, pp->arg[i].pp);
+  }
+  return h;
+}
+
+static void fc_line(char words[][256], int wordc)
+{
+  int i;
+
+  if (g_fc_dir == NULL)
+    return;
+  for (i = 0; i < wordc; i++)
+    g_fc_hash = fnv64_str(g_fc_hash, words[i]);
+  g_fc_hash = fnv64_str(g_fc_hash, "\n");
+}
+
+static void fc_lookup_cb(const char *name, int offset,
+  const struct parsed_proto *pp)
+{
+  struct fc_lookup *l;
+  int i;
+
+  for (i = 0; i < g_fc_lookup_cnt; i++)
+    if (g_fc_lookups[i].offset == offset && IS(g_fc_lookups[i].name, name))
+      return;
+
+  if ((g_fc_lookup_cnt & 0xff) == 0) {
+    g_fc_lookups = realloc(g_fc_lookups,
+      sizeof(g_fc_lookups[0]) * (g_fc_lookup_cnt + 0x100));
+    my_assert_not(g_fc_lookups, NULL);
+  }
+  l = &g_fc_lookups[g_fc_lookup_cnt++];
+  l->name = fa_strdup(name);
+  l->offset = offset;
+  l->hash = fc_pp_hash(FNV64_INIT, pp);
+}
+
+// called at 'proc', starts collecting lines and lookups
+static void fc_func_start(void)
+{
+  if (g_fc_dir == NULL)
+    return;
+
+  g_fc_lookup_cnt = 0;
+  g_fc_hash = FNV64_INIT;
+  pp_lookup_cb = fc_lookup_cb;
+}
+
+static void fc_fn(char *buf, size_t size)
+{
+  snprintf(buf, size, "%s/%016llx.fc", g_fc_dir,
+    (unsigned long long)g_fc_key);
+}
+
+// try to take current function from the cache,
+// emits C into fout, or restores hg_fp entry in header mode
+static int fc_load(FILE *fout, const char *funcn, int opcnt)
+{
+  const struct parsed_proto *pp;
+  struct func_prototype *fp;
+  struct func_proto_dep *dep;
+  char buf[4096], name[256];
+  unsigned long long hash;
+  int cnt, offset, v[8];
+  long len;
+  size_t n;
+  FILE *f;
+  int i;
+
+  // validation lookups are not for recording
+  pp_lookup_cb = NULL;
+  g_fc_key = fnv64_str(g_fc_hash, funcn);
+  g_fc_key = fnv64_int(g_fc_key, opcnt);
+  g_fc_key = fnv64_int(g_fc_key, g_ida_func_attr);
+  g_fc_key = fnv64_int(g_fc_key, g_sct_func_attr);
+  g_fc_key = fnv64_int(g_fc_key, g_stack_clear_start);
+  g_fc_key = fnv64_int(g_fc_key, g_stack_clear_len);
+  g_fc_key = fnv64_int(g_fc_key, g_regmask_init);
+  g_fc_key = fnv64_int(g_fc_key, g_regmask_rm);
+  g_fc_key = fnv64_int(g_fc_key, g_header_mode | (g_allow_regfunc << 1)
+               | (g_allow_user_icall << 2) | (g_nowarn_reguse << 3));
+  // anything else about this build of translate
+  g_fc_key = fnv64_str(g_fc_key, __DATE__ " " __TIME__);
+
+  fc_fn(buf, sizeof(buf));
+  f = fopen(buf, "r");
+  if (f == NULL) {
+    pp_lookup_cb = fc_lookup_cb;
+    return 0;
+  }
+
+  if (fscanf(f, "%d\n", &cnt) != 1)
+    goto fail;
+  for (i = 0; i < cnt; i++) {
+    if (fscanf(f, "%255s %d %llx\n", name, &offset, &hash) != 3)
+      goto fail;
+    if (offset < 0)
+      pp = proto_parse(g_fhdr, name, 1);
+    else
+      pp = proto_lookup_struct(g_fhdr, name, offset);
+    if (fc_pp_hash(FNV64_INIT, pp) != hash)
+      goto fail;
+  }
+
+  if (!g_header_mode) {
+    if (fscanf(f, "c %ld\n", &len) != 1)
+      goto fail;
+    for (; len > 0; len -= n) {
+      n = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf), f);
+      if (n == 0)
+        goto fail;
+      fwrite(buf, 1, n, fout);
+    }
+  }
+  else {
+    if (fscanf(f, "fp %d", &cnt) != 1)
+      goto fail;
+    if (cnt >= 0) {
+      if (fscanf(f, " %d %x %x %d %d %d %d\n", &v[0], &v[1], &v[2],
+            &v[3], &v[4], &v[5], &v[6]) != 7)
+        goto fail;
+      fp = hg_fp_add(funcn);
+      fp->argc_stack = v[0];
+      fp->regmask_dep = v[1];
+      fp->regmask_use = v[2];
+      fp->has_ret = v[3];
+      fp->has_ret64 = v[4];
+      fp->is_stdcall = v[5];
+      fp->eax_pass = v[6];
+      for (i = 0; i < cnt; i++) {
+        if (fscanf(f, "%255s %x %d %d %d %d\n", name, &v[0], &v[1],
+              &v[2], &v[3], &v[4]) != 6)
+          aerr("%s: truncated cache entry\n", funcn);
+        hg_fp_add_dep(fp, name, v[4]);
+        dep = &fp->dep_func[fp->dep_func_cnt - 1];
+        dep->regmask_live = v[0];
+        dep->ret_dep = v[1];
+        dep->has_ret = v[2];
+        dep->has_ret64 = v[3];
+      }
+    }
+  }
+
+  fclose(f);
+  return 1;
+
+fail:
+  fclose(f);
+  pp_lookup_cb = fc_lookup_cb;
+  return 0;
+}
 
-    p = strrchr(p, ';');
-    p += 2;
+// store what gen_func() wrote to fout since fout_start,
+// or the hg_fp entry made by gen_hdr()
+static void fc_save(FILE *fout, long fout_start, const char *funcn)
+{
+  const struct func_prototype *fp = NULL;
+  const struct func_proto_dep *dep;
+  char fn[4096], fn_tmp[4096 + 16];
+  char buf[4096];
+  long len, end;
+  size_t n;
+  FILE *f;
+  int i;
 
-    if (IS_START(p, "sctref")) {
-      found_need = 1;
-      break;
-    }
+  pp_lookup_cb = NULL;
+  fc_fn(fn, sizeof(fn));
+  snprintf(fn_tmp, sizeof(fn_tmp), "%s.%d", fn, (int)getpid());
+  f = fopen(fn_tmp, "w");
+  if (f == NULL)
+    return;
 
-    // it's printed once, but no harm to check again
-    if (IS_START(p, "DATA XREF: "))
-      p += 11;
+  fprintf(f, "%d\n", g_fc_lookup_cnt);
+  for (i = 0; i < g_fc_lookup_cnt; i++)
+    fprintf(f, "%s %d %llx\n", g_fc_lookups[i].name,
+      g_fc_lookups[i].offset, (unsigned long long)g_fc_lookups[i].hash);
 
-    if (is_xref_needed(p, rlist, rlist_len)) {
-      found_need = 1;
-      break;
+  if (!g_header_mode) {
+    fflush(fout);
+    end = ftell(fout);
+    fprintf(f, "c %ld\n", end - fout_start);
+    fseek(fout, fout_start, SEEK_SET);
+    for (len = end - fout_start; len > 0; len -= n) {
+      n = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf), fout);
+      my_assert_not(n, 0);
+      fwrite(buf, 1, n, f);
+    }
+    fseek(fout, end, SEEK_SET);
+  }
+  else {
+    if (hg_fp_cnt > 0 && IS(hg_fp[hg_fp_cnt - 1].name, funcn))
+      fp = &hg_fp[hg_fp_cnt - 1];
+    if (fp == NULL)
+      // was in the seed header
+      fprintf(f, "fp -1\n");
+    else {
+      fprintf(f, "fp %d %d %x %x %d %d %d %d\n", fp->dep_func_cnt,
+        fp->argc_stack, fp->regmask_dep, fp->regmask_use, fp->has_ret,
+        fp->has_ret64, fp->is_stdcall, fp->eax_pass);
+      for (i = 0; i < fp->dep_func_cnt; i++) {
+        dep = &fp->dep_func[i];
+        fprintf(f, "%s %x %d %d %d %d\n", dep->name, dep->regmask_live,
+          dep->ret_dep, dep->has_ret, dep->has_ret64, dep->ptr_taken);
+      }
     }
   }
-  fseek(fasm, pos, SEEK_SET);
-  return found_need;
+
+  if (ferror(f) | fclose(f))
+    remove(fn_tmp);
+  else if (rename(fn_tmp, fn) != 0)
+    remove(fn_tmp);
 }
 
-static void scan_variables(FILE *fasm, char **rlist, int rlist_len)
+static void rlist_add(const char *name)
 {
-  struct scanned_var *var;
-  char line[256] = { 0, };
-  char words[4][256];
-  int no_identifier;
-  char *p = NULL;
-  int wordc;
-  int l;
+  int *slot;
+  int i;
 
-  while (!feof(fasm))
-  {
-    // skip to next data section
-    while (my_fgets(line, sizeof(line), fasm))
-    {
-      asmln++;
+  if (g_rlist_len * 2 >= g_rlist_hash_size) {
+    g_rlist_hash_size = g_rlist_hash_size ? g_rlist_hash_size * 2 : 0x100;
+    free(g_rlist_hash);
+    g_rlist_hash = calloc(g_rlist_hash_size, sizeof(g_rlist_hash[0]));
+    my_assert_not(g_rlist_hash, NULL);
+    for (i = 0; i < g_rlist_len; i++)
+      *rlist_slot(g_rlist[i], strlen(g_rlist[i])) = i + 1;
+  }
 
-      p = sskip(line);
-      if (*p == 0 || *p == ';')
-        continue;
+  slot = rlist_slot(name, strlen(name));
+  if (*slot != 0)
+    return;
 
-      p = sskip(next_word_s(words[0], sizeof(words[0]), p));
-      if (*p == 0 || *p == ';')
-        continue;
+  if ((g_rlist_len & 0xff) == 0) {
+    g_rlist = realloc(g_rlist, sizeof(g_rlist[0]) * (g_rlist_len + 0x100));
+    my_assert_not(g_rlist, NULL);
+  }
+  g_rlist[g_rlist_len] = strdup(name);
+  my_assert_not(g_rlist[g_rlist_len], NULL);
+  *slot = ++g_rlist_len;
+}
 
-      if (*p != 's' || !IS_START(p, "segment para public"))
-        continue;
+static void rlist_free(void)
+{
+  int i;
 
-      break;
-    }
+  for (i = 0; i < g_rlist_len; i++)
+    free(g_rlist[i]);
+  free(g_rlist);
+  free(g_rlist_hash);
+  g_rlist = NULL;
+  g_rlist_hash = NULL;
+  g_rlist_len = g_rlist_hash_size = 0;
+}
 
-    if (p == NULL || !IS_START(p, "segment para public"))
-      break;
-    p = sskip(p + 19);
+// reads names of functions to skip
+static void rlist_read(char **fns, int fn_cnt)
+{
+  char rline[256];
+  char word[256];
+  FILE *frlist;
+  int skip_func;
+  char *p;
+  int i;
 
-    if (!IS_START(p, "'DATA'"))
-      continue;
+  // needs special handling..
+  rlist_add("__alloca_probe");
 
-    // now process it
-    while (my_fgets(line, sizeof(line), fasm))
-    {
-      asmln++;
+  for (i = 0; i < fn_cnt; i++) {
+    skip_func = 0;
 
-      p = line;
-      no_identifier = my_isblank(*p);
+    frlist = fopen(fns[i], "r");
+    my_assert_not(frlist, NULL);
 
-      p = sskip(p);
+    while (my_fgets(rline, sizeof(rline), frlist)) {
+      p = sskip(rline);
       if (*p == 0 || *p == ';')
         continue;
-
-      for (wordc = 0; wordc < ARRAY_SIZE(words); wordc++) {
-        words[wordc][0] = 0;
-        p = sskip(next_word_s(words[wordc], sizeof(words[0]), p));
-        if (*p == 0 || *p == ';') {
-          wordc++;
-          break;
+      if (*p == '#') {
+        if (IS_START(p, "#if 0")
+         || (g_allow_regfunc && IS_START(p, "#if NO_REGFUNC")))
+        {
+          skip_func = 1;
         }
-      }
-
-      if (wordc == 2 && IS(words[1], "ends"))
-        break;
-      if (wordc < 2)
-        continue;
-
-      if (no_identifier) {
-        if (wordc >= 3 && IS(words[0], "dd") && IS(words[1], "offset"))
-          hg_ref_add(words[2]);
+        else if (IS_START(p, "#endif"))
+          skip_func = 0;
         continue;
       }
-
-      if (IS_START(words[0], "__IMPORT_DESCRIPTOR_")) {
-        // when this starts, we don't need anything from this section
-        break;
-      }
-
-      // check refs comment(s)
-      if (!ida_xrefs_show_need(fasm, p, rlist, rlist_len))
+      if (skip_func)
         continue;
 
-      if ((hg_var_cnt & 0xff) == 0) {
-        hg_vars = realloc(hg_vars, sizeof(hg_vars[0])
-                   * (hg_var_cnt + 0x100));
-        my_assert_not(hg_vars, NULL);
-        memset(hg_vars + hg_var_cnt, 0, sizeof(hg_vars[0]) * 0x100);
-      }
-
-      var = &hg_vars[hg_var_cnt++];
-      snprintf(var->name, sizeof(var->name), "%s", words[0]);
-
-      // maybe already in seed header?
-      var->pp = proto_parse(g_fhdr, var->name, 1);
-      if (var->pp != NULL) {
-        if (var->pp->is_fptr) {
-          var->lmod = OPLM_DWORD;
-          //var->is_ptr = 1;
-        }
-        else if (var->pp->is_func)
-          aerr("func?\n");
-        else if (!guess_lmod_from_c_type(&var->lmod, &var->pp->type))
-          aerr("unhandled C type '%s' for '%s'\n",
-            var->pp->type.name, var->name);
-
-        var->is_seeded = 1;
+      p = next_word(word, sizeof(word), p);
+      if (word[0] == 0)
         continue;
-      }
 
-      if      (IS(words[1], "dd")) {
-        var->lmod = OPLM_DWORD;
-        if (wordc >= 4 && IS(words[2], "offset"))
-          hg_ref_add(words[3]);
-      }
-      else if (IS(words[1], "dw"))
-        var->lmod = OPLM_WORD;
-      else if (IS(words[1], "db")) {
-        var->lmod = OPLM_BYTE;
-        if (wordc >= 3 && (l = strlen(words[2])) > 4) {
-          if (words[2][0] == '\'' && IS(words[2] + l - 2, ",0"))
-            var->is_c_str = 1;
-        }
-      }
-      else if (IS(words[1], "dq"))
-        var->lmod = OPLM_QWORD;
-      //else if (IS(words[1], "dt"))
-      else
-        aerr("type '%s' not known\n", words[1]);
+      rlist_add(word);
     }
-  }
 
-  rewind(fasm);
-  asmln = 0;
+    fclose(frlist);
+  }
 }
 
-static void set_label(int i, const char *name)
+// translate the parsed function, or collect its proto in header mode
+static FILE *func_gen(FILE *fout, int func_no, int opcnt)
 {
-  const char *p;
-  int len;
-
-  len = strlen(name);
-  p = strchr(name, ':');
-  if (p != NULL)
-    len = p - name;
-
-  if (g_labels[i] != NULL && !IS_START(g_labels[i], "algn_"))
-    aerr("dupe label '%s' vs '%s'?\n", name, g_labels[i]);
-  g_labels[i] = realloc(g_labels[i], len + 1);
-  my_assert_not(g_labels[i], NULL);
-  memcpy(g_labels[i], name, len);
-  g_labels[i][len] = 0;
-}
+  if (g_shards != NULL && g_job_id < 0)
+    fout = shard_fout(func_no);
+  prof_func_start(g_func, opcnt);
+  if (g_fc_dir == NULL || !fc_load(fout, g_func, opcnt)) {
+    long fout_start = ftell(fout);
 
-struct chunk_item {
-  char *name;
-  long fptr;
-  int asmln;
+    if (g_header_mode)
+      gen_hdr(g_func, opcnt);
+    else
+      gen_func(fout, g_fhdr, g_func, opcnt);
+    if (g_fc_dir != NULL)
+      fc_save(fout, fout_start, g_func);
+  }
+  prof_func_end();
+  if (g_job_id >= 0)
+    fprintf(g_jobs[g_job_id].fidx, "%d %ld\n", func_no, ftell(fout));
+
+  return fout;
+}
+
+// drop the per-function state left by parsing and gen_*()
+static void func_reset(int opcnt)
+{
+  g_ida_func_attr = 0;
+  g_sct_func_attr = 0;
+  g_stack_clear_start = 0;
+  g_stack_clear_len = 0;
+  g_regmask_init = 0;
+  g_regmask_rm = 0;
+  g_skip_func = 0;
+  g_func[0] = 0;
+  g_seh_found = 0;
+  if (opcnt != 0) {
+    memset(ops, 0, opcnt * sizeof(ops[0]));
+    clear_labels(opcnt);
+  }
+  fa_reset();
+  g_eqcnt = 0;
+  g_func_pd_cnt = 0;
+  g_func_lmods = 0;
+}
+
+// -hc: functions as parsed by the header pass, so that the C pass
+// doesn't need to go through the .asm again. Ops are kept as they
+// were before gen_hdr(), those that looked up the header keep their
+// words too and get parsed again against the generated one.
+struct hc_func {
+  int func_no;
+  int opcnt;
+  int ida_func_attr;
+  int sct_func_attr;
+  int stack_clear_start;
+  int stack_clear_len;
+  int regmask_init;
+  int regmask_rm;
+  int seh_found;
+  int func_lmods;     // from ops that are not parsed again
+  int eqcnt;
+  int pd_cnt;
+  uint64_t fc_hash;
+  size_t ops_ofs;     // in g_hc_buf: per op words, op, label
+  size_t ofs;         // name, equs, jumptables, label after last op
 };
 
-static struct chunk_item *func_chunks;
-static int func_chunk_cnt;
-static int func_chunk_alloc;
+static struct hc_func *g_hc_funcs;
+static int g_hc_cnt;
+static int g_hc_alloc;
+static char *g_hc_buf;
+static size_t g_hc_size;
+static size_t g_hc_buf_alloc;
+static size_t g_hc_end;   // of last kept function's data
+static int g_hc_lmods;
 
-static void add_func_chunk(FILE *fasm, const char *name, int line)
+static void hc_put(const void *data, size_t size)
 {
-  if (func_chunk_cnt >= func_chunk_alloc) {
-    func_chunk_alloc *= 2;
-    func_chunks = realloc(func_chunks,
-      func_chunk_alloc * sizeof(func_chunks[0]));
-    my_assert_not(func_chunks, NULL);
+  if (g_hc_size + size > g_hc_buf_alloc) {
+    g_hc_buf_alloc = g_hc_buf_alloc * 2 + size + 0x10000;
+    g_hc_buf = realloc(g_hc_buf, g_hc_buf_alloc);
+    my_assert_not(g_hc_buf, NULL);
   }
-  func_chunks[func_chunk_cnt].fptr = ftell(fasm);
-  func_chunks[func_chunk_cnt].name = strdup(name);
-  func_chunks[func_chunk_cnt].asmln = line;
-  func_chunk_cnt++;
+  memcpy(g_hc_buf + g_hc_size, data, size);
+  g_hc_size += size;
 }
 
-static int cmp_chunks(const void *p1, const void *p2)
+static void hc_put_str(const char *s)
 {
-  const struct chunk_item *c1 = p1, *c2 = p2;
-  return strcmp(c1->name, c2->name);
+  hc_put(s != NULL ? s : "", s != NULL ? strlen(s) + 1 : 1);
 }
 
-static void scan_ahead_for_chunks(FILE *fasm)
+static const char *hc_get(const char *p, void *data, size_t size)
 {
-  char words[2][256];
-  char line[256];
-  long oldpos;
-  int oldasmln;
-  int wordc;
-  char *p;
-  int i;
+  memcpy(data, p, size);
+  return p + size;
+}
 
-  oldpos = ftell(fasm);
-  oldasmln = asmln;
+// called at 'proc', drops whatever a skipped function left
+static void hc_func_start(void)
+{
+  g_hc_size = g_hc_end;
+  g_hc_lmods = 0;
+}
 
-  while (my_fgets(line, sizeof(line), fasm))
-  {
-    wordc = 0;
-    asmln++;
+// what parse_op() sets, packed
+struct hc_op {
+  unsigned short op;
+  unsigned char pfo;
+  unsigned char pfo_inv;
+  unsigned char operand_cnt;
+  unsigned char lmod;
+  unsigned char opr_cnt;  // stored operands, not always operand_cnt
+  unsigned char has_datap;
+  unsigned int flags;
+  int regmask_src;
+  int regmask_dst;
+  int asmln;
+};
 
-    p = sskip(line);
-    if (*p == 0)
-      continue;
+struct hc_opr {
+  unsigned char type;
+  unsigned char lmod;
+  signed char reg;
+  unsigned char bits;     // is_ptr..size_lt
+  unsigned char segment;
+  unsigned int val;
+};
 
-    if (*p == ';')
-    {
-      // get rid of random tabs
-      for (i = 0; line[i] != 0; i++)
-        if (line[i] == '\t')
-          line[i] = ' ';
+static void hc_op_put(int i)
+{
+  static const struct parsed_opr opr_none;
+  const struct parsed_op *po = &ops[i];
+  const struct parsed_opr *opr;
+  struct hc_opr ho;
+  struct hc_op h;
+  int j;
 
-      if (p[2] == 'S' && IS_START(p, "; START OF FUNCTION CHUNK FOR "))
-      {
-        p += 30;
-        next_word(words[0], sizeof(words[0]), p);
-        if (words[0][0] == 0)
-          aerr("missing name for func chunk?\n");
+  memset(&h, 0, sizeof(h));
+  h.op = po->op;
+  h.pfo = po->pfo;
+  h.pfo_inv = po->pfo_inv;
+  h.operand_cnt = po->operand_cnt;
+  h.lmod = po->lmod;
+  h.opr_cnt = MAX_OPERANDS;
+  while (h.opr_cnt > 0 && !memcmp(&po->operand[h.opr_cnt - 1], &opr_none,
+                            sizeof(opr_none)))
+    h.opr_cnt--;
+  h.has_datap = po->datap != NULL;
+  h.flags = po->flags;
+  h.regmask_src = po->regmask_src;
+  h.regmask_dst = po->regmask_dst;
+  h.asmln = po->asmln;
+  hc_put(&h, sizeof(h));
+
+  for (j = 0; j < h.opr_cnt; j++) {
+    opr = &po->operand[j];
+    memset(&ho, 0, sizeof(ho));
+    ho.type = opr->type;
+    ho.lmod = opr->lmod;
+    ho.reg = opr->reg;
+    ho.bits = opr->is_ptr | (opr->is_array << 1)
+      | (opr->type_from_var << 2) | (opr->size_mismatch << 3)
+      | (opr->size_lt << 4);
+    ho.segment = opr->segment;
+    ho.val = opr->val;
+    hc_put(&ho, sizeof(ho));
+    hc_put_str(opr->name);
+  }
+  if (po->datap != NULL)
+    hc_put_str(po->datap);
+  hc_put_str(g_labels[i]);
+}
+
+// parse_op() for the header pass, keeping the result;
+// wordc == 0 is for ops made without parsing
+static void hc_parse_op(int i, char words[][256], int wordc)
+{
+  size_t start = g_hc_size;
+  int lookups = g_opr_lookups;
+  int lmods = g_func_lmods;
+  unsigned char c = wordc;
+  int w;
+
+  hc_put(&c, 1);
+  for (w = 0; w < wordc; w++)
+    hc_put_str(words[w]);
+
+  if (wordc > 0) {
+    g_func_lmods = 0;
+    parse_op(&ops[i], words, wordc);
+    if (g_opr_lookups == lookups) {
+      g_hc_size = start;
+      c = 0;
+      hc_put(&c, 1);
+      g_hc_lmods |= g_func_lmods;
+    }
+    g_func_lmods |= lmods;
+  }
+
+  hc_op_put(i);
+}
+
+// called once the function is fully parsed, before gen_hdr()
+static void hc_func_end(int func_no, int opcnt)
+{
+  const struct parsed_data *pd;
+  struct hc_func *f;
+  int i, j;
 
-        add_func_chunk(fasm, words[0], asmln);
-      }
-      else if (IS_START(p, "; sctend"))
-        break;
+  if (g_hc_cnt >= g_hc_alloc) {
+    g_hc_alloc = g_hc_alloc * 2 + 64;
+    g_hc_funcs = realloc(g_hc_funcs, g_hc_alloc * sizeof(g_hc_funcs[0]));
+    my_assert_not(g_hc_funcs, NULL);
+  }
+
+  f = &g_hc_funcs[g_hc_cnt];
+  memset(f, 0, sizeof(*f));
+  f->func_no = func_no;
+  f->opcnt = opcnt;
+  f->ida_func_attr = g_ida_func_attr;
+  f->sct_func_attr = g_sct_func_attr;
+  f->stack_clear_start = g_stack_clear_start;
+  f->stack_clear_len = g_stack_clear_len;
+  f->regmask_init = g_regmask_init;
+  f->regmask_rm = g_regmask_rm;
+  f->seh_found = g_seh_found;
+  f->func_lmods = g_hc_lmods;
+  f->eqcnt = g_eqcnt;
+  f->pd_cnt = g_func_pd_cnt;
+  f->fc_hash = g_fc_hash;
+  f->ops_ofs = g_hc_end;
+  f->ofs = g_hc_size;
+
+  hc_put_str(g_func);
+  if (g_eqcnt > 0)
+    hc_put(g_eqs, g_eqcnt * sizeof(g_eqs[0]));
+  for (i = 0; i < g_func_pd_cnt; i++) {
+    pd = &g_func_pd[i];
+    hc_put(pd, sizeof(*pd));
+    for (j = 0; j < pd->count; j++) {
+      if (pd->type == OPT_OFFSET)
+        hc_put_str(pd->d[j].u.label);
+      else
+        hc_put(&pd->d[j].u.val, sizeof(pd->d[j].u.val));
+    }
+  }
+  hc_put_str(g_labels[opcnt]);
+  g_hc_end = g_hc_size;
+  g_hc_cnt++;
+}
 
-      continue;
-    } // *p == ';'
+// set up the function for gen_func() like the .asm parsing would,
+// returns opcnt
+static int hc_func_load(const struct hc_func *f, int *eq_alloc,
+  int *pd_alloc)
+{
+  static char words[64][256];
+  struct parsed_data *pd;
+  struct parsed_opr *opr;
+  struct parsed_op *po;
+  struct hc_opr ho;
+  struct hc_op h;
+  const char *p;
+  void *datap;
+  int i, j, w;
+  int wordc;
 
-    for (wordc = 0; wordc < ARRAY_SIZE(words); wordc++) {
-      words[wordc][0] = 0;
-      p = sskip(next_word_s(words[wordc], sizeof(words[0]), p));
-      if (*p == 0 || *p == ';') {
-        wordc++;
-        break;
+  p = g_hc_buf + f->ofs;
+  strcpy(g_func, p);
+  p += strlen(p) + 1;
+  g_ida_func_attr = f->ida_func_attr;
+  g_sct_func_attr = f->sct_func_attr;
+  g_stack_clear_start = f->stack_clear_start;
+  g_stack_clear_len = f->stack_clear_len;
+  g_regmask_init = f->regmask_init;
+  g_regmask_rm = f->regmask_rm;
+  g_seh_found = f->seh_found;
+  g_func_lmods = f->func_lmods;
+
+  if (f->eqcnt > *eq_alloc) {
+    *eq_alloc = f->eqcnt;
+    g_eqs = realloc(g_eqs, *eq_alloc * sizeof(g_eqs[0]));
+    my_assert_not(g_eqs, NULL);
+  }
+  g_eqcnt = f->eqcnt;
+  p = hc_get(p, g_eqs, g_eqcnt * sizeof(g_eqs[0]));
+
+  if (f->pd_cnt > *pd_alloc) {
+    *pd_alloc = f->pd_cnt;
+    g_func_pd = realloc(g_func_pd, *pd_alloc * sizeof(g_func_pd[0]));
+    my_assert_not(g_func_pd, NULL);
+  }
+  g_func_pd_cnt = f->pd_cnt;
+  for (i = 0; i < g_func_pd_cnt; i++) {
+    pd = &g_func_pd[i];
+    p = hc_get(p, pd, sizeof(*pd));
+    pd->count_alloc = pd->count;
+    pd->d = fa_calloc(pd->count * sizeof(pd->d[0]));
+    for (j = 0; j < pd->count; j++) {
+      if (pd->type == OPT_OFFSET) {
+        pd->d[j].u.label = fa_strdup(p);
+        p += strlen(p) + 1;
       }
+      else
+        p = hc_get(p, &pd->d[j].u.val, sizeof(pd->d[j].u.val));
+      pd->d[j].bt_i = -1;
     }
-
-    if (wordc == 2 && IS(words[1], "ends"))
-      break;
   }
+  if (*p != 0)
+    set_label(f->opcnt, p);
 
-  fseek(fasm, oldpos, SEEK_SET);
-  asmln = oldasmln;
+  fc_func_start();
+  g_fc_hash = f->fc_hash;
+
+  ops_reserve(f->opcnt + 2);
+  p = g_hc_buf + f->ops_ofs;
+  for (i = 0; i < f->opcnt; i++) {
+    po = &ops[i];
+    wordc = (unsigned char)*p++;
+    for (w = 0; w < wordc; w++) {
+      strcpy(words[w], p);
+      p += strlen(p) + 1;
+    }
+
+    p = hc_get(p, &h, sizeof(h));
+    po->op = h.op;
+    po->pfo = h.pfo;
+    po->pfo_inv = h.pfo_inv;
+    po->operand_cnt = h.operand_cnt;
+    po->lmod = h.lmod;
+    po->flags = h.flags;
+    po->regmask_src = h.regmask_src;
+    po->regmask_dst = h.regmask_dst;
+    po->asmln = h.asmln;
+    for (j = 0; j < h.opr_cnt; j++) {
+      opr = &po->operand[j];
+      p = hc_get(p, &ho, sizeof(ho));
+      opr->type = ho.type;
+      opr->lmod = ho.lmod;
+      opr->reg = ho.reg;
+      opr->is_ptr = ho.bits & 1;
+      opr->is_array = (ho.bits >> 1) & 1;
+      opr->type_from_var = (ho.bits >> 2) & 1;
+      opr->size_mismatch = (ho.bits >> 3) & 1;
+      opr->size_lt = (ho.bits >> 4) & 1;
+      opr->segment = ho.segment;
+      opr->val = ho.val;
+      strcpy(opr->name, p);
+      p += strlen(p) + 1;
+    }
+    if (h.has_datap) {
+      po->datap = strdup(p);
+      p += strlen(p) + 1;
+    }
+    if (*p != 0)
+      set_label(i, p);
+    p += strlen(p) + 1;
+
+    if (wordc > 0) {
+      // looked at the header, parse again with the new one
+      datap = po->datap;
+      for (w = wordc; w < ARRAY_SIZE(words); w++)
+        words[w][0] = 0;
+      asmln = po->asmln;
+      memset(po, 0, sizeof(*po));
+      parse_op(po, words, wordc);
+      po->datap = datap;
+    }
+  }
+
+  return f->opcnt;
 }
 
 int main(int argc, char *argv[])
 {
-  FILE *fout, *fasm, *frlist;
+  FILE *fout;
   struct parsed_data *pd = NULL;
   int pd_alloc = 0;
-  char **rlist = NULL;
-  int rlist_len = 0;
-  int rlist_alloc = 0;
   int func_chunks_used = 0;
-  int func_chunks_sorted = 0;
   int func_chunk_i = -1;
-  long func_chunk_ret = 0;
+  int func_chunk_ret = 0;
   int func_chunk_ret_ln = 0;
-  int scanned_ahead = 0;
-  char line[256];
-  char words[20][256];
+  char *line = NULL;
+  int line_size = 0;
+  char words[64][256];
   enum opr_lenmod lmod;
   char *sctproto = NULL;
   int in_func = 0;
@@ -9706,7 +13247,20 @@ int main(int argc, char *argv[])
   int eq_alloc;
   int verbose = 0;
   int multi_seg = 0;
+  int job_count = 1;
+  const char *prof_csv = NULL;
+  int func_no = -1;
   int end = 0;
+  const char *hdr_out = NULL;
+  const struct hc_func *hcf;
+  int hc_collect = 0;
+  int hc_pass = 0;
+  char *hc_gen = NULL;
+  size_t hc_gen_size = 0;
+  const char *shard_inc = NULL;
+  int shard_count = 0;
+  int allow_regfunc;
+  int arg_rlist;
   int arg_out;
   int arg;
   int pi = 0;
@@ -9714,6 +13268,7 @@ int main(int argc, char *argv[])
   int ret, len;
   char *p, *p2;
   int wordc;
+  FILE *f;
 
   for (arg = 1; arg < argc; arg++) {
     if (IS(argv[arg], "-v"))
@@ -9728,6 +13283,20 @@ int main(int argc, char *argv[])
       multi_seg = 1;
     else if (IS(argv[arg], "-hdr"))
       g_header_mode = g_quiet_pp = g_allow_regfunc = 1;
+    else if (IS(argv[arg], "-hc") && arg + 1 < argc)
+      hdr_out = argv[++arg];
+    else if (IS(argv[arg], "-j") && arg + 1 < argc)
+      job_count = atoi(argv[++arg]);
+    else if (IS(argv[arg], "-cache") && arg + 1 < argc)
+      g_fc_dir = argv[++arg];
+    else if (IS(argv[arg], "-shard") && arg + 2 < argc) {
+      shard_count = atoi(argv[++arg]);
+      shard_inc = argv[++arg];
+    }
+    else if (IS(argv[arg], "-prof") && arg + 1 < argc) {
+      g_prof = 1;
+      prof_csv = argv[++arg];
+    }
     else
       break;
   }
@@ -9735,98 +13304,126 @@ int main(int argc, char *argv[])
   if (argc < arg + 3) {
     printf("usage:\n%s [options] <.c> <.asm> <hdr.h> [rlist]*\n"
            "%s -hdr <out.h> <.asm> <seed.h> [rlist]*\n"
+           "%s -hc <out.h> [options] <.c> <.asm> <seed.h> [rlist]*\n"
            "options:\n"
            "  -hdr - header generation mode\n"
+           "  -hc  - do -hdr to <out.h>, then translate using it\n"
            "  -rf  - allow unannotated indirect calls\n"
            "  -uc  - allow ind. calls/refs to __usercall\n"
            "  -m   - allow multiple .text sections\n"
            "  -wu  - don't warn about bad reg use\n"
+           "  -j <n> - translate in n worker processes (not for -hdr)\n"
+           "  -prof <csv> - time passes/functions, report to stderr and csv\n"
+           "  -cache <dir> - reuse results of unchanged functions\n"
+           "  -shard <n> <inc.h> - write C to <.c>_0.c.. <.c>_<n-1>.c"
+           " instead,\n"
+           "     each starting with #include \"inc.h\"\n"
            "[rlist] is a file with function names to skip,"
            " one per line\n",
-      argv[0], argv[0]);
+      argv[0], argv[0], argv[0]);
     return 1;
   }
 
   arg_out = arg++;
 
+  if (shard_count > 0 && g_header_mode)
+    aerr("-shard is for C output\n");
+
+  allow_regfunc = g_allow_regfunc;
+  if (hdr_out != NULL) {
+    // header pass first, same as -hdr
+    if (g_header_mode)
+      aerr("-hc with -hdr?\n");
+    g_header_mode = g_quiet_pp = g_allow_regfunc = 1;
+    hc_collect = 1;
+  }
+
   asmfn = argv[arg++];
-  fasm = fopen(asmfn, "r");
-  my_assert_not(fasm, NULL);
+  asm_open(asmfn);
 
   hdrfn = argv[arg++];
   g_fhdr = fopen(hdrfn, "r");
   my_assert_not(g_fhdr, NULL);
 
-  rlist_alloc = 64;
-  rlist = malloc(rlist_alloc * sizeof(rlist[0]));
-  my_assert_not(rlist, NULL);
-  // needs special handling..
-  rlist[rlist_len++] = "__alloca_probe";
-
-  func_chunk_alloc = 32;
-  func_chunks = malloc(func_chunk_alloc * sizeof(func_chunks[0]));
-  my_assert_not(func_chunks, NULL);
+  build_chunk_index();
 
   memset(words, 0, sizeof(words));
+  build_op_hash();
+  pp_clone_alloc = fa_calloc;
 
-  for (; arg < argc; arg++) {
-    int skip_func = 0;
-
-    frlist = fopen(argv[arg], "r");
-    my_assert_not(frlist, NULL);
-
-    while (my_fgets(line, sizeof(line), frlist)) {
-      p = sskip(line);
-      if (*p == 0 || *p == ';')
-        continue;
-      if (*p == '#') {
-        if (IS_START(p, "#if 0")
-         || (g_allow_regfunc && IS_START(p, "#if NO_REGFUNC")))
-        {
-          skip_func = 1;
-        }
-        else if (IS_START(p, "#endif"))
-          skip_func = 0;
-        continue;
-      }
-      if (skip_func)
-        continue;
-
-      p = next_word(words[0], sizeof(words[0]), p);
-      if (words[0][0] == 0)
-        continue;
-
-      if (rlist_len >= rlist_alloc) {
-        rlist_alloc = rlist_alloc * 2 + 64;
-        rlist = realloc(rlist, rlist_alloc * sizeof(rlist[0]));
-        my_assert_not(rlist, NULL);
-      }
-      rlist[rlist_len++] = strdup(words[0]);
-    }
+  arg_rlist = arg;
+  rlist_read(argv + arg_rlist, argc - arg_rlist);
 
-    fclose(frlist);
-    frlist = NULL;
+  if (g_fc_dir != NULL) {
+    if (mkdir(g_fc_dir, 0777) != 0 && errno != EEXIST)
+      aerr("can't create %s: %s\n", g_fc_dir, strerror(errno));
   }
 
-  if (rlist_len > 0)
-    qsort(rlist, rlist_len, sizeof(rlist[0]), cmpstringp);
+  if (shard_count > 0)
+    shard_plan(shard_count);
 
-  fout = fopen(argv[arg_out], "w");
-  my_assert_not(fout, NULL);
+  // cache needs to read back what gen_func() writes
+  if (shard_count > 0 && hdr_out == NULL) {
+    shards_open(argv[arg_out], shard_inc, shard_count,
+      g_fc_dir != NULL ? "w+" : "w");
+    fout = g_shards[0];
+  }
+  else {
+    fout = fopen(hdr_out != NULL ? hdr_out : argv[arg_out],
+             g_fc_dir != NULL ? "w+" : "w");
+    my_assert_not(fout, NULL);
+  }
 
   eq_alloc = 128;
   g_eqs = malloc(eq_alloc * sizeof(g_eqs[0]));
   my_assert_not(g_eqs, NULL);
 
-  for (i = 0; i < ARRAY_SIZE(g_label_refs); i++) {
-    g_label_refs[i].i = -1;
-    g_label_refs[i].next = NULL;
+  ops_reserve(256);
+
+  if (g_prof) {
+    // times are per process, so keep everything in this one
+    job_count = 1;
+    g_prof_last = prof_now();
+    if (pp_cache == NULL) {
+      prof_pass(PROF_CACHES);
+      build_caches(g_fhdr);
+      prof_pass(PROF_PARSE);
+    }
   }
 
   if (g_header_mode)
-    scan_variables(fasm, rlist, rlist_len);
+    scan_variables();
+
+next_pass:
+  if (!g_header_mode && job_count > 1) {
+    // share the parsed headers with workers
+    if (pp_cache == NULL)
+      build_caches(g_fhdr);
+    if (!jobs_start(job_count)) {
+      ret = jobs_finish(fout);
+      out_close(fout);
+      asm_close();
+      fclose(g_fhdr);
+      return ret;
+    }
+    fout = g_jobs[g_job_id].fout;
+  }
+
+  for (i = 0; hc_pass && i < g_hc_cnt; i++) {
+    hcf = &g_hc_funcs[i];
+    p = g_hc_buf + hcf->ofs;
+    if (rlist_find(p, strlen(p)))
+      continue;
+    if (g_job_id >= 0 && hcf->func_no % g_job_cnt != g_job_id)
+      continue;
+    pi = hc_func_load(hcf, &eq_alloc, &pd_alloc);
+    fout = func_gen(fout, hcf->func_no, pi);
+    free_label(pi);
+    func_reset(pi);
+    pi = 0;
+  }
 
-  while (my_fgets(line, sizeof(line), fasm))
+  while (!hc_pass && asm_getline(&line, &line_size))
   {
     wordc = 0;
     asmln++;
@@ -9925,18 +13522,6 @@ int main(int argc, char *argv[])
           }
         }
       }
-      else if (p[2] == 'S' && IS_START(p, "; START OF FUNCTION CHUNK FOR "))
-      {
-        p += 30;
-        next_word(words[0], sizeof(words[0]), p);
-        if (words[0][0] == 0)
-          aerr("missing name for func chunk?\n");
-
-        if (!scanned_ahead) {
-          add_func_chunk(fasm, words[0], asmln);
-          func_chunks_sorted = 0;
-        }
-      }
       else if (p[2] == 'E' && IS_START(p, "; END OF FUNCTION CHUNK"))
       {
         if (func_chunk_i >= 0) {
@@ -9944,38 +13529,22 @@ int main(int argc, char *argv[])
             && IS(func_chunks[func_chunk_i].name, g_func))
           {
             // move on to next chunk
-            ret = fseek(fasm, func_chunks[func_chunk_i].fptr, SEEK_SET);
-            if (ret)
-              aerr("seek failed for '%s' chunk #%d\n",
-                g_func, func_chunk_i);
+            g_asm_pos = func_chunks[func_chunk_i].pos;
             asmln = func_chunks[func_chunk_i].asmln;
             func_chunk_i++;
           }
           else {
             if (func_chunk_ret == 0)
               aerr("no return from chunk?\n");
-            fseek(fasm, func_chunk_ret, SEEK_SET);
+            g_asm_pos = func_chunk_ret;
             asmln = func_chunk_ret_ln;
             func_chunk_ret = 0;
             pending_endp = 1;
           }
         }
       }
-      else if (p[2] == 'F' && IS_START(p, "; FUNCTION CHUNK AT ")) {
+      else if (p[2] == 'F' && IS_START(p, "; FUNCTION CHUNK AT "))
         func_chunks_used = 1;
-        p += 20;
-        if (IS_START(g_func, "sub_")) {
-          unsigned long addr = strtoul(p, NULL, 16);
-          unsigned long f_addr = strtoul(g_func + 4, NULL, 16);
-          if (addr > f_addr && !scanned_ahead) {
-            //anote("scan_ahead caused by '%s', addr %lx\n",
-            //  g_func, addr);
-            scan_ahead_for_chunks(fasm);
-            scanned_ahead = 1;
-            func_chunks_sorted = 0;
-          }
-        }
-      }
       continue;
     } // *p == ';'
 
@@ -10023,9 +13592,13 @@ parse_words:
       else if (IS_START(p, "; sctskip_start")) {
         if (in_func) {
           if (!skip_code) {
+            fc_line(words, wordc);
             ops[pi].op = OPP_ABORT;
             ops[pi].asmln = asmln;
+            if (hc_collect)
+              hc_parse_op(pi, words, 0);
             pi++;
+            ops_reserve(pi + 2);
           }
           skip_code = 1;
         }
@@ -10058,6 +13631,7 @@ do_pending_endp:
           && ((words[0][0] == 'd' && words[0][2] == 0)
               || (words[1][0] == 'd' && words[1][2] == 0)))
       {
+        fc_line(words, wordc);
         i = 1;
         if (words[1][0] == 'd' && words[1][2] == 0) {
           // label
@@ -10088,8 +13662,8 @@ do_pending_endp:
 
         if (pd->count_alloc < pd->count + wordc) {
           pd->count_alloc = pd->count_alloc * 2 + 14 + wordc;
-          pd->d = realloc(pd->d, sizeof(pd->d[0]) * pd->count_alloc);
-          my_assert_not(pd->d, NULL);
+          pd->d = fa_grow(pd->d, sizeof(pd->d[0]) * pd->count,
+                    sizeof(pd->d[0]) * pd->count_alloc);
         }
         for (; i < wordc; i++) {
           if (IS(words[i], "offset")) {
@@ -10100,7 +13674,7 @@ do_pending_endp:
           if (p != NULL)
             *p = 0;
           if (pd->type == OPT_OFFSET)
-            pd->d[pd->count].u.label = strdup(words[i]);
+            pd->d[pd->count].u.label = fa_strdup(words[i]);
           else
             pd->d[pd->count].u.val = parse_number(words[i], 0);
           pd->d[pd->count].bt_i = -1;
@@ -10110,43 +13684,18 @@ do_pending_endp:
       }
 
       if (in_func && !g_skip_func) {
-        if (g_header_mode)
-          gen_hdr(g_func, pi);
-        else
-          gen_func(fout, g_fhdr, g_func, pi);
+        if (hc_collect)
+          hc_func_end(func_no, pi);
+        fout = func_gen(fout, func_no, pi);
       }
 
+      func_reset(pi);
       pending_endp = 0;
       in_func = 0;
-      g_ida_func_attr = 0;
-      g_sct_func_attr = 0;
-      g_stack_clear_start = 0;
-      g_stack_clear_len = 0;
-      g_regmask_init = 0;
-      g_regmask_rm = 0;
       skip_warned = 0;
-      g_skip_func = 0;
-      g_func[0] = 0;
-      g_seh_found = 0;
       func_chunks_used = 0;
       func_chunk_i = -1;
-      if (pi != 0) {
-        memset(&ops, 0, pi * sizeof(ops[0]));
-        clear_labels(pi);
-        pi = 0;
-      }
-      g_eqcnt = 0;
-      for (i = 0; i < g_func_pd_cnt; i++) {
-        pd = &g_func_pd[i];
-        if (pd->type == OPT_OFFSET) {
-          for (j = 0; j < pd->count; j++)
-            free(pd->d[j].u.label);
-        }
-        free(pd->d);
-        pd->d = NULL;
-      }
-      g_func_pd_cnt = 0;
-      g_func_lmods = 0;
+      pi = 0;
       pd = NULL;
 
       if (end)
@@ -10159,12 +13708,19 @@ do_pending_endp:
       if (in_func)
         aerr("proc '%s' while in_func '%s'?\n",
           words[0], g_func);
-      p = words[0];
-      if (bsearch(&p, rlist, rlist_len, sizeof(rlist[0]), cmpstringp))
+      if (rlist_find(words[0], strlen(words[0])))
         g_skip_func = 1;
+      func_no++;
+      if (g_job_id >= 0 && func_no % g_job_cnt != g_job_id)
+        g_skip_func = 1; // other worker's
       strcpy(g_func, words[0]);
       set_label(0, words[0]);
       in_func = 1;
+      if (!g_skip_func) {
+        fc_func_start();
+        if (hc_collect)
+          hc_func_start();
+      }
       continue;
     }
 
@@ -10187,27 +13743,13 @@ do_pending_endp:
 
       if (!g_skip_func && func_chunks_used) {
         // start processing chunks
-        struct chunk_item *ci, key = { g_func, 0 };
-
-        func_chunk_ret = ftell(fasm);
+        func_chunk_ret = g_asm_pos;
         func_chunk_ret_ln = asmln;
-        if (!func_chunks_sorted) {
-          qsort(func_chunks, func_chunk_cnt,
-            sizeof(func_chunks[0]), cmp_chunks);
-          func_chunks_sorted = 1;
-        }
-        ci = bsearch(&key, func_chunks, func_chunk_cnt,
-               sizeof(func_chunks[0]), cmp_chunks);
-        if (ci == NULL)
+        func_chunk_i = find_func_chunks(g_func);
+        if (func_chunk_i < 0)
           aerr("'%s' needs chunks, but none found\n", g_func);
-        func_chunk_i = ci - func_chunks;
-        for (; func_chunk_i > 0; func_chunk_i--)
-          if (!IS(func_chunks[func_chunk_i - 1].name, g_func))
-            break;
 
-        ret = fseek(fasm, func_chunks[func_chunk_i].fptr, SEEK_SET);
-        if (ret)
-          aerr("seek failed for '%s' chunk #%d\n", g_func, func_chunk_i);
+        g_asm_pos = func_chunks[func_chunk_i].pos;
         asmln = func_chunks[func_chunk_i].asmln;
         func_chunk_i++;
         continue;
@@ -10225,7 +13767,7 @@ do_pending_endp:
       }
 
       // scan for next text segment
-      while (my_fgets(line, sizeof(line), fasm)) {
+      while (asm_getline(&line, &line_size)) {
         asmln++;
         p = sskip(line);
         if (*p == 0 || *p == ';')
@@ -10241,6 +13783,8 @@ do_pending_endp:
     p = strchr(words[0], ':');
     if (p != NULL) {
       set_label(pi, words[0]);
+      if (in_func && !g_skip_func && !skip_code)
+        fc_line(words, 1);
       continue;
     }
 
@@ -10250,11 +13794,12 @@ do_pending_endp:
           anote("skipping from '%s'\n", g_labels[pi]);
         skip_warned = 1;
       }
-      free(g_labels[pi]);
-      g_labels[pi] = NULL;
+      free_label(pi);
       continue;
     }
 
+    fc_line(words, wordc);
+
     if (wordc > 1 && IS(words[1], "="))
     {
       if (wordc != 5)
@@ -10288,22 +13833,68 @@ do_pending_endp:
       continue;
     }
 
-    if (pi >= ARRAY_SIZE(ops))
-      aerr("too many ops\n");
-
-    parse_op(&ops[pi], words, wordc);
-
+    if (sctproto != NULL && g_fc_dir != NULL)
+      g_fc_hash = fnv64_str(g_fc_hash, sctproto);
+    if (IS(words[0], "call") && g_fc_dir != NULL)
+      // line numbers go to unresolved_call()
+      g_fc_hash = fnv64_int(g_fc_hash, asmln);
     ops[pi].datap = sctproto;
     sctproto = NULL;
+    if (hc_collect)
+      hc_parse_op(pi, words, wordc);
+    else
+      parse_op(&ops[pi], words, wordc);
     pi++;
+    ops_reserve(pi + 2);
+  }
+
+  if (g_header_mode) {
+    prof_pass(PROF_OUTPUT);
+    output_hdr(fout, hc_collect ? &hc_gen : NULL, &hc_gen_size);
+  }
+
+  if (hc_collect) {
+    // -hc: now translate the function table, protos come from
+    // the seed caches with the generated part of the header added
+    fclose(fout);
+    prof_pass(PROF_CACHES);
+    f = fmemopen(hc_gen, hc_gen_size, "r");
+    my_assert_not(f, NULL);
+    if (pp_caches_add(g_fhdr, f, hdr_out) < 0)
+      aerr("can't parse generated %s\n", hdr_out);
+    fclose(f);
+    free(hc_gen);
+    hdrfn = hdr_out;
+    prof_pass(PROF_PARSE);
+
+    hc_collect = 0;
+    hc_pass = 1;
+    g_header_mode = g_quiet_pp = 0;
+    g_allow_regfunc = allow_regfunc;
+    rlist_free();
+    rlist_read(argv + arg_rlist, argc - arg_rlist);
+
+    if (shard_count > 0) {
+      shards_open(argv[arg_out], shard_inc, shard_count,
+        g_fc_dir != NULL ? "w+" : "w");
+      fout = g_shards[0];
+    }
+    else {
+      fout = fopen(argv[arg_out], g_fc_dir != NULL ? "w+" : "w");
+      my_assert_not(fout, NULL);
+    }
+
+    goto next_pass;
   }
 
-  if (g_header_mode)
-    output_hdr(fout);
+  prof_dump(prof_csv);
 
-  fclose(fout);
-  fclose(fasm);
+  if (g_job_id >= 0)
+    fflush(g_jobs[g_job_id].fidx);
+  out_close(fout);
+  asm_close();
   fclose(g_fhdr);
+  free(line);
 
   return 0;
 }